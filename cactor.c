@@ -20,358 +20,4917 @@
  * limitations under that License.
  */
 
+// For CPU affinity
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "cactor.h"
 
 int ca_lib_initialized = 0;
 
-ca_actor_list_node_t* ca_actor_list_head = 0;
-pthread_mutex_t thread_actor_list_mutex;
+// Actors table: chunks are allocated on demand and never freed.
+// Growth and the free slots list are guarded by thread_actor_table_mutex;
+// lookups take no lock.
+ca_actor_t* ca_actors_chunks[CA_ACTORS_MAX_CHUNKS];
+uint32_t ca_actors_high_water = 0;	// Slots ever handed out
+uint32_t ca_actors_free_head = 0;	// Index + 1 of first free slot, 0 if none
+volatile long ca_actors_live = 0;
+// Retired pools, kept for the next ones: guarded by thread_actor_table_mutex
+ca_pool_t* ca_pools_free = 0;
+// ca_join() and ca_wait_actor() callers, and senders waiting for room,
+// that are not tasks: each sleeps on a condition of its own
+pthread_mutex_t thread_join_mutex = PTHREAD_MUTEX_INITIALIZER;
+ca_monitor_t* ca_join_waiters = 0;	// ca_join() callers, till no actor is live
+pthread_mutex_t thread_actor_table_mutex;
 
-ca_msg_list_node_t* ca_msg_list_head = 0;
-pthread_mutex_t thread_msg_list_mutex;
+// Actor running on the current thread, if any
+__thread ca_actor_t* ca_self = 0;
+// Where this thread starts looking for the shortest mailbox in a pool
+__thread unsigned int ca_pool_cursor = 0;
 
-// Private forward declaration
+// Message pools: per-thread caches, plus a global depot of
+// batches of (up to) CA_MSG_BATCH free messages each
+__thread ca_msg_cache_t ca_msg_cache = { 0, 0 };
+ca_msg_batch_t* ca_msg_depot = 0;
+size_t ca_msg_depot_count = 0;
+size_t ca_msg_depot_capacity = 0;
+pthread_mutex_t thread_msg_depot_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Scheduler
+int ca_sched_mode = CA_SCHED_DEFAULT;
+int ca_num_workers = 0;				// 0: one per online CPU
+pthread_once_t ca_workers_once = PTHREAD_ONCE_INIT;
+__thread ca_worker_t* ca_worker = 0;	// Set on worker threads only
+
+ca_worker_t** ca_workers = 0;
+int ca_workers_count = 0;
+
+// Nodes (see ca_node_join()): the shared segment once joined, and
+// the thread moving messages from its rings to our mailboxes
+ca_node_segment_t* ca_node_segment = 0;
+int ca_node_self = 0;				// Our node number
+int ca_node_epoch = 0;				// And its incarnation
+int ca_node_stopping = 0;
+pthread_t ca_node_dispatcher;
+
+// How long thread actors spin before waiting for a message, in ns:
+// negative until ca_lib_init_() picks the default
+long ca_receive_spin = -1;
+
+// Global run queue: tasks made runnable outside of any worker,
+// tasks that yielded, and local deques' overflow
+ca_actor_t* ca_runq_head = 0;
+ca_actor_t* ca_runq_tail = 0;
+long ca_runq_length = 0;
+pthread_mutex_t thread_runq_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Idle workers sleep until ca_idle_seq moves
+int ca_idle_workers = 0;
+unsigned long ca_idle_seq = 0;
+pthread_mutex_t thread_idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  thread_idle_cond = PTHREAD_COND_INITIALIZER;
+
+// Contexts and stacks of exited tasks, ready for reuse
+ca_task_t* ca_task_pool = 0;
+pthread_mutex_t thread_task_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Timers: a table of timers, a wheel of armed ones, served by one thread.
+// All guarded by thread_timers_mutex.
+ca_timer_t* ca_timers_chunks[CA_TIMERS_MAX_CHUNKS];
+uint32_t ca_timers_high_water = 0;
+uint32_t ca_timers_free_head = 0;
+ca_timer_t* ca_wheel[CA_WHEEL_LEVELS][CA_WHEEL_SLOTS];
+uint64_t ca_wheel_used[CA_WHEEL_LEVELS];	// Bit set: slot not empty
+uint64_t ca_wheel_now = 0;					// Last tick processed
+uint64_t ca_wheel_wakeup = UINT64_MAX;		// Next tick the thread looks at
+size_t ca_wheel_count = 0;					// Armed timers
+struct timespec ca_wheel_epoch;				// CLOCK_MONOTONIC at tick 0
+pthread_once_t ca_timers_once = PTHREAD_ONCE_INIT;
+pthread_mutex_t thread_timers_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  thread_timers_cond;
+
+// Statistics: what actors gone left behind, and lock contention.
+// Per-actor counters live in the actors themselves.
+unsigned long ca_actors_spawned = 0;	// Guarded by thread_actor_table_mutex
+unsigned long ca_retired_dropped = 0;
+unsigned long ca_retired_blocked_ns = 0;
+unsigned long ca_lock_contended[CA_LOCK_KINDS];
+
+// Tracing: one ring per thread that has recorded anything, all
+// of them on one list; rings outlive their threads
+int ca_trace_on = 0;
+uint64_t ca_trace_since = 0;		// Ticks when last turned on: nothing older is dumped
+uint64_t ca_trace_since_ns = 0;		// Same instant, in ns
+ca_trace_ring_t* ca_trace_rings = 0;
+uint64_t ca_trace_ring_size = CA_TRACE_RING_SIZE;	// Events per ring allocated from now on
+uint32_t ca_trace_flows = 0;		// Last flow id handed out
+__thread ca_trace_ring_t* ca_trace_ring = 0;
+pthread_key_t ca_trace_key;			// Gives a ring back when its thread exits
+pthread_once_t ca_trace_once = PTHREAD_ONCE_INIT;
+pthread_mutex_t thread_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Private forward declarations
 ca_actor_t* ca_get_thread_info_(ca_actor_id_t id);
+ca_actor_t* ca_target_(ca_actor_id_t* id);
+ca_msg_t* ca_new_msg_(ca_actor_id_t dest_id, unsigned long type, void* data, size_t data_size);
+void ca_delete_msg_(ca_msg_t* ca_msg);
+void ca_unpark_task_(ca_actor_t* ca_actor);
+ca_msg_t* ca_try_dequeue_msg_(ca_actor_t* ca_actor);
+void ca_deliver_msg_(ca_actor_t* ca_actor, ca_msg_t* ca_msg);
+void ca_wake_room_waiters_(ca_actor_t* ca_actor);
+void ca_lock_contended_(pthread_mutex_t* mutex);
+void ca_actor_contended_(ca_actor_t* ca_actor);
+void ca_shared_release_(void* data, size_t data_size);
+void ca_trace_record_(int kind, ca_actor_id_t actor, ca_actor_id_t peer, uint64_t arg, unsigned long type);
+void ca_yield_();
+ca_worker_t* ca_current_worker_();
+int ca_node_send_(ca_actor_id_t src_id, ca_actor_id_t id, int prio, uint32_t call_id, unsigned long type, void* data, size_t data_size, int may_block);
+
+// Atomic helpers (gcc builtins)
+#define CA_ATOMIC_XCHG(p, v)		__atomic_exchange_n(p, v, __ATOMIC_ACQ_REL)
+#define CA_ATOMIC_LOAD(p)			__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define CA_ATOMIC_STORE(p, v)		__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define CA_ATOMIC_ADD(p, v)			__atomic_add_fetch(p, v, __ATOMIC_ACQ_REL)
+#define CA_ATOMIC_OR(p, v)			__atomic_fetch_or(p, v, __ATOMIC_ACQ_REL)
+#define CA_ATOMIC_AND(p, v)			__atomic_fetch_and(p, v, __ATOMIC_ACQ_REL)
+#define CA_ATOMIC_CAS(p, expected, v) \
+	({ __typeof__(*(p)) ca_expected_ = (expected); \
+	   __atomic_compare_exchange_n(p, &ca_expected_, v, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); })
+
+// Statistics counters: no ordering needed, and no RMW where
+// only one thread ever writes
+#define CA_STAT_ADD(p, v)			__atomic_add_fetch(p, v, __ATOMIC_RELAXED)
+#define CA_STAT_BUMP(p, v)			__atomic_store_n(p, *(p) + (v), __ATOMIC_RELAXED)
+#define CA_STAT_READ(p)				__atomic_load_n(p, __ATOMIC_RELAXED)
+
+// Busy-wait hint
+#if defined(__x86_64__) || defined(__i386__)
+#define CA_CPU_RELAX()				__builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CA_CPU_RELAX()				__asm__ __volatile__("yield" ::: "memory")
+#else
+#define CA_CPU_RELAX()				do { } while(0)
+#endif
+
+// Trace events: one relaxed load and a branch while tracing is off;
+// arguments are only evaluated while it is on
+#if CA_TRACE == 1
+#define CA_TRACE_EVENT(kind, actor, peer, arg, type) \
+	do { \
+		if(__builtin_expect(CA_STAT_READ(&ca_trace_on), 0)) { \
+			ca_trace_record_(kind, actor, peer, (uint64_t)(arg), type); \
+		} \
+	} while(0)
+// A message is built: it gets the next flow id, for its receive to
+// link back to
+#define CA_TRACE_SENT(actor, peer, ca_msg) \
+	do { \
+		if(__builtin_expect(CA_STAT_READ(&ca_trace_on), 0)) { \
+			(ca_msg)->seq = __atomic_add_fetch(&ca_trace_flows, 1, __ATOMIC_RELAXED); \
+			ca_trace_record_(CA_TRACE_SEND, actor, peer, (ca_msg)->seq, (ca_msg)->type); \
+		} \
+	} while(0)
+#else
+#define CA_TRACE_EVENT(kind, actor, peer, arg, type)	do { } while(0)
+#define CA_TRACE_SENT(actor, peer, ca_msg)				do { } while(0)
+#endif
+#define CA_TRACE_MSG(kind, actor, peer, ca_msg) \
+	CA_TRACE_EVENT(kind, actor, peer, (ca_msg)->seq, (ca_msg)->type)
+
+/*
+ * Private
+ * Monotonic clock, in nanoseconds
+ */
+uint64_t ca_now_ns_() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Private
+ * Charge the time since 'since' to actor as blocked receiving.
+ * Only the actor itself calls this.
+ */
+void ca_note_blocked_(ca_actor_t* ca_actor, uint64_t since) {
+	uint64_t blocked = ca_now_ns_() - since;
+	CA_STAT_BUMP(&ca_actor->blocked_ns, blocked);
+	CA_TRACE_EVENT(CA_TRACE_WAKEUP, ACTOR_ID(ca_actor), CA_INVALID_ACTOR_ID, blocked, 0);
+}
+
+/*
+ * Private
+ * Set up an empty mailbox
+ */
+void ca_mailbox_init_(ca_mailbox_t* mailbox) {
+#if CA_MAILBOX_LOCKFREE == 1
+	mailbox->stub.next = 0;
+	mailbox->last = &mailbox->stub;
+	mailbox->first = &mailbox->stub;
+#else
+	mailbox->last = 0;
+	mailbox->first = 0;
+#endif
+}
+
+#if CA_MAILBOX_LOCKFREE == 1
+/*
+ * Private
+ * Link a chain of nodes, first to last, at the end of the mailbox.
+ * Safe to call from any number of threads at once.
+ */
+void ca_mailbox_push_(ca_mailbox_t* mailbox, ca_msg_list_node_t* first, ca_msg_list_node_t* last) {
+	last->next = 0;
+	ca_msg_list_node_t* prev = CA_ATOMIC_XCHG(&mailbox->last, last);
+	// Between these two lines the owner may see a truncated queue
+	// and report it as empty: we signal it once linked anyway.
+	CA_ATOMIC_STORE(&prev->next, first);
+}
+#endif
+
+/*
+ * Private
+ * Return the actor's priority lanes, allocating them on first use.
+ * Whoever loses the race to install them frees its own copy.
+ * The lanes then stay with the slot, like its mailbox.
+ */
+ca_prio_lanes_t* ca_prio_lanes_(ca_actor_t* ca_actor) {
+	ca_prio_lanes_t* lanes = CA_ATOMIC_LOAD(&ca_actor->prio_lanes);
+	if(lanes != 0) {
+		return lanes;
+	}
+	void* memory;
+	if(posix_memalign(&memory, CA_CACHE_LINE, sizeof(ca_prio_lanes_t)) != 0) {
+		return 0;
+	}
+	lanes = (ca_prio_lanes_t*)memory;
+	int lane;
+	for(lane = 0; lane < CA_PRIO_REPLY; lane++) {
+		ca_mailbox_init_(&lanes->lanes[lane]);
+	}
+	lanes->queued = 0;
+	if(!CA_ATOMIC_CAS(&ca_actor->prio_lanes, (ca_prio_lanes_t*)0, lanes)) {
+		free(lanes);
+		lanes = CA_ATOMIC_LOAD(&ca_actor->prio_lanes);
+	}
+	return lanes;
+}
 
 /*
  * Private
- * Add message to message list
+ * Append messages first to last, already linked through their
+ * nodes, to their destination actor's mailbox in one go.
+ * Lane 0 is the mailbox proper; others are priority lanes, which
+ * must have been allocated: their bit is set once linked.
+ * Lock-free build: may be called by any thread without guarding.
+ * Fallback build: caller must be guarding that actor's condition mutex.
  */
-void ca_enqueue_msg_(ca_msg_t* ca_msg) {
-	GUARD_SECTION("msgs-ca_enqueue_msg_", thread_msg_list_mutex)
-	ca_msg_list_node_t* ca_msg_node =
-		(ca_msg_list_node_t*)malloc(sizeof(ca_msg_list_node_t));
-	ca_msg_node->msg = ca_msg;
-	ca_msg_node->next = 0;
-	if(ca_msg_list_head == 0) {
-		ca_msg_list_head = ca_msg_node;
+void ca_enqueue_msg_(ca_actor_t* ca_actor, int lane, ca_msg_t* first, ca_msg_t* last) {
+	ca_mailbox_t* mailbox = lane == CA_PRIO_NORMAL ? &ca_actor->mailbox
+		: &CA_ATOMIC_LOAD(&ca_actor->prio_lanes)->lanes[lane - 1];
+#if CA_MAILBOX_LOCKFREE == 1
+	ca_mailbox_push_(mailbox, &first->node, &last->node);
+#else
+	last->node.next = 0;
+	if(mailbox->last == 0) {
+		mailbox->first = &first->node;
 	}
 	else {
-		ca_msg_list_node_t* cur_node;
-		for(cur_node = ca_msg_list_head; ; cur_node = cur_node->next) {
-			if(cur_node->next == 0) {
-				cur_node->next = ca_msg_node;
-				break;
-			}
+		mailbox->last->next = &first->node;
+	}
+	mailbox->last = &last->node;
+#endif
+	if(lane != CA_PRIO_NORMAL) {
+		CA_ATOMIC_OR(&ca_actor->prio_used, 1u << lane);
+	}
+}
+
+/*
+ * Private
+ * Pop the oldest message from the mailbox, or return nothing.
+ * Only ever called by the mailbox owner.
+ * Fallback build: caller must be guarding the actor's condition mutex.
+ */
+ca_msg_t* ca_mailbox_pop_(ca_mailbox_t* mailbox) {
+#if CA_MAILBOX_LOCKFREE == 1
+	ca_msg_list_node_t* first = mailbox->first;
+	ca_msg_list_node_t* next = CA_ATOMIC_LOAD(&first->next);
+	if(first == &mailbox->stub) {
+		if(next == 0) {
+			return 0;
 		}
+		mailbox->first = next;
+		first = next;
+		next = CA_ATOMIC_LOAD(&next->next);
+	}
+	if(next != 0) {
+		mailbox->first = next;
+		return (ca_msg_t*)first;
+	}
+	if(first != CA_ATOMIC_LOAD(&mailbox->last)) {
+		// A producer is half-way through linking: come back later
+		return 0;
+	}
+	// Last message: put stub back behind it so that 'first'
+	// never has to be left dangling
+	ca_mailbox_push_(mailbox, &mailbox->stub, &mailbox->stub);
+	next = CA_ATOMIC_LOAD(&first->next);
+	if(next != 0) {
+		mailbox->first = next;
+		return (ca_msg_t*)first;
 	}
-	LEAVE_SECTION("msgs-ca_enqueue_msg_", thread_msg_list_mutex)
+	return 0;
+#else
+	ca_msg_list_node_t* first = mailbox->first;
+	if(first == 0) {
+		return 0;
+	}
+	mailbox->first = first->next;
+	if(mailbox->first == 0) {
+		mailbox->last = 0;
+	}
+	return (ca_msg_t*)first;
+#endif
 }
 
 /*
  * Private
- * Depending on the value of action:
- *     MSG_RETRIEVE_ACTION -> return next message for current actor, or nothing
- *     MSG_PRUNE_ACTION -> delete all messages for current actor, return last one
+ * Set a message aside, at the end of its type's queue
  */
-ca_msg_t* ca_dequeue_msg_(ca_actor_id_t id, int action) {
-	GUARD_SECTION("msgs-ca_dequeue_msg_", thread_msg_list_mutex)
-	ca_msg_t* ca_msg = 0;
-	ca_msg_list_node_t* cur_node, * prev_node;
-	prev_node = 0;
-	for(cur_node = ca_msg_list_head; cur_node != 0; cur_node = cur_node->next) {
-		if(cur_node->msg->dest_id == id) {
-			ca_msg = cur_node->msg;
-			if(prev_node == 0) {
-				ca_msg_list_head = cur_node->next;
-			}
-			else {
-				prev_node->next = cur_node->next;
+void ca_stash_put_(ca_stash_t* stash, ca_msg_t* ca_msg) {
+	int queue = ca_msg->type < CA_STASH_QUEUES - 1 ? (int)ca_msg->type : CA_STASH_QUEUES - 1;
+	ca_msg->seq = stash->seq++;
+	ca_msg->node.next = 0;
+	if(stash->tail[queue]) {
+		stash->tail[queue]->node.next = &ca_msg->node;
+	}
+	else {
+		stash->head[queue] = ca_msg;
+	}
+	stash->tail[queue] = ca_msg;
+	stash->used |= 1ULL << queue;
+	stash->count++;
+}
+
+/*
+ * Private
+ * Take a message out of a stash queue; prev is the message before
+ * it in that queue, or nothing if it is the head.
+ */
+ca_msg_t* ca_stash_take_(ca_stash_t* stash, int queue, ca_msg_t* prev, ca_msg_t* ca_msg) {
+	ca_msg_t* next = (ca_msg_t*)ca_msg->node.next;
+	if(prev) {
+		prev->node.next = ca_msg->node.next;
+	}
+	else {
+		stash->head[queue] = next;
+	}
+	if(stash->tail[queue] == ca_msg) {
+		stash->tail[queue] = prev;
+	}
+	if(stash->head[queue] == 0) {
+		stash->used &= ~(1ULL << queue);
+	}
+	stash->count--;
+	// Its flow id is long gone: no arrow for it
+	ca_msg->seq = 0;
+	return ca_msg;
+}
+
+/*
+ * Private
+ * Take the oldest stashed message whose type is in type_mask, or nothing.
+ * Only looks at the head of each matching queue.
+ */
+ca_msg_t* ca_stash_take_mask_(ca_stash_t* stash, uint64_t type_mask) {
+	uint64_t queues = stash->used & type_mask;
+	int oldest = -1;
+	while(queues != 0) {
+		int queue = __builtin_ctzll(queues);
+		queues &= queues - 1;
+		if(oldest < 0 || (int32_t)(stash->head[queue]->seq - stash->head[oldest]->seq) < 0) {
+			oldest = queue;
+		}
+	}
+	if(oldest < 0) {
+		return 0;
+	}
+	return ca_stash_take_(stash, oldest, 0, stash->head[oldest]);
+}
+
+/*
+ * Private
+ * Take the oldest stashed message match() accepts, or nothing.
+ * Each queue is walked up to its first match only.
+ */
+ca_msg_t* ca_stash_take_fn_(ca_stash_t* stash, int (*match)(ca_msg_t*, void*), void* arg) {
+	uint64_t queues = stash->used;
+	int oldest = -1;
+	ca_msg_t* oldest_msg = 0;
+	ca_msg_t* oldest_prev = 0;
+	while(queues != 0) {
+		int queue = __builtin_ctzll(queues);
+		queues &= queues - 1;
+		ca_msg_t* prev = 0;
+		ca_msg_t* ca_msg;
+		for(ca_msg = stash->head[queue]; ca_msg; prev = ca_msg, ca_msg = (ca_msg_t*)ca_msg->node.next) {
+			if(oldest_msg && (int32_t)(ca_msg->seq - oldest_msg->seq) > 0) {
+				break;	// Found older elsewhere already
 			}
-			free(cur_node);
-			// If pruning, go through all messages.
-			// If retrieving, simply return the msg found.
-			if(action == MSG_RETRIEVE_ACTION) {
+			if(match(ca_msg, arg)) {
+				oldest = queue;
+				oldest_msg = ca_msg;
+				oldest_prev = prev;
 				break;
 			}
 		}
-		prev_node = cur_node;
 	}
-	LEAVE_SECTION("msgs-ca_dequeue_msg_", thread_msg_list_mutex)
-	return ca_msg;
+	if(oldest < 0) {
+		return 0;
+	}
+	return ca_stash_take_(stash, oldest, oldest_prev, oldest_msg);
 }
 
 /*
  * Private
- * Add actor information to actors list:
- * it's a double-linked list
+ * Return the actor's stash, allocating it on first use, or nothing
+ * if out of memory. Kept with the slot for whoever gets it next.
  */
-void ca_add_actor_to_list_(ca_actor_t* ca_actor) {
-	GUARD_SECTION("actors-ca_add_actor_to_list_", thread_actor_list_mutex)
-	ca_actor_list_node_t* ca_actor_node =
-		(ca_actor_list_node_t*)malloc(sizeof(ca_actor_list_node_t));
-	ca_actor_node->actor = ca_actor;
-	ca_actor_node->next = 0;
-	if(ca_actor_list_head == 0) {
-		ca_actor_node->prev = 0;
-		ca_actor_list_head = ca_actor_node;
+ca_stash_t* ca_stash_of_(ca_actor_t* ca_actor) {
+	if(ca_actor->stash == 0) {
+		ca_actor->stash = (ca_stash_t*)calloc(1, sizeof(ca_stash_t));
 	}
-	else {
-		ca_actor_list_node_t* cur_node;
-		for(cur_node = ca_actor_list_head; ; cur_node = cur_node->next) {
-			if(cur_node->next == 0) {
-				ca_actor_node->prev = cur_node;
-				cur_node->next = ca_actor_node;
-				break;
-			}
+	return ca_actor->stash;
+}
+
+/*
+ * Private
+ * Take a free slot in the calls table, growing it if need be, and
+ * return the future of the call it is for; 0 if out of memory or
+ * CA_CALL_INDEX_MASK + 1 calls are in flight already.
+ * Only the owner ever touches its calls: no locking.
+ */
+ca_future_t ca_call_open_(ca_stash_t* stash) {
+	if(stash->calls_free == 0) {
+		uint32_t size = stash->calls_size ? 2 * stash->calls_size : 16;
+		if(size > CA_CALL_INDEX_MASK + 1) {
+			size = CA_CALL_INDEX_MASK + 1;
 		}
+		if(size == stash->calls_size) {
+			return 0;
+		}
+		ca_call_slot_t* calls = (ca_call_slot_t*)realloc(stash->calls, size * sizeof(ca_call_slot_t));
+		if(calls == 0) {
+			return 0;
+		}
+		uint32_t index;
+		for(index = stash->calls_size; index < size; index++) {
+			// Generation 1 first: no future is 0
+			calls[index].id = (1u << CA_CALL_INDEX_BITS) | index;
+			calls[index].next_free = index + 1 < size ? index + 2 : 0;
+			calls[index].busy = 0;
+			calls[index].reply = 0;
+		}
+		stash->calls_free = stash->calls_size + 1;
+		stash->calls = calls;
+		stash->calls_size = size;
 	}
-	LEAVE_SECTION("actors-ca_add_actor_to_list_", thread_actor_list_mutex)
+	ca_call_slot_t* slot = &stash->calls[stash->calls_free - 1];
+	stash->calls_free = slot->next_free;
+	slot->busy = 1;
+	return slot->id;
 }
 
 /*
  * Private
- * Instantiate and return a new actor:
- * allocate memory, set mutex and condition to default values,
- * set up flag to 0
+ * Return the slot of a call in flight, or nothing if it is over
+ * (or never was ours)
  */
-ca_actor_t* ca_new_actor_() {
-	ca_actor_t* ca_actor = (ca_actor_t*)malloc(sizeof(ca_actor_t));
-	ca_actor->up = 0;
-	pthread_mutex_init(&ca_actor->thread_cond_mutex, 0); // Default
-	pthread_cond_init(&ca_actor->thread_cond, 0); // Default
-	return ca_actor;
+ca_call_slot_t* ca_call_slot_(ca_stash_t* stash, ca_future_t future) {
+	uint32_t index = future & CA_CALL_INDEX_MASK;
+	if(stash == 0 || index >= stash->calls_size) {
+		return 0;
+	}
+	ca_call_slot_t* slot = &stash->calls[index];
+	return slot->busy && slot->id == future ? slot : 0;
 }
 
 /*
  * Private
- * Delete actor
- * TODO First delete this actor's message entries
+ * Call over: free its slot for the next one, under a new future, so
+ * that a reply to this one that comes late gets dropped
  */
-void ca_delete_actor_(ca_actor_t* ca_actor) {
-	(void)ca_dequeue_msg_(ACTOR_ID(ca_actor), MSG_PRUNE_ACTION);
-	free(ca_actor);
+void ca_call_close_(ca_stash_t* stash, ca_call_slot_t* slot) {
+	uint32_t generation = (slot->id >> CA_CALL_INDEX_BITS) + 1;
+	if(generation > (~CA_CALL_REPLY >> CA_CALL_INDEX_BITS)) {
+		generation = 1;
+	}
+	slot->id = generation << CA_CALL_INDEX_BITS | (slot->id & CA_CALL_INDEX_MASK);
+	slot->busy = 0;
+	slot->reply = 0;
+	slot->next_free = stash->calls_free;
+	stash->calls_free = (slot->id & CA_CALL_INDEX_MASK) + 1;
 }
 
 /*
  * Private
- * Wait for an actor to be in the actors list
+ * Reply to one of our calls popped: file it with its call, found by
+ * index rather than searched for, or drop it if that call is over.
+ * Handlers never wait for theirs: the call is over, and the reply is
+ * returned, to be handled as any message.
  */
-void ca_wait_for_actor_known_(ca_actor_id_t id) {
-	ca_actor_t* ca_actor = 0;
-	// First wait for our actor to be in the actors list
-	do {
-		ca_actor = ca_get_thread_info_(id);
-		if(ca_actor == 0) {
-			sched_yield();
-		}
-	} while(ca_actor == 0);
+ca_msg_t* ca_call_file_(ca_actor_t* ca_actor, ca_msg_t* ca_msg) {
+	ca_call_slot_t* slot = ca_call_slot_(ca_actor->stash, ca_msg->call_id & ~CA_CALL_REPLY);
+	if(slot == 0 || slot->reply != 0) {
+		ca_delete_msg_(ca_msg);
+		return 0;
+	}
+	if(ca_actor->kind == CA_ACTOR_HANDLER) {
+		ca_call_close_(ca_actor->stash, slot);
+		return ca_msg;
+	}
+	slot->reply = ca_msg;
+	return 0;
 }
 
 /*
  * Private
- * Wait for an actor to be "realized"
- * the actor simply sets its information 'up' flag to 1
- * and that is we check (relinquishing our scheduler position
- * after every test)
- * Assumption: actor is already in actors list.
+ * Actor gone: end the calls it left in flight, their replies included
  */
-void ca_wait_for_actor_up_(ca_actor_id_t id) {
-	ca_actor_t* ca_actor = ca_get_thread_info_(id);
-	for(;;) {
-		if(ca_actor->up) {
-			break;
+void ca_calls_reset_(ca_stash_t* stash) {
+	uint32_t index;
+	for(index = 0; index < stash->calls_size; index++) {
+		ca_call_slot_t* slot = &stash->calls[index];
+		if(slot->busy) {
+			if(slot->reply) {
+				ca_delete_msg_(slot->reply);
+			}
+			ca_call_close_(stash, slot);
 		}
-		sched_yield();
 	}
 }
 
 /*
  * Private
- * This functions ALWAYS makes a copy of data. We may wish to add a lighter
- * version later.
+ * Account for a message taken out of the mailbox.
+ * Only the owner pops, or senders making room under the trimming lock:
+ * a plain store does, unless both may pop at once (priority lanes).
+ * Bounded mailboxes also let senders waiting for room know, sequentially
+ * consistent like them registering then checking for room again:
+ * either they see room, or we see them.
  */
-ca_msg_t* ca_new_msg_(ca_actor_id_t dest_id, unsigned long type, void* data, size_t data_size) {
-	ca_actor_t* ca_actor = ca_get_thread_info_(pthread_self());
-	ca_msg_t* ca_msg = (ca_msg_t*)malloc(sizeof(ca_msg_t));
-	ca_msg->dest_id = dest_id;
-	ca_msg->src_id  = ACTOR_ID(ca_actor);
-	ca_msg->type = type;
-	void* data_copy = (void*)malloc(sizeof(data_size));
-	memcpy(data_copy, data, data_size);
-	ca_msg->data = data_copy;
-	ca_msg->data_size = data_size;
-	return ca_msg;
+void ca_popped_(ca_actor_t* ca_actor) {
+	if(ca_actor->trim_locked) {
+		__atomic_add_fetch(&ca_actor->taken, 1, __ATOMIC_SEQ_CST);
+	}
+	else if(CA_ATOMIC_LOAD(&ca_actor->capacity) == 0) {
+		CA_ATOMIC_STORE(&ca_actor->taken, ca_actor->taken + 1);
+		return;
+	}
+	else {
+		__atomic_store_n(&ca_actor->taken, ca_actor->taken + 1, __ATOMIC_SEQ_CST);
+	}
+	if(__atomic_load_n(&ca_actor->room_waiters, __ATOMIC_SEQ_CST) != 0) {
+		ca_wake_room_waiters_(ca_actor);
+	}
 }
 
 /*
  * Private
- * Delete a message's payload then the message itself
+ * Pop the next message from the highest non-empty priority lane out
+ * of lanes, one bit per lane, or return nothing. A lane that looks
+ * drained gets its bit cleared, then is looked at once more: a sender
+ * sets the bit after linking, so either it sees the bit cleared and
+ * sets it again, or we see its message.
+ * Discards messages that were meant for this slot's previous tenant,
+ * and files replies to calls away instead of returning them.
+ * Only ever called by the mailbox owner.
+ * Fallback build: caller must be guarding the actor's condition mutex.
  */
-void ca_delete_msg_(ca_msg_t* ca_msg) {
-	if(ca_msg->data != 0) {
-		free(ca_msg->data);
+ca_msg_t* ca_dequeue_lanes_(ca_actor_t* ca_actor, uint32_t lanes) {
+	uint32_t used;
+	while((used = CA_ATOMIC_LOAD(&ca_actor->prio_used) & lanes) != 0) {
+		int lane = 31 - __builtin_clz(used);
+		ca_mailbox_t* mailbox = &ca_actor->prio_lanes->lanes[lane - 1];
+		ca_msg_t* ca_msg = ca_mailbox_pop_(mailbox);
+		if(ca_msg == 0) {
+			CA_ATOMIC_AND(&ca_actor->prio_used, ~(1u << lane));
+			if((ca_msg = ca_mailbox_pop_(mailbox)) == 0) {
+				continue;
+			}
+			CA_ATOMIC_OR(&ca_actor->prio_used, 1u << lane);
+		}
+		ca_popped_(ca_actor);
+		CA_ATOMIC_ADD(&ca_actor->prio_lanes->queued, -1);
+		if(ca_msg->dest_id != ACTOR_ID(ca_actor)) {
+			ca_delete_msg_(ca_msg);
+			continue;
+		}
+		if(!(ca_msg->call_id & CA_CALL_REPLY)) {
+			return ca_msg;
+		}
+		// Never queued with the others: see ca_future_wait()
+		if((ca_msg = ca_call_file_(ca_actor, ca_msg)) != 0) {
+			return ca_msg;
+		}
 	}
-	free(ca_msg);	
+	return 0;
 }
 
-void ca_release_msg(ca_msg_t* ca_msg) {
-	ca_delete_msg_(ca_msg);
+/*
+ * Private
+ * Pop the oldest message from the mailbox proper, or return nothing.
+ * Senders to a CA_OVERFLOW_DROP_OLDEST actor pop from it too, to make
+ * room: on such a slot, pops take the trimming lock (lock-free build;
+ * the fallback build has them guard the condition mutex anyway).
+ * Fallback build: caller must be guarding the actor's condition mutex.
+ */
+ca_msg_t* ca_mailbox_take_(ca_actor_t* ca_actor) {
+#if CA_MAILBOX_LOCKFREE == 1
+	if(ca_actor->trim_locked) {
+		while(CA_ATOMIC_XCHG(&ca_actor->trimming, 1) != 0) {
+			sched_yield();
+		}
+		ca_msg_t* ca_msg = ca_mailbox_pop_(&ca_actor->mailbox);
+		CA_ATOMIC_STORE(&ca_actor->trimming, 0);
+		return ca_msg;
+	}
+#endif
+	return ca_mailbox_pop_(&ca_actor->mailbox);
 }
 
 /*
- * Retrieve an actors' info based on its id:
- * look for actor through actors list, match on id
+ * Private
+ * Pop the next message from the mailbox proper, priority lanes
+ * first, or return nothing.
+ * Discards messages that were meant for this slot's previous tenant.
+ * Only ever called by the mailbox owner.
+ * Fallback build: caller must be guarding the actor's condition mutex.
  */
-ca_actor_t* ca_get_thread_info_(ca_actor_id_t id) {
-	GUARD_SECTION("actors-ca_get_thread_info", thread_actor_list_mutex)
-	ca_actor_t* ca_actor = 0;
-	ca_actor_list_node_t* cur_node;
-	for(cur_node = ca_actor_list_head; cur_node != 0; cur_node = cur_node->next) {
-		if(ACTOR_ID(cur_node->actor) == id) {
-			ca_actor = cur_node->actor;
+ca_msg_t* ca_dequeue_mailbox_(ca_actor_t* ca_actor) {
+	ca_msg_t* ca_msg;
+	if(CA_ATOMIC_LOAD(&ca_actor->prio_used) != 0 && (ca_msg = ca_dequeue_lanes_(ca_actor, ~0u)) != 0) {
+		return ca_msg;
+	}
+	while((ca_msg = ca_mailbox_take_(ca_actor)) != 0) {
+		ca_popped_(ca_actor);
+		if(ca_msg->dest_id == ACTOR_ID(ca_actor)) {
 			break;
 		}
+		ca_delete_msg_(ca_msg);
 	}
-	LEAVE_SECTION("actors-ca_get_thread_info", thread_actor_list_mutex)
-	return ca_actor;
+	return ca_msg;
 }
 
 /*
  * Private
- * This function is what a thread executes first
- * This function will call the real function and perform
- * some cleanup upon return
+ * Only ever called by the mailbox owner.
+ * Fallback build: caller must be guarding the actor's condition mutex.
+ * Depending on the value of action:
+ *     MSG_RETRIEVE_ACTION -> return next message for this actor, or nothing:
+ *                            priority lanes first, then messages set aside
+ *                            by selective receives, they are older
+ *     MSG_PRUNE_ACTION -> delete all messages for this actor, return nothing
  */
-void* ca_actor_wrapper_(void* ca_args) {
-	ca_actor_args_t* args = (ca_actor_args_t*)ca_args;
-	ca_actor_t* ca_actor = args->ca_actor;
-	// First, wait for actor to be in the actors list
-	ca_wait_for_actor_known_(ACTOR_ID(ca_actor));
-	//
-	args->fn((void*)0);
-	// We end up here when the actor's function returns
-	// Time to clean up and leave
-	free(args);
-	ca_delete_actor_(ca_actor);
-	return 0;
+ca_msg_t* ca_dequeue_msg_(ca_actor_t* ca_actor, int action) {
+	ca_stash_t* stash = ca_actor->stash;
+	ca_msg_t* ca_msg;
+	if(action == MSG_PRUNE_ACTION) {
+		while(stash != 0 && (ca_msg = ca_stash_take_mask_(stash, ~0ULL)) != 0) {
+			ca_delete_msg_(ca_msg);
+		}
+		while((ca_msg = ca_mailbox_take_(ca_actor)) != 0) {
+			ca_popped_(ca_actor);
+			ca_delete_msg_(ca_msg);
+		}
+		while((ca_msg = ca_dequeue_lanes_(ca_actor, ~0u)) != 0) {
+			ca_delete_msg_(ca_msg);
+		}
+		if(stash != 0) {
+			ca_calls_reset_(stash);
+		}
+		return 0;
+	}
+	if(CA_ATOMIC_LOAD(&ca_actor->prio_used) != 0 && (ca_msg = ca_dequeue_lanes_(ca_actor, ~0u)) != 0) {
+		return ca_msg;
+	}
+	if(stash != 0 && stash->count > 0) {
+		return ca_stash_take_mask_(stash, ~0ULL);
+	}
+	return ca_dequeue_mailbox_(ca_actor);
 }
 
 /*
- * Create a new actor:
- * create matching thread, assign id, add to actors list
+ * Private
+ * Return the actors table slot at index.
+ * Index must be below the high water mark.
  */
-ca_actor_t* ca_spawn(void*(*fn)(void*)) {
-	// Our friend here will be used to create our first thread.
-	// By definition, this means that initializing states here
-	// is safe until we create our first thread.
-	if(!ca_lib_initialized) {
-		ca_lib_initialized = 1;
-		pthread_mutex_init(&thread_actor_list_mutex, 0);
-		pthread_mutex_init(&thread_msg_list_mutex, 0);
-	}
+ca_actor_t* ca_actor_slot_(uint32_t index) {
+	ca_actor_t* chunk = CA_ATOMIC_LOAD(&ca_actors_chunks[index >> CA_ACTORS_CHUNK_BITS]);
+	return &chunk[index & (CA_ACTORS_CHUNK_SIZE - 1)];
+}
 
-	ca_actor_t* ca_actor = ca_new_actor_();
-	ca_actor_args_t* ca_args = (ca_actor_args_t*)malloc(sizeof(ca_actor_args_t)); // TODO: Free later
-	ca_args->ca_actor = ca_actor;
-	ca_args->fn = fn;
-	ca_actor->args = ca_args;
-	pthread_create(&(ca_actor->thread), 0, &ca_actor_wrapper_, (void*)ca_args);
-	ca_add_actor_to_list_(ca_actor);	
+/*
+ * Private
+ * Instantiate and return a new actor of kind, CA_ACTOR_*, with state:
+ * recycle a free slot or grow the table; a fresh slot gets its
+ * mutex, condition and mailbox set up once and for all.
+ * The id is published before the actor's thread or task even
+ * exists, so messages sent to it right away simply queue up; its
+ * kind and state come first, so that they find out what it is.
+ */
+ca_actor_t* ca_new_actor_(int kind, void* state) {
+	ca_actor_t* ca_actor;
+	uint32_t index;
+	GUARD_SECTION("actors-ca_new_actor_", thread_actor_table_mutex)
+	if(ca_actors_free_head != 0) {
+		index = ca_actors_free_head - 1;
+		ca_actor = ca_actor_slot_(index);
+		ca_actors_free_head = ca_actor->next_free;
+	}
+	else {
+		index = ca_actors_high_water;
+		uint32_t chunk_index = index >> CA_ACTORS_CHUNK_BITS;
+		if(chunk_index >= CA_ACTORS_MAX_CHUNKS) {
+			LEAVE_SECTION("actors-ca_new_actor_", thread_actor_table_mutex)
+			return 0;
+		}
+		if(ca_actors_chunks[chunk_index] == 0) {
+			void* chunk;
+			if(posix_memalign(&chunk, CA_CACHE_LINE, CA_ACTORS_CHUNK_SIZE * sizeof(ca_actor_t)) != 0) {
+				LEAVE_SECTION("actors-ca_new_actor_", thread_actor_table_mutex)
+				return 0;
+			}
+			memset(chunk, 0, CA_ACTORS_CHUNK_SIZE * sizeof(ca_actor_t));
+			CA_ATOMIC_STORE(&ca_actors_chunks[chunk_index], (ca_actor_t*)chunk);
+		}
+		ca_actor = ca_actor_slot_(index);
+		pthread_mutex_init(&ca_actor->thread_cond_mutex, 0); // Default
+		pthread_cond_init(&ca_actor->thread_cond, 0); // Default
+		ca_mailbox_init_(&ca_actor->mailbox);
+		CA_ATOMIC_STORE(&ca_actors_high_water, index + 1);
+	}
+	ca_actor->next_free = 0;
+	CA_ATOMIC_STORE(&ca_actor->kind, kind);
+	CA_ATOMIC_STORE(&ca_actor->state, state);
+	ca_actor->task = 0;
+	ca_actor->wake_state = CA_TASK_RUNNING;
+	ca_actor->spin_ns = 0;
+	ca_actor->run_next = 0;
+	ca_actor->monitors = 0;
+	ca_actor->exiting = 0;
+	ca_actor->capacity = 0;
+	ca_actor->overflow = CA_OVERFLOW_BLOCK;
+	ca_actor->send_timeout = -1;
+	ca_actor->taken_base = CA_ATOMIC_LOAD(&ca_actor->taken);
+	ca_actor->depth_high_water = 0;
+	ca_actor->msgs_out = 0;
+	ca_actor->dropped = 0;
+	ca_actor->trimmed = 0;
+	ca_actor->blocked_ns = 0;
+	ca_actor->contended = 0;
+	ca_actors_spawned++;
+	// Skip generation 0 so that no id is ever 0
+	if(++ca_actor->generation > CA_ACTOR_GENERATION_MAX) {
+		ca_actor->generation = 1;
+	}
+	CA_ATOMIC_STORE(&ca_actor->id, CA_ACTOR_ID_MAKE(ca_actor->generation, index));
+	CA_ATOMIC_ADD(&ca_actors_live, 1);
+	PDEBUG_ACTORS_LIST
+	LEAVE_SECTION("actors-ca_new_actor_", thread_actor_table_mutex)
 	return ca_actor;
 }
 
 /*
- * Wait for a message for this actor:
- * lock, set own state to up (in case), wait for signal, unlock
+ * Private
+ * Tell a monitor that the actor it watched, id, has exited.
+ * A CA_MONITOR_WAIT monitor may be gone as soon as 'done' is set.
  */
-ca_msg_t* ca_receive() {
-	ca_msg_t* ca_msg;
-	ca_actor_t* ca_actor = ca_get_thread_info_(pthread_self());
-	//printf("Retrieved %lu\n", (unsigned long)ca_actor->id);
-	// TODO: Check that it;s to claim to be up while unguarded.
-	ca_actor->up = 1;
-	// Maybe we already have messages in the pipeline...
-	// In that case we do not need to wait.
-	GUARD_SECTION("1actor-ca_receive", ca_actor->thread_cond_mutex)
-	ca_msg = ca_dequeue_msg_(ACTOR_ID(ca_actor), MSG_RETRIEVE_ACTION);
-	while(ca_msg == 0) {
-		// Looks like we will have to wait,,,
-		pthread_cond_wait(&ca_actor->thread_cond, &ca_actor->thread_cond_mutex);
-		ca_msg = ca_dequeue_msg_(ACTOR_ID(ca_actor), MSG_RETRIEVE_ACTION);
-		if(ca_msg == 0) {
-			sched_yield();
+void ca_notify_monitor_(ca_monitor_t* monitor, ca_actor_id_t id) {
+	ca_actor_t* watcher = ca_get_thread_info_(monitor->watcher);
+	if(monitor->kind == CA_MONITOR_MSG) {
+		free(monitor);
+		if(watcher == 0) {
+			return;
+		}
+		ca_msg_t* ca_msg = ca_new_msg_(ACTOR_ID(watcher), CA_MSG_TYPE_EXIT, 0, 0);
+		if(ca_msg != 0) {
+			ca_msg->src_id = id;
+			ca_deliver_msg_(watcher, ca_msg);
 		}
+		return;
 	}
-	LEAVE_SECTION("1actor-ca_receive", ca_actor->thread_cond_mutex)
-	return ca_msg;
+	if(watcher != 0 && watcher->kind == CA_ACTOR_TASK) {
+		CA_ATOMIC_STORE(monitor->done, 1);
+		ca_unpark_task_(watcher);
+		return;
+	}
+	GUARD_SECTION("join-ca_notify_monitor_", thread_join_mutex)
+	*monitor->done = 1;
+	pthread_cond_signal(monitor->wake);
+	LEAVE_SECTION("join-ca_notify_monitor_", thread_join_mutex)
 }
 
 /*
- * Send message to actor identified by id:
- * Check that actor's thread is up, lock, signal, unlock
+ * Private
+ * One live actor fewer: the last one out wakes ca_join() callers up
  */
-void ca_send(ca_actor_id_t id, unsigned long type, void* data, size_t data_size) {
-	// Wait for receiver to be realized
-	ca_wait_for_actor_up_(id);
-	// Prepare message
-	ca_msg_t* ca_msg = ca_new_msg_(id, type, data, data_size);
-	ca_enqueue_msg_(ca_msg);
-	// Send signal: there is a message!
+void ca_actors_live_drop_() {
+	if(CA_ATOMIC_ADD(&ca_actors_live, -1) == 0) {
+		GUARD_SECTION("join-ca_actors_live_drop_", thread_join_mutex)
+		while(ca_join_waiters != 0) {
+			ca_monitor_t* waiter = ca_join_waiters;
+			ca_join_waiters = waiter->next;
+			*waiter->done = 1;
+			pthread_cond_signal(waiter->wake);
+		}
+		LEAVE_SECTION("join-ca_actors_live_drop_", thread_join_mutex)
+	}
+}
+
+/*
+ * Private
+ * Delete actor
+ * First delete this actor's pending messages and close its monitors
+ * list, then retire its id and give its slot back, and finally tell
+ * whoever was waiting for it.
+ * Messages still in flight to the retired id are discarded by
+ * whoever gets the slot next (see ca_dequeue_msg_()).
+ */
+void ca_delete_actor_(ca_actor_t* ca_actor) {
+	CA_TRACE_EVENT(CA_TRACE_EXIT, ACTOR_ID(ca_actor), CA_INVALID_ACTOR_ID, 0, 0);
+	GUARD_ACTOR_SECTION("1actor-ca_delete_actor_", ca_actor)
+	(void)ca_dequeue_msg_(ca_actor, MSG_PRUNE_ACTION);
+	ca_monitor_t* monitors = ca_actor->monitors;
+	ca_actor->monitors = 0;
+	ca_actor->exiting = 1;
+	LEAVE_SECTION("1actor-ca_delete_actor_", ca_actor->thread_cond_mutex)
+	CA_STAT_ADD(&ca_retired_dropped, CA_STAT_READ(&ca_actor->dropped));
+	CA_STAT_ADD(&ca_retired_blocked_ns, ca_actor->blocked_ns);
+	GUARD_SECTION("actors-ca_delete_actor_", thread_actor_table_mutex)
+	ca_actor_id_t id = ca_actor->id;
+	uint32_t index = CA_ACTOR_ID_INDEX(id);
+	CA_ATOMIC_STORE(&ca_actor->id, CA_INVALID_ACTOR_ID);
+	ca_actor->next_free = ca_actors_free_head;
+	ca_actors_free_head = index + 1;
+	LEAVE_SECTION("actors-ca_delete_actor_", thread_actor_table_mutex)
+	// Senders that were waiting for room give up now the id is retired
+	ca_wake_room_waiters_(ca_actor);
+	while(monitors != 0) {
+		ca_monitor_t* monitor = monitors;
+		monitors = monitors->next;
+		ca_notify_monitor_(monitor, id);
+	}
+	ca_actors_live_drop_();
+}
+
+/*
+ * Private
+ * Add a monitor to actor id. Returns 0, or -1 if that actor has
+ * already exited, in which case the monitor was not added.
+ */
+int ca_add_monitor_(ca_actor_id_t id, ca_monitor_t* monitor) {
 	ca_actor_t* ca_actor = ca_get_thread_info_(id);
-	GUARD_SECTION("1actor", ca_actor->thread_cond_mutex)
-	pthread_cond_signal(&ca_actor->thread_cond);
-	LEAVE_SECTION("1actor", ca_actor->thread_cond_mutex)
+	if(ca_actor == 0) {
+		return -1;
+	}
+	int added = 0;
+	GUARD_ACTOR_SECTION("1actor-ca_add_monitor_", ca_actor)
+	// Check again now that the actor cannot slip away
+	if(CA_ATOMIC_LOAD(&ca_actor->id) == id && !ca_actor->exiting) {
+		monitor->next = ca_actor->monitors;
+		ca_actor->monitors = monitor;
+		added = 1;
+	}
+	LEAVE_SECTION("1actor-ca_add_monitor_", ca_actor->thread_cond_mutex)
+	return added ? 0 : -1;
 }
 
 /*
- * Reply to a message's sender
- * Invokes ca_send()
+ * Private
+ * Wake up all senders waiting for room in actor's mailbox
  */
-void ca_reply(ca_msg_t* msg, unsigned long type, void* data, size_t data_size) {
-	ca_send(msg->src_id, type, data, data_size);
+void ca_wake_room_waiters_(ca_actor_t* ca_actor) {
+	GUARD_SECTION("join-ca_wake_room_waiters_", thread_join_mutex)
+	ca_monitor_t* waiters = ca_actor->room_waiters;
+	__atomic_store_n(&ca_actor->room_waiters, (ca_monitor_t*)0, __ATOMIC_SEQ_CST);
+	LEAVE_SECTION("join-ca_wake_room_waiters_", thread_join_mutex)
+	while(waiters != 0) {
+		ca_monitor_t* waiter = waiters;
+		waiters = waiters->next;
+		ca_notify_monitor_(waiter, ACTOR_ID(ca_actor));
+	}
 }
 
-void ca_sleep(long milliseconds) {
-	ca_actor_t* ca_actor = ca_get_thread_info_(pthread_self());	
-	// TODO: Check that it;s to claim to be up while unguarded.
-	ca_actor->up = 1;	
-	GUARD_SECTION("1actor-ca_sleep", ca_actor->thread_cond_mutex)
-	struct timespec unlockAfter;
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	unlockAfter.tv_sec = now.tv_sec + milliseconds / 1000;
-	unlockAfter.tv_nsec = now.tv_usec * 1000 + (milliseconds % 1000) * 1000 * 1000;
-	pthread_cond_timedwait(&ca_actor->thread_cond, &ca_actor->thread_cond_mutex, &unlockAfter);
-	LEAVE_SECTION("1actor-ca_sleep", ca_actor->thread_cond_mutex)
+/*
+ * Private
+ * Current thread's message cache: read through a function call so
+ * that a task never uses the cache of a worker it has left.
+ */
+__attribute__((noinline)) ca_msg_cache_t* ca_current_msg_cache_() {
+	return &ca_msg_cache;
 }
 
 /*
- * Wait for all actors to have exited:
- * Loop through actors list,  pseudo-join(), next(), ...
+ * Private
+ * Refill an empty message cache: take a batch from the depot,
+ * or carve a new one out of a freshly allocated slab.
+ * Slabs are never freed; their messages keep being recycled.
  */
-void ca_join() {
-	ca_actor_list_node_t* cur_node;
-	while(ca_actor_list_head != 0) {
-		GUARD_SECTION("actors-ca_wait_for_actors_down", thread_actor_list_mutex)
-		if(ca_actor_list_head != 0) {
-			for(cur_node = ca_actor_list_head; cur_node != 0; cur_node = cur_node->next) {
-				// BEWARE! Before these threads are currently marked as detached
-				// rather than joinable (Are they really??? TODO: Check)
-				// thread is may be reused. Yeah I don't think so...
-				//pthread_join(cur_node->actor->thread, 0);
-				int is_dead = (ESRCH == pthread_kill(cur_node->actor->thread, 0));
-				if(is_dead) {
-					pthread_mutex_destroy(&cur_node->actor->thread_cond_mutex);
-					pthread_cond_destroy(&cur_node->actor->thread_cond);
-
-					if(cur_node->next == 0 && cur_node->prev == 0) {
-						ca_actor_list_head = 0;
-					}
-					else {
-						if(cur_node->prev != 0) {
-							cur_node->prev->next = cur_node->next;					
-						}
-						if(cur_node->next != 0) {
-							cur_node->next->prev = cur_node->prev;
-						}
-					}
-				}
-			}
+void ca_msg_cache_refill_(ca_msg_cache_t* cache) {
+	ca_msg_list_node_t* batch = 0;
+	int count = CA_MSG_BATCH;
+	GUARD_SECTION("msgs-ca_msg_cache_refill_", thread_msg_depot_mutex)
+	if(ca_msg_depot_count > 0) {
+		ca_msg_depot_count--;
+		batch = ca_msg_depot[ca_msg_depot_count].head;
+		count = ca_msg_depot[ca_msg_depot_count].count;
+	}
+	LEAVE_SECTION("msgs-ca_msg_cache_refill_", thread_msg_depot_mutex)
+	if(batch == 0) {
+		void* slab;
+		if(posix_memalign(&slab, CA_CACHE_LINE, CA_MSG_BATCH * sizeof(ca_msg_t)) != 0) {
+			return;
+		}
+		ca_msg_t* msgs = (ca_msg_t*)slab;
+		int i;
+		for(i = 0; i < CA_MSG_BATCH - 1; i++) {
+			msgs[i].node.next = &msgs[i + 1].node;
 		}
-		PDEBUG_ACTORS_LIST
-		LEAVE_SECTION("actors-ca_wait_for_actors_down", thread_actor_list_mutex)
+		msgs[CA_MSG_BATCH - 1].node.next = 0;
+		batch = &msgs[0].node;
+	}
+	cache->head = batch;
+	cache->count = count;
+}
 
-		sched_yield();
+/*
+ * Private
+ * Move count messages from the head of a message cache over to the
+ * depot, as one batch. Should the depot fail to grow, they stay in
+ * the cache: returns 0 then, non-zero if they went.
+ */
+int ca_msg_cache_give_(ca_msg_cache_t* cache, int count) {
+	int given = 0;
+	GUARD_SECTION("msgs-ca_msg_cache_give_", thread_msg_depot_mutex)
+	if(ca_msg_depot_count == ca_msg_depot_capacity) {
+		size_t capacity = ca_msg_depot_capacity ? ca_msg_depot_capacity * 2 : 16;
+		ca_msg_batch_t* depot = (ca_msg_batch_t*)realloc(ca_msg_depot, capacity * sizeof(ca_msg_batch_t));
+		if(depot != 0) {
+			ca_msg_depot = depot;
+			ca_msg_depot_capacity = capacity;
+		}
+	}
+	if(ca_msg_depot_count < ca_msg_depot_capacity) {
+		ca_msg_list_node_t* batch = cache->head;
+		ca_msg_list_node_t* last = batch;
+		int i;
+		for(i = 1; i < count; i++) {
+			last = last->next;
+		}
+		cache->head = last->next;
+		cache->count -= count;
+		last->next = 0;
+		ca_msg_depot[ca_msg_depot_count].head = batch;
+		ca_msg_depot[ca_msg_depot_count].count = count;
+		ca_msg_depot_count++;
+		given = 1;
+	}
+	LEAVE_SECTION("msgs-ca_msg_cache_give_", thread_msg_depot_mutex)
+	return given;
+}
+
+/*
+ * Private
+ * A message cache grew too big: move one batch over to the depot
+ */
+void ca_msg_cache_drain_(ca_msg_cache_t* cache) {
+	(void)ca_msg_cache_give_(cache, CA_MSG_BATCH);
+}
+
+/*
+ * Private
+ * Give all of this thread's cached messages back, e.g. before it
+ * exits: full batches, then whatever is left as a smaller one.
+ * Allocates nothing.
+ */
+void ca_msg_cache_flush_() {
+	ca_msg_cache_t* cache = ca_current_msg_cache_();
+	while(cache->count > 0
+			&& ca_msg_cache_give_(cache, cache->count < CA_MSG_BATCH ? cache->count : CA_MSG_BATCH)) {
+	}
+}
+
+/*
+ * Private
+ * Get a message from this thread's cache
+ */
+ca_msg_t* ca_msg_alloc_() {
+	ca_msg_cache_t* cache = ca_current_msg_cache_();
+	if(cache->head == 0) {
+		ca_msg_cache_refill_(cache);
+		if(cache->head == 0) {
+			return 0;
+		}
+	}
+	ca_msg_list_node_t* node = cache->head;
+	cache->head = node->next;
+	cache->count--;
+	return (ca_msg_t*)node;
+}
+
+/*
+ * Private
+ * Return a message to this thread's cache (whichever thread
+ * allocated it)
+ */
+void ca_msg_free_(ca_msg_t* ca_msg) {
+	ca_msg_cache_t* cache = ca_current_msg_cache_();
+	ca_msg->node.next = cache->head;
+	cache->head = &ca_msg->node;
+	if(++cache->count >= 2 * CA_MSG_BATCH) {
+		ca_msg_cache_drain_(cache);
+	}
+}
+
+/*
+ * Private
+ * This functions ALWAYS makes a copy of data. We may wish to add a lighter
+ * version later.
+ * Small payloads are copied inside the message: no allocation at all.
+ */
+ca_msg_t* ca_new_msg_(ca_actor_id_t dest_id, unsigned long type, void* data, size_t data_size) {
+	ca_msg_t* ca_msg = ca_msg_alloc_();
+	if(ca_msg == 0) {
+		return 0;
+	}
+	ca_msg->dest_id = dest_id;
+	// Messages sent from outside any actor (e.g. main()) have no source
+	ca_msg->src_id  = ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID;
+	ca_msg->type = type;
+	ca_msg->release = 0;
+	ca_msg->call_id = 0;
+	ca_msg->seq = 0;
+	if(data_size <= CA_MSG_INLINE_SIZE) {
+		ca_msg->data = ca_msg->inline_data;
+	}
+	else {
+		ca_msg->data = malloc(data_size);
+		if(ca_msg->data == 0) {
+			ca_msg_free_(ca_msg);
+			return 0;
+		}
+	}
+	if(data_size > 0) {
+		memcpy(ca_msg->data, data, data_size);
+	}
+	ca_msg->data_size = data_size;
+	CA_TRACE_SENT(ca_msg->src_id, dest_id, ca_msg);
+	return ca_msg;
+}
+
+/*
+ * Private
+ * Wrap a buffer the caller gives away: no copy.
+ * Returns 0, and leaves the buffer alone, if out of memory.
+ */
+ca_msg_t* ca_wrap_msg_(ca_actor_id_t dest_id, unsigned long type, void* data, size_t data_size, ca_release_fn_t release) {
+	ca_msg_t* ca_msg = ca_msg_alloc_();
+	if(ca_msg == 0) {
+		return 0;
+	}
+	ca_msg->dest_id = dest_id;
+	ca_msg->src_id  = ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID;
+	ca_msg->type = type;
+	ca_msg->release = release;
+	ca_msg->call_id = 0;
+	ca_msg->seq = 0;
+	ca_msg->data = data;
+	ca_msg->data_size = data_size;
+	CA_TRACE_SENT(ca_msg->src_id, dest_id, ca_msg);
+	return ca_msg;
+}
+
+/*
+ * Private
+ * Get rid of a buffer that was handed over to us
+ */
+void ca_release_data_(void* data, size_t data_size, ca_release_fn_t release) {
+	if(release) {
+		release(data, data_size);
+	}
+	else {
+		free(data);
+	}
+}
+
+/*
+ * Private
+ * Delete a message's payload then the message itself
+ */
+void ca_delete_msg_(ca_msg_t* ca_msg) {
+	if(ca_msg->data != ca_msg->inline_data) {
+		ca_release_data_(ca_msg->data, ca_msg->data_size, ca_msg->release);
+	}
+	else if(ca_msg->release) {
+		// Built in place (see ca_msg_new())
+		ca_msg->release(ca_msg->data, ca_msg->data_size);
+	}
+	ca_msg_free_(ca_msg);
+}
+
+void ca_release_msg(ca_msg_t* ca_msg) {
+	CA_TRACE_MSG(CA_TRACE_RELEASE, ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID, ca_msg->src_id, ca_msg);
+	ca_delete_msg_(ca_msg);
+}
+
+/*
+ * Retrieve an actors' info based on its id:
+ * index straight into the actors table, then make sure the slot
+ * still belongs to that id. No lock needed: slots are never freed.
+ * Returns nothing if the actor is unknown or has exited.
+ */
+ca_actor_t* ca_get_thread_info_(ca_actor_id_t id) {
+	uint32_t index = CA_ACTOR_ID_INDEX(id);
+	if(id == CA_INVALID_ACTOR_ID || index >= CA_ATOMIC_LOAD(&ca_actors_high_water)) {
+		return 0;
+	}
+	ca_actor_t* ca_actor = ca_actor_slot_(index);
+	if(CA_ATOMIC_LOAD(&ca_actor->id) != id) {
+		return 0;
+	}
+	return ca_actor;
+}
+
+// ---------------------------------------------------------
+// Scheduler (CA_SCHED_WORKERS)
+// Actors run as tasks: each has its own small stack and is
+// resumed by whichever worker thread pops it from the run
+// queue. A task gives its worker back control when it yields,
+// parks (nothing to receive, sleeping) or exits.
+// Beware: a task may resume on another worker, so it must not
+// keep pointers to thread-local data across a switch.
+// ---------------------------------------------------------
+
+/*
+ * Choose how actors are run, before spawning the first one:
+ * mode is CA_SCHED_THREADS or CA_SCHED_WORKERS, num_workers is
+ * the size of the worker pool (0: one worker per online CPU).
+ * Returns 0, EBUSY if actors were already spawned, or EINVAL.
+ */
+int ca_set_scheduler(int mode, int num_workers) {
+	if(mode != CA_SCHED_THREADS && mode != CA_SCHED_WORKERS) {
+		return EINVAL;
+	}
+	if(num_workers < 0) {
+		return EINVAL;
+	}
+	if(ca_lib_initialized) {
+		return EBUSY;
+	}
+	ca_sched_mode = mode;
+	ca_num_workers = num_workers;
+	return 0;
+}
+
+/*
+ * Private
+ * Bytes to map for a stack_size stack: whole pages, plus a guard page.
+ * No smaller than a thread's may be: that much goes on a task's
+ * stack as well before it gets anywhere.
+ */
+size_t ca_task_stack_bytes_(size_t stack_size) {
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	if(stack_size < (size_t)PTHREAD_STACK_MIN) {
+		stack_size = (size_t)PTHREAD_STACK_MIN;
+	}
+	return ((stack_size + page_size - 1) / page_size + 1) * page_size;
+}
+
+/*
+ * Private
+ * Get a task context and stack, from the pool or freshly mapped;
+ * only CA_TASK_STACK_SIZE stacks are pooled.
+ * The lowest stack page is left inaccessible to catch overflows.
+ */
+ca_task_t* ca_task_alloc_(size_t stack_size) {
+	ca_task_t* task = 0;
+	if(stack_size == CA_TASK_STACK_SIZE) {
+		GUARD_SECTION("tasks-ca_task_alloc_", thread_task_pool_mutex)
+		task = ca_task_pool;
+		if(task != 0) {
+			ca_task_pool = task->next_free;
+		}
+		LEAVE_SECTION("tasks-ca_task_alloc_", thread_task_pool_mutex)
+		if(task != 0) {
+			return task;
+		}
+	}
+	task = (ca_task_t*)malloc(sizeof(ca_task_t));
+	if(task == 0) {
+		return 0;
+	}
+	task->stack_size = ca_task_stack_bytes_(stack_size);
+	task->stack = mmap(0, task->stack_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if(task->stack == MAP_FAILED) {
+		free(task);
+		return 0;
+	}
+	mprotect(task->stack, (size_t)sysconf(_SC_PAGESIZE), PROT_NONE);
+	return task;
+}
+
+/*
+ * Private
+ * Give an exited task's context and stack back to the pool,
+ * or back to the system if not of the pooled size
+ */
+void ca_task_free_(ca_task_t* task) {
+	if(task->stack_size != ca_task_stack_bytes_(CA_TASK_STACK_SIZE)) {
+		munmap(task->stack, task->stack_size);
+		free(task);
+		return;
+	}
+	GUARD_SECTION("tasks-ca_task_free_", thread_task_pool_mutex)
+	task->next_free = ca_task_pool;
+	ca_task_pool = task;
+	LEAVE_SECTION("tasks-ca_task_free_", thread_task_pool_mutex)
+}
+
+/*
+ * Private
+ * Wake an idle worker up, if any, to come and look for work.
+ * Pairs with the idle_workers increment in ca_worker_idle_():
+ * either we see it, or that worker sees the work we just queued.
+ */
+void ca_notify_workers_() {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ca_idle_workers, __ATOMIC_RELAXED) > 0) {
+		GUARD_SECTION("idle-ca_notify_workers_", thread_idle_mutex)
+		ca_idle_seq++;
+		pthread_cond_signal(&thread_idle_cond);
+		LEAVE_SECTION("idle-ca_notify_workers_", thread_idle_mutex)
+	}
+}
+
+/*
+ * Private
+ * Append a runnable task to the global run queue
+ */
+void ca_runq_push_(ca_actor_t* ca_actor) {
+	ca_actor->run_next = 0;
+	GUARD_SECTION("runq-ca_runq_push_", thread_runq_mutex)
+	if(ca_runq_tail == 0) {
+		ca_runq_head = ca_actor;
+	}
+	else {
+		ca_runq_tail->run_next = ca_actor;
+	}
+	ca_runq_tail = ca_actor;
+	CA_ATOMIC_STORE(&ca_runq_length, ca_runq_length + 1);
+	LEAVE_SECTION("runq-ca_runq_push_", thread_runq_mutex)
+}
+
+/*
+ * Private
+ * Pop the oldest task from the global run queue, or nothing
+ */
+ca_actor_t* ca_runq_pop_() {
+	ca_actor_t* ca_actor;
+	if(CA_ATOMIC_LOAD(&ca_runq_length) == 0) {
+		return 0;
+	}
+	GUARD_SECTION("runq-ca_runq_pop_", thread_runq_mutex)
+	ca_actor = ca_runq_head;
+	if(ca_actor != 0) {
+		ca_runq_head = ca_actor->run_next;
+		if(ca_runq_head == 0) {
+			ca_runq_tail = 0;
+		}
+		CA_ATOMIC_STORE(&ca_runq_length, ca_runq_length - 1);
+	}
+	LEAVE_SECTION("runq-ca_runq_pop_", thread_runq_mutex)
+	return ca_actor;
+}
+
+/*
+ * Private
+ * Owner only: push a task at the bottom of the worker's deque.
+ * Returns 0, or -1 if the deque is full.
+ */
+int ca_deque_push_(ca_worker_t* worker, ca_actor_t* ca_actor) {
+	long bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+	long top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+	if(bottom - top >= CA_RUN_DEQUE_SIZE) {
+		return -1;
+	}
+	__atomic_store_n(&worker->deque[bottom & (CA_RUN_DEQUE_SIZE - 1)], ca_actor, __ATOMIC_RELAXED);
+	__atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+ * Private
+ * Owner only: pop the task at the bottom of the worker's deque,
+ * or nothing. Races thieves for the last one.
+ */
+ca_actor_t* ca_deque_pop_(ca_worker_t* worker) {
+	long bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&worker->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long top = __atomic_load_n(&worker->top, __ATOMIC_RELAXED);
+	if(top > bottom) {
+		__atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	ca_actor_t* ca_actor = __atomic_load_n(&worker->deque[bottom & (CA_RUN_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+	if(top == bottom) {
+		if(!__atomic_compare_exchange_n(&worker->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			ca_actor = 0;
+		}
+		__atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+	}
+	return ca_actor;
+}
+
+/*
+ * Private
+ * Any worker: take the task at the top of another worker's deque,
+ * or nothing (empty, or lost a race against another taker).
+ */
+ca_actor_t* ca_deque_steal_(ca_worker_t* worker) {
+	long top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long bottom = __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE);
+	if(top >= bottom) {
+		return 0;
+	}
+	ca_actor_t* ca_actor = __atomic_load_n(&worker->deque[top & (CA_RUN_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+	if(!__atomic_compare_exchange_n(&worker->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	return ca_actor;
+}
+
+/*
+ * Private
+ * Make a task runnable: on this worker's deque if called from a
+ * worker (idle workers may steal it), on the global run queue otherwise.
+ */
+void ca_schedule_(ca_actor_t* ca_actor) {
+	ca_worker_t* worker = ca_current_worker_();
+	if(worker == 0 || ca_deque_push_(worker, ca_actor) != 0) {
+		ca_runq_push_(ca_actor);
+	}
+	ca_notify_workers_();
+}
+
+/*
+ * Private
+ * Make a task runnable, to run next on this worker if called from
+ * a worker. Whatever task was due next gets queued on the deque.
+ */
+void ca_schedule_next_(ca_actor_t* ca_actor) {
+	ca_worker_t* worker = ca_current_worker_();
+	if(worker == 0) {
+		ca_runq_push_(ca_actor);
+	}
+	else {
+		ca_actor = CA_ATOMIC_XCHG(&worker->runnext, ca_actor);
+		if(ca_actor != 0 && ca_deque_push_(worker, ca_actor) != 0) {
+			ca_runq_push_(ca_actor);
+		}
+	}
+	ca_notify_workers_();
+}
+
+/*
+ * Private
+ * Make a task, or handler actor, runnable again if it is parked.
+ * If it is still running, it will notice and not park.
+ * Safe to call from any thread.
+ */
+void ca_unpark_task_(ca_actor_t* ca_actor) {
+	int previous_state = CA_ATOMIC_XCHG(&ca_actor->wake_state, CA_TASK_NOTIFIED);
+	if(previous_state == CA_TASK_PARKED) {
+		CA_ATOMIC_STORE(&ca_actor->wake_state, CA_TASK_RUNNING);
+		// Run it here, soon: whatever woke it up is still in our cache
+		ca_schedule_next_(ca_actor);
+	}
+}
+
+/*
+ * Private
+ * Current worker: read through a function call so that the
+ * compiler cannot reuse a thread-local address computed before
+ * the calling task last switched.
+ */
+__attribute__((noinline)) ca_worker_t* ca_current_worker_() {
+	return ca_worker;
+}
+
+/*
+ * Private
+ * Hand control back to the worker running this task.
+ * Returns when the task is resumed, possibly by another worker.
+ */
+void ca_task_switch_(ca_actor_t* ca_actor, int reason) {
+	ca_worker_t* worker = ca_current_worker_();
+	worker->switch_reason = reason;
+	swapcontext(&ca_actor->task->context, &worker->context);
+}
+
+/*
+ * Private
+ * Let other actors run: tasks go to the back of the run queue,
+ * threads give up their CPU
+ */
+void ca_yield_() {
+	ca_actor_t* ca_actor = ca_self;
+	if(ca_actor != 0 && ca_actor->kind == CA_ACTOR_TASK) {
+		ca_task_switch_(ca_actor, CA_SWITCH_YIELD);
+	}
+	else {
+		sched_yield();
+	}
+}
+
+/*
+ * Private
+ * Look for a task to steal from the other workers, starting with a
+ * random one. Tasks waiting in a victim's 'runnext' are only taken
+ * on a second pass, if that victim has not scheduled anything since
+ * the first: they are meant to run there, and usually will shortly.
+ */
+ca_actor_t* ca_steal_(ca_worker_t* worker) {
+	int pass, i;
+	for(pass = 0; pass < 2; pass++) {
+		worker->rand_state = worker->rand_state * 1103515245 + 12345;
+		int start = (int)((worker->rand_state >> 16) % (unsigned int)ca_workers_count);
+		for(i = 0; i < ca_workers_count; i++) {
+			ca_worker_t* victim = ca_workers[(start + i) % ca_workers_count];
+			if(victim == worker) {
+				continue;
+			}
+			ca_actor_t* ca_actor = ca_deque_steal_(victim);
+			if(ca_actor != 0) {
+				return ca_actor;
+			}
+			unsigned long ticks = __atomic_load_n(&victim->ticks, __ATOMIC_RELAXED);
+			if(pass == 0) {
+				worker->seen_ticks[victim->index] = ticks;
+			}
+			else if(ticks == worker->seen_ticks[victim->index] &&
+				__atomic_load_n(&victim->runnext, __ATOMIC_RELAXED) != 0) {
+				ca_actor = CA_ATOMIC_XCHG(&victim->runnext, (ca_actor_t*)0);
+				if(ca_actor != 0) {
+					return ca_actor;
+				}
+			}
+		}
+		if(pass == 0) {
+			sched_yield();
+		}
+	}
+	return 0;
+}
+
+/*
+ * Private
+ * Find the next task to run, in order: own 'runnext', own deque,
+ * global run queue, other workers. The global run queue is checked
+ * first every so often so that it cannot starve.
+ */
+ca_actor_t* ca_find_task_(ca_worker_t* worker) {
+	ca_actor_t* ca_actor;
+	if(worker->ticks % 61 == 0 && (ca_actor = ca_runq_pop_()) != 0) {
+		return ca_actor;
+	}
+	if(__atomic_load_n(&worker->runnext, __ATOMIC_RELAXED) != 0 &&
+		(ca_actor = CA_ATOMIC_XCHG(&worker->runnext, (ca_actor_t*)0)) != 0) {
+		return ca_actor;
+	}
+	if((ca_actor = ca_deque_pop_(worker)) != 0) {
+		return ca_actor;
+	}
+	if((ca_actor = ca_runq_pop_()) != 0) {
+		return ca_actor;
+	}
+	if(ca_workers_count > 1) {
+		return ca_steal_(worker);
+	}
+	return 0;
+}
+
+/*
+ * Private
+ * Nothing to run anywhere: sleep until some task is made runnable.
+ * We count ourselves idle before a last look around, so that
+ * ca_notify_workers_() cannot miss us.
+ */
+ca_actor_t* ca_worker_idle_(ca_worker_t* worker) {
+	ca_actor_t* ca_actor;
+	GUARD_SECTION("idle-ca_worker_idle_", thread_idle_mutex)
+	unsigned long seq = ca_idle_seq;
+	__atomic_add_fetch(&ca_idle_workers, 1, __ATOMIC_SEQ_CST);
+	LEAVE_SECTION("idle-ca_worker_idle_", thread_idle_mutex)
+	ca_actor = ca_find_task_(worker);
+	GUARD_SECTION("idle-ca_worker_idle_", thread_idle_mutex)
+	if(ca_actor == 0) {
+		while(seq == ca_idle_seq) {
+			pthread_cond_wait(&thread_idle_cond, &thread_idle_mutex);
+		}
+	}
+	__atomic_sub_fetch(&ca_idle_workers, 1, __ATOMIC_SEQ_CST);
+	LEAVE_SECTION("idle-ca_worker_idle_", thread_idle_mutex)
+	return ca_actor;
+}
+
+/*
+ * Private
+ * Run a handler actor for the messages in its mailbox, at most
+ * CA_HANDLER_BATCH of them. Returns what to do with it next, as
+ * a task switching back would.
+ */
+int ca_handler_run_(ca_actor_t* ca_actor) {
+	int count;
+	for(count = 0; count < CA_HANDLER_BATCH; count++) {
+		ca_msg_t* ca_msg = ca_try_dequeue_msg_(ca_actor);
+		if(ca_msg == 0) {
+			return CA_SWITCH_PARK;
+		}
+		CA_TRACE_MSG(CA_TRACE_RECEIVE, ACTOR_ID(ca_actor), ca_msg->src_id, ca_msg);
+		int done = ca_actor->handler(ca_actor->state, ca_msg);
+		ca_release_msg(ca_msg);
+		if(done) {
+			return CA_SWITCH_EXIT;
+		}
+	}
+	return CA_SWITCH_YIELD;
+}
+
+/*
+ * Private
+ * What a worker thread executes: resume runnable tasks one after
+ * the other, then deal with them according to why they switched back.
+ * Handler actors are run right here, on the worker's stack.
+ * A task only ever gets marked as parked here, once its context
+ * has been saved, so that it cannot be resumed twice.
+ */
+void* ca_worker_main_(void* arg) {
+	ca_worker_t* worker = (ca_worker_t*)arg;
+	ca_worker = worker;
+	for(;;) {
+		ca_actor_t* ca_actor = ca_find_task_(worker);
+		if(ca_actor == 0) {
+			ca_actor = ca_worker_idle_(worker);
+			if(ca_actor == 0) {
+				continue;
+			}
+		}
+		__atomic_store_n(&worker->ticks, worker->ticks + 1, __ATOMIC_RELAXED);
+		ca_self = ca_actor;
+		if(ca_actor->kind == CA_ACTOR_HANDLER) {
+			worker->switch_reason = ca_handler_run_(ca_actor);
+		}
+		else {
+			swapcontext(&worker->context, &ca_actor->task->context);
+		}
+		ca_self = 0;
+		switch(worker->switch_reason) {
+			case CA_SWITCH_YIELD:
+				// Back of the line
+				ca_runq_push_(ca_actor);
+				ca_notify_workers_();
+				break;
+			case CA_SWITCH_PARK:
+				if(!CA_ATOMIC_CAS(&ca_actor->wake_state, CA_TASK_RUNNING, CA_TASK_PARKED)) {
+					// Notified while switching out: run again
+					CA_ATOMIC_STORE(&ca_actor->wake_state, CA_TASK_RUNNING);
+					ca_schedule_(ca_actor);
+				}
+				break;
+			case CA_SWITCH_EXIT: {
+				ca_task_t* task = ca_actor->task;
+				ca_delete_actor_(ca_actor);
+				if(task != 0) {
+					ca_task_free_(task);
+				}
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Private
+ * Start the worker pool; called once
+ */
+void ca_workers_start_() {
+	int num_workers = ca_num_workers;
+	if(num_workers == 0) {
+		num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if(num_workers < 1) {
+			num_workers = 1;
+		}
+	}
+	ca_workers = (ca_worker_t**)malloc(num_workers * sizeof(ca_worker_t*));
+	int i;
+	for(i = 0; i < num_workers; i++) {
+		void* worker;
+		if(posix_memalign(&worker, CA_CACHE_LINE, sizeof(ca_worker_t)) != 0) {
+			break;
+		}
+		memset(worker, 0, sizeof(ca_worker_t));
+		ca_workers[i] = (ca_worker_t*)worker;
+		ca_workers[i]->index = i;
+		ca_workers[i]->rand_state = (unsigned int)i * 2654435761u + 1;
+		ca_workers[i]->seen_ticks = (unsigned long*)calloc(num_workers, sizeof(unsigned long));
+	}
+	ca_workers_count = num_workers = i;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for(i = 0; i < num_workers; i++) {
+		pthread_t thread;
+		pthread_create(&thread, &attr, &ca_worker_main_, (void*)ca_workers[i]);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+/*
+ * Private
+ * This function is what a task executes first
+ * Same as ca_actor_wrapper_(), except that cleaning up
+ * is left to the worker, once off this task's stack.
+ */
+void ca_task_entry_() {
+	ca_actor_t* ca_actor = ca_self;
+	ca_actor_args_t* args = ca_actor->args;
+	args->fn(args->arg);
+	free(args);
+	ca_task_switch_(ca_actor, CA_SWITCH_EXIT);
+}
+
+/*
+ * Private
+ * Turn a freshly allocated actor into a runnable task, on a
+ * stack_size stack. Returns 0 on success.
+ */
+int ca_spawn_task_(ca_actor_t* ca_actor, size_t stack_size) {
+	ca_task_t* task = ca_task_alloc_(stack_size);
+	if(task == 0) {
+		return -1;
+	}
+	ca_actor->kind = CA_ACTOR_TASK;
+	ca_actor->task = task;
+	getcontext(&task->context);
+	task->context.uc_stack.ss_sp = task->stack;
+	task->context.uc_stack.ss_size = task->stack_size;
+	task->context.uc_link = 0;
+	makecontext(&task->context, &ca_task_entry_, 0);
+	pthread_once(&ca_workers_once, &ca_workers_start_);
+	ca_schedule_(ca_actor);
+	return 0;
+}
+
+// ---------------------------------------------------------
+// Timers
+// One thread advances the wheel as time goes by, sleeping
+// until the next tick that has timers or that makes a level
+// wrap around. Arming and cancelling are O(1).
+// ---------------------------------------------------------
+
+/*
+ * Private
+ * Current tick, rounded down or up
+ */
+uint64_t ca_wheel_ticks_(int round_up) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t ns = (int64_t)(now.tv_sec - ca_wheel_epoch.tv_sec) * 1000000000
+		+ (now.tv_nsec - ca_wheel_epoch.tv_nsec);
+	return (uint64_t)((ns + (round_up ? 999999 : 0)) / 1000000);
+}
+
+/*
+ * Private
+ * CLOCK_MONOTONIC time of a tick, for timed waits
+ */
+struct timespec ca_wheel_time_(uint64_t tick) {
+	struct timespec at = ca_wheel_epoch;
+	at.tv_sec += tick / 1000;
+	at.tv_nsec += (tick % 1000) * 1000 * 1000;
+	if(at.tv_nsec >= 1000 * 1000 * 1000) {
+		at.tv_sec++;
+		at.tv_nsec -= 1000 * 1000 * 1000;
+	}
+	return at;
+}
+
+/*
+ * Private
+ * Timers table slot at index, below the high water mark
+ */
+ca_timer_t* ca_timer_slot_(uint32_t index) {
+	return &ca_timers_chunks[index >> CA_TIMERS_CHUNK_BITS][index & (CA_TIMERS_CHUNK_SIZE - 1)];
+}
+
+/*
+ * Private
+ * Put a timer in the slot matching its expiry tick.
+ * Caller must be guarding thread_timers_mutex.
+ */
+void ca_wheel_link_(ca_timer_t* timer) {
+	uint64_t expires = timer->expires;
+	int level = 0;
+	if(expires < ca_wheel_now) {
+		// Overdue: fire on next tick
+		expires = ca_wheel_now + 1;
+	}
+	else if(expires > ca_wheel_now) {
+		uint64_t delta = expires - ca_wheel_now;
+		while(level < CA_WHEEL_LEVELS - 1 && delta >= (1ULL << (CA_WHEEL_BITS * (level + 1)))) {
+			level++;
+		}
+		if(delta >= (1ULL << (CA_WHEEL_BITS * CA_WHEEL_LEVELS))) {
+			// Beyond the wheel: park in the farthest slot for now
+			expires = ca_wheel_now + (1ULL << (CA_WHEEL_BITS * CA_WHEEL_LEVELS)) - 1;
+		}
+	}
+	int slot = (int)((expires >> (CA_WHEEL_BITS * level)) & (CA_WHEEL_SLOTS - 1));
+	timer->level = level;
+	timer->slot = slot;
+	timer->prev = 0;
+	timer->next = ca_wheel[level][slot];
+	if(timer->next) {
+		timer->next->prev = timer;
+	}
+	ca_wheel[level][slot] = timer;
+	ca_wheel_used[level] |= 1ULL << slot;
+}
+
+/*
+ * Private
+ * Take a timer out of its slot.
+ * Caller must be guarding thread_timers_mutex.
+ */
+void ca_wheel_unlink_(ca_timer_t* timer) {
+	if(timer->prev) {
+		timer->prev->next = timer->next;
+	}
+	else {
+		ca_wheel[timer->level][timer->slot] = timer->next;
+		if(timer->next == 0) {
+			ca_wheel_used[timer->level] &= ~(1ULL << timer->slot);
+		}
+	}
+	if(timer->next) {
+		timer->next->prev = timer->prev;
+	}
+}
+
+/*
+ * Private
+ * Empty a slot, returning its timers
+ */
+ca_timer_t* ca_wheel_detach_(int level, int slot) {
+	ca_timer_t* timers = ca_wheel[level][slot];
+	ca_wheel[level][slot] = 0;
+	ca_wheel_used[level] &= ~(1ULL << slot);
+	return timers;
+}
+
+/*
+ * Private
+ * Process ticks up to now: move timers down a level as levels wrap
+ * around, and return the timers that expired, linked through next.
+ * Caller must be guarding thread_timers_mutex.
+ */
+ca_timer_t* ca_wheel_advance_(uint64_t now) {
+	ca_timer_t* fired = 0;
+	while(ca_wheel_now < now) {
+		if(ca_wheel_count == 0) {
+			ca_wheel_now = now;
+			break;
+		}
+		if(ca_wheel_used[0] == 0) {
+			// Nothing on the first level: skip to where it wraps around
+			uint64_t wrap = (ca_wheel_now + CA_WHEEL_SLOTS) & ~(uint64_t)(CA_WHEEL_SLOTS - 1);
+			if(wrap > now) {
+				ca_wheel_now = now;
+				break;
+			}
+			ca_wheel_now = wrap - 1;
+		}
+		uint64_t tick = ++ca_wheel_now;
+		int level;
+		for(level = 1; level < CA_WHEEL_LEVELS; level++) {
+			if((tick & ((1ULL << (CA_WHEEL_BITS * level)) - 1)) != 0) {
+				break;
+			}
+			// Level below just wrapped around: redistribute
+			int slot = (int)((tick >> (CA_WHEEL_BITS * level)) & (CA_WHEEL_SLOTS - 1));
+			ca_timer_t* timer = ca_wheel_detach_(level, slot);
+			while(timer) {
+				ca_timer_t* next = timer->next;
+				ca_wheel_link_(timer);
+				timer = next;
+			}
+		}
+		ca_timer_t* timer = ca_wheel_detach_(0, (int)(tick & (CA_WHEEL_SLOTS - 1)));
+		while(timer) {
+			ca_timer_t* next = timer->next;
+			if(timer->expires <= tick) {
+				timer->state = CA_TIMER_FIRING;
+				timer->next = fired;
+				fired = timer;
+				ca_wheel_count--;
+			}
+			else {
+				ca_wheel_link_(timer);
+			}
+			timer = next;
+		}
+	}
+	return fired;
+}
+
+/*
+ * Private
+ * Next tick worth waking up for, UINT64_MAX if none.
+ * Caller must be guarding thread_timers_mutex.
+ */
+uint64_t ca_wheel_next_() {
+	if(ca_wheel_count == 0) {
+		return UINT64_MAX;
+	}
+	uint64_t next = (ca_wheel_now + CA_WHEEL_SLOTS) & ~(uint64_t)(CA_WHEEL_SLOTS - 1);
+	uint64_t used = ca_wheel_used[0];
+	if(used != 0) {
+		int from = (int)((ca_wheel_now + 1) & (CA_WHEEL_SLOTS - 1));
+		uint64_t rotated = (used >> from) | (from ? used << (CA_WHEEL_SLOTS - from) : 0);
+		uint64_t tick = ca_wheel_now + 1 + __builtin_ctzll(rotated);
+		if(tick < next) {
+			next = tick;
+		}
+	}
+	return next;
+}
+
+/*
+ * Private
+ * Give a timer's slot back.
+ * Caller must be guarding thread_timers_mutex.
+ */
+void ca_timer_free_(ca_timer_t* timer) {
+	uint32_t index = (uint32_t)timer->id;
+	timer->state = CA_TIMER_FREE;
+	timer->id = 0;
+	timer->msg = 0;
+	timer->next_free = ca_timers_free_head;
+	ca_timers_free_head = index + 1;
+}
+
+/*
+ * Private
+ * A timer went off: deliver its message, or wake its actor up
+ */
+void ca_timer_fire_(ca_actor_id_t actor_id, ca_msg_t* ca_msg) {
+	ca_actor_t* ca_actor = ca_msg ? ca_target_(&actor_id) : ca_get_thread_info_(actor_id);
+	if(ca_msg) {
+		if(ca_actor) {
+			// Pools pick a member now
+			ca_msg->dest_id = actor_id;
+			ca_deliver_msg_(ca_actor, ca_msg);
+		}
+		else {
+			if(CA_ACTOR_ID_NODE(actor_id) != 0) {
+				// No waiting for room on the timers thread
+				(void)ca_node_send_(ca_msg->src_id, actor_id, CA_PRIO_NORMAL, 0,
+					ca_msg->type, ca_msg->data, ca_msg->data_size, 0);
+			}
+			ca_delete_msg_(ca_msg);
+		}
+		return;
+	}
+	if(ca_actor == 0) {
+		return;
+	}
+	if(ca_actor->kind != CA_ACTOR_THREAD) {
+		ca_unpark_task_(ca_actor);
+		return;
+	}
+	GUARD_ACTOR_SECTION("1actor-ca_timer_fire_", ca_actor)
+	pthread_cond_signal(&ca_actor->thread_cond);
+	LEAVE_SECTION("1actor-ca_timer_fire_", ca_actor->thread_cond_mutex)
+}
+
+/*
+ * Private
+ * Timers thread: advance the wheel, fire what expired, then sleep
+ * until the next tick worth looking at
+ */
+void* ca_timers_main_(void* arg) {
+	GUARD_SECTION("timers-ca_timers_main_", thread_timers_mutex)
+	for(;;) {
+		ca_timer_t* fired = ca_wheel_advance_(ca_wheel_ticks_(0));
+		if(fired) {
+			LEAVE_SECTION("timers-ca_timers_main_", thread_timers_mutex)
+			ca_timer_t* timer;
+			for(timer = fired; timer; timer = timer->next) {
+				ca_timer_fire_(timer->actor_id, timer->msg);
+			}
+			GUARD_SECTION("timers-ca_timers_main_", thread_timers_mutex)
+			while(fired) {
+				timer = fired;
+				fired = fired->next;
+				ca_timer_free_(timer);
+			}
+			continue;
+		}
+		ca_wheel_wakeup = ca_wheel_next_();
+		if(ca_wheel_wakeup == UINT64_MAX) {
+			pthread_cond_wait(&thread_timers_cond, &thread_timers_mutex);
+		}
+		else {
+			struct timespec deadline = ca_wheel_time_(ca_wheel_wakeup);
+			pthread_cond_timedwait(&thread_timers_cond, &thread_timers_mutex, &deadline);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Private
+ * Set up the timers thread; called once
+ */
+void ca_timers_start_() {
+	clock_gettime(CLOCK_MONOTONIC, &ca_wheel_epoch);
+	pthread_condattr_t condattr;
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&thread_timers_cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_t thread;
+	pthread_create(&thread, &attr, &ca_timers_main_, 0);
+	pthread_attr_destroy(&attr);
+}
+
+/*
+ * Private
+ * Tick at which a timer armed now for so many milliseconds expires.
+ * Rounded up: a timer never fires early.
+ */
+uint64_t ca_timer_deadline_(long milliseconds) {
+	pthread_once(&ca_timers_once, &ca_timers_start_);
+	return ca_wheel_ticks_(1) + (milliseconds > 0 ? (uint64_t)milliseconds : 0);
+}
+
+/*
+ * Private
+ * Has that deadline passed yet?
+ */
+int ca_timer_expired_(uint64_t deadline) {
+	return ca_wheel_ticks_(0) >= deadline;
+}
+
+/*
+ * Private
+ * Arm a timer that will, at tick 'expires', deliver ca_msg or, if
+ * there is none, wake actor_id up.
+ * Returns the timer's id, or 0 if there is no room for it.
+ */
+ca_timer_id_t ca_timer_arm_(ca_actor_id_t actor_id, uint64_t expires, ca_msg_t* ca_msg) {
+	pthread_once(&ca_timers_once, &ca_timers_start_);
+	ca_timer_t* timer;
+	uint32_t index;
+	GUARD_SECTION("timers-ca_timer_arm_", thread_timers_mutex)
+	if(ca_timers_free_head != 0) {
+		index = ca_timers_free_head - 1;
+		timer = ca_timer_slot_(index);
+		ca_timers_free_head = timer->next_free;
+	}
+	else {
+		index = ca_timers_high_water;
+		uint32_t chunk_index = index >> CA_TIMERS_CHUNK_BITS;
+		if(chunk_index >= CA_TIMERS_MAX_CHUNKS) {
+			LEAVE_SECTION("timers-ca_timer_arm_", thread_timers_mutex)
+			return 0;
+		}
+		if(ca_timers_chunks[chunk_index] == 0) {
+			ca_timers_chunks[chunk_index] = (ca_timer_t*)calloc(CA_TIMERS_CHUNK_SIZE, sizeof(ca_timer_t));
+			if(ca_timers_chunks[chunk_index] == 0) {
+				LEAVE_SECTION("timers-ca_timer_arm_", thread_timers_mutex)
+				return 0;
+			}
+		}
+		ca_timers_high_water = index + 1;
+		timer = ca_timer_slot_(index);
+	}
+	// Skip generation 0 so that no id is ever 0
+	if(++timer->generation == 0) {
+		timer->generation = 1;
+	}
+	timer->id = ((ca_timer_id_t)timer->generation << 32) | index;
+	// That tick is over already: make it the next one
+	timer->expires = expires > ca_wheel_now ? expires : ca_wheel_now + 1;
+	timer->actor_id = actor_id;
+	timer->msg = ca_msg;
+	timer->state = CA_TIMER_ARMED;
+	ca_wheel_link_(timer);
+	ca_wheel_count++;
+	if(timer->expires < ca_wheel_wakeup) {
+		// Earlier than the timers thread planned to look
+		ca_wheel_wakeup = timer->expires;
+		pthread_cond_signal(&thread_timers_cond);
+	}
+	ca_timer_id_t timer_id = timer->id;
+	LEAVE_SECTION("timers-ca_timer_arm_", thread_timers_mutex)
+	return timer_id;
+}
+
+/*
+ * Private
+ * Disarm a timer. Returns 1 if it had not fired yet, 0 if it has
+ * (or is about to) or if there is no such timer.
+ * A message it carried is deleted.
+ */
+int ca_timer_cancel_(ca_timer_id_t timer_id) {
+	uint32_t index = (uint32_t)timer_id;
+	ca_msg_t* ca_msg = 0;
+	int cancelled = 0;
+	GUARD_SECTION("timers-ca_timer_cancel_", thread_timers_mutex)
+	if(timer_id != 0 && index < ca_timers_high_water) {
+		ca_timer_t* timer = ca_timer_slot_(index);
+		if(timer->id == timer_id && timer->state == CA_TIMER_ARMED) {
+			ca_wheel_unlink_(timer);
+			ca_wheel_count--;
+			ca_msg = timer->msg;
+			ca_timer_free_(timer);
+			cancelled = 1;
+		}
+	}
+	LEAVE_SECTION("timers-ca_timer_cancel_", thread_timers_mutex)
+	if(ca_msg) {
+		ca_delete_msg_(ca_msg);
+	}
+	return cancelled;
+}
+
+/*
+ * Private
+ * This function is what a thread executes first
+ * This function will call the real function and perform
+ * some cleanup upon return
+ */
+void* ca_actor_wrapper_(void* ca_args) {
+	ca_actor_args_t* args = (ca_actor_args_t*)ca_args;
+	ca_actor_t* ca_actor = args->ca_actor;
+	ca_self = ca_actor;
+	args->fn(args->arg);
+	// We end up here when the actor's function returns
+	// Time to clean up and leave
+	free(args);
+	ca_delete_actor_(ca_actor);
+	ca_msg_cache_flush_();
+	return 0;
+}
+
+/*
+ * Private
+ * Spawning functions call this first. By definition, initializing
+ * states here is safe until the first actor is spawned.
+ */
+void ca_lib_init_() {
+	if(!ca_lib_initialized) {
+		ca_lib_initialized = 1;
+		pthread_mutex_init(&thread_actor_table_mutex, 0);
+		if(CA_STAT_READ(&ca_receive_spin) < 0) {
+			ca_set_receive_spin(-1);
+		}
+	}
+}
+
+/*
+ * Private
+ * Add NUMA node's CPUs to set, as listed by sysfs ("0-3,8").
+ * Returns the number of CPUs added: none if there is no such node.
+ */
+int ca_node_cpus_(int node, cpu_set_t* set) {
+	char path[64];
+	int count = 0;
+	int first, last;
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	FILE* list = fopen(path, "r");
+	if(list == 0) {
+		return 0;
+	}
+	while(fscanf(list, "%d", &first) == 1) {
+		last = first;
+		if(fscanf(list, "-%d", &last) != 1) {
+			last = first;
+		}
+		for(; first <= last && first < CPU_SETSIZE; first++) {
+			CPU_SET(first, set);
+			count++;
+		}
+		if(fgetc(list) != ',') {
+			break;
+		}
+	}
+	fclose(list);
+	return count;
+}
+
+/*
+ * Private
+ * Where a thread actor spawned with opts may run: the CPUs it names,
+ * on its NUMA node if any of them are. Returns 0 if anywhere.
+ */
+int ca_spawn_cpus_(const ca_spawn_opts_t* opts, cpu_set_t* set) {
+	cpu_set_t node_set;
+	int cpu;
+	int count = 0;
+	CPU_ZERO(set);
+	for(cpu = 0; cpu < CA_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+		if(opts->cpus[cpu / CA_CPU_MASK_BITS] == 0) {
+			cpu += CA_CPU_MASK_BITS - 1;
+		}
+		else if(opts->cpus[cpu / CA_CPU_MASK_BITS] & (1UL << (cpu % CA_CPU_MASK_BITS))) {
+			CPU_SET(cpu, set);
+			count++;
+		}
+	}
+	CPU_ZERO(&node_set);
+	if(opts->numa_node < 0 || ca_node_cpus_(opts->numa_node, &node_set) == 0) {
+		return count;
+	}
+	if(count == 0) {
+		*set = node_set;
+		return CPU_COUNT(set);
+	}
+	CPU_AND(&node_set, &node_set, set);
+	if(CPU_COUNT(&node_set) > 0) {
+		*set = node_set;
+	}
+	return CPU_COUNT(set);
+}
+
+/*
+ * Private
+ * Create a new actor:
+ * assign id and slot in actors table, set its mailbox limit,
+ * create matching thread (or, in CA_SCHED_WORKERS mode, matching task)
+ */
+ca_actor_t* ca_spawn_(void*(*fn)(void*), void* arg, const ca_spawn_opts_t* opts) {
+	ca_lib_init_();
+	ca_actor_t* ca_actor = ca_new_actor_(CA_ACTOR_THREAD, 0);
+	if(ca_actor == 0) {
+		return 0;
+	}
+	if(opts->overflow == CA_OVERFLOW_DROP_OLDEST) {
+		// For good: late senders may still drop from this slot's
+		// mailbox once it has a new tenant
+		ca_actor->trim_locked = 1;
+	}
+	ca_actor->overflow = opts->overflow;
+	ca_actor->send_timeout = opts->send_timeout;
+	CA_ATOMIC_STORE(&ca_actor->capacity, opts->capacity > 0 ? opts->capacity : 0);
+	ca_actor_args_t* ca_args = (ca_actor_args_t*)malloc(sizeof(ca_actor_args_t)); // Freed once fn returns
+	ca_args->ca_actor = ca_actor;
+	ca_args->fn = fn;
+	ca_args->arg = arg;
+	ca_actor->args = ca_args;
+	// Before it can run, let alone exit
+	CA_TRACE_EVENT(CA_TRACE_SPAWN, ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID, ACTOR_ID(ca_actor), 0, 0);
+	if(ca_sched_mode == CA_SCHED_WORKERS) {
+		// Tasks go wherever workers take them: no affinity
+		if(ca_spawn_task_(ca_actor, opts->stack_size > 0 ? opts->stack_size : CA_TASK_STACK_SIZE) != 0) {
+			free(ca_args);
+			ca_delete_actor_(ca_actor);
+			return 0;
+		}
+		return ca_actor;
+	}
+	// Nobody joins actor threads: let them go as soon as they are done
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	size_t stack_size = opts->stack_size > 0 ? opts->stack_size : CA_THREAD_STACK_SIZE;
+	if(stack_size > 0) {
+		pthread_attr_setstacksize(&attr, stack_size < (size_t)PTHREAD_STACK_MIN ? (size_t)PTHREAD_STACK_MIN : stack_size);
+	}
+	// Pinned before it runs: its stack, message cache and whatever
+	// else it allocates first touch memory on its own node
+	cpu_set_t cpus;
+	if(ca_spawn_cpus_(opts, &cpus) > 0) {
+		pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus);
+	}
+	int created = pthread_create(&(ca_actor->thread), &attr, &ca_actor_wrapper_, (void*)ca_args);
+	pthread_attr_destroy(&attr);
+	if(created != 0) {
+		free(ca_args);
+		ca_delete_actor_(ca_actor);
+		return 0;
+	}
+	return ca_actor;
+}
+
+ca_actor_t* ca_spawn(void*(*fn)(void*)) {
+	static const ca_spawn_opts_t defaults = CA_SPAWN_OPTS_INIT;
+	return ca_spawn_(fn, 0, &defaults);
+}
+
+/*
+ * Same as ca_spawn(), with a mailbox that holds at most capacity
+ * messages: see ca_set_mailbox_limit()
+ */
+ca_actor_t* ca_spawn_bounded(void*(*fn)(void*), long capacity, int policy, long timeout) {
+	ca_spawn_opts_t opts = CA_SPAWN_OPTS_INIT;
+	opts.capacity = capacity;
+	opts.overflow = policy;
+	opts.send_timeout = timeout;
+	return ca_spawn_(fn, 0, &opts);
+}
+
+/*
+ * Same as ca_spawn(), fn getting arg, as opts say (all defaults if
+ * none). Stack size goes for threads and tasks alike; CPU affinity
+ * and NUMA node only for actors on their own thread.
+ * Returns nothing if the actor could not be created, e.g. if none of
+ * the CPUs it may run on are online.
+ */
+ca_actor_t* ca_spawn_opts(void*(*fn)(void*), void* arg, const ca_spawn_opts_t* opts) {
+	static const ca_spawn_opts_t defaults = CA_SPAWN_OPTS_INIT;
+	return ca_spawn_(fn, arg, opts != 0 ? opts : &defaults);
+}
+
+/*
+ * Spawn an actor that is nothing but a mailbox and state: worker
+ * threads call handler(state, msg) for every message it receives,
+ * then release the message, until handler returns non-zero. The
+ * worker pool is started if need be, whatever the scheduler.
+ * A handler runs on its worker's stack and must not block it: its
+ * receives never wait (there is seldom a need for them anyway), nor
+ * do its sends to full mailboxes, but ca_sleep(), ca_wait_actor() or
+ * ca_join() would.
+ */
+ca_actor_t* ca_spawn_handler(ca_handler_fn_t handler, void* state) {
+	ca_lib_init_();
+	ca_actor_t* ca_actor = ca_new_actor_(CA_ACTOR_HANDLER, state);
+	if(ca_actor == 0) {
+		return 0;
+	}
+	ca_actor->handler = handler;
+	CA_TRACE_EVENT(CA_TRACE_SPAWN, ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID, ACTOR_ID(ca_actor), 0, 0);
+	pthread_once(&ca_workers_once, &ca_workers_start_);
+	// Runs once, like a new task: finding nothing to do, it parks
+	ca_schedule_(ca_actor);
+	return ca_actor;
+}
+
+// ---------------------------------------------------------
+// Pools
+// ---------------------------------------------------------
+
+/*
+ * Private
+ * Jump consistent hash (Lamping, Veach): which of buckets key goes
+ * to. Going from n to n + 1 buckets only moves keys to the new one,
+ * going back only moves those of the last one.
+ */
+int ca_jump_hash_(uint64_t key, int buckets) {
+	int64_t bucket = -1;
+	int64_t next = 0;
+	// Spread small keys, such as counters, first
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	while(next < buckets) {
+		bucket = next;
+		key = key * 2862933555777941757ULL + 1;
+		next = (int64_t)((bucket + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+	}
+	return (int)bucket;
+}
+
+/*
+ * Private
+ * Index of the member with the fewest messages queued, out of the
+ * first size. Ties go to the first one found from where this thread
+ * started last time, plus one; an empty mailbox ends the search.
+ */
+int ca_pool_shortest_(ca_pool_t* pool, int size) {
+	int index = (int)(ca_pool_cursor++ % (unsigned int)size);
+	int best = index;
+	long best_depth = -1;
+	int i;
+	for(i = 0; i < size; i++, index = index + 1 < size ? index + 1 : 0) {
+		ca_actor_t* member = ca_get_thread_info_(CA_ATOMIC_LOAD(&pool->members[index]));
+		if(member == 0) {
+			continue;
+		}
+		long depth = CA_STAT_READ(&member->sent) - CA_STAT_READ(&member->taken);
+		if(best_depth < 0 || depth < best_depth) {
+			best = index;
+			best_depth = depth > 0 ? depth : 0;
+			if(best_depth == 0) {
+				break;
+			}
+		}
+	}
+	return best;
+}
+
+/*
+ * Private
+ * Pick the member of pool slot ca_actor, of id *id, that a message
+ * goes to, by *key for CA_POOL_HASH, if there is one: round robin
+ * otherwise, lest all messages of a type pile up on one member.
+ * A member that has exited, not yet replaced, passes its turn to the
+ * next one. *id becomes the member's.
+ * Returns nothing, *id being 0, if the pool is empty or was retired
+ * meanwhile; also nothing if every member has exited.
+ */
+ca_actor_t* ca_pool_pick_(ca_actor_t* ca_actor, ca_actor_id_t* id, const uint64_t* key) {
+	ca_actor_id_t pool_id = *id;
+	*id = CA_INVALID_ACTOR_ID;
+	ca_pool_t* pool = (ca_pool_t*)CA_ATOMIC_LOAD(&ca_actor->state);
+	// Still the pool's slot after reading 'state': that was its pool
+	if(CA_ATOMIC_LOAD(&ca_actor->id) != pool_id) {
+		return 0;
+	}
+	int size = CA_ATOMIC_LOAD(&pool->size);
+	if(size <= 0) {
+		return 0;
+	}
+	int pick;
+	if(pool->policy == CA_POOL_HASH && key != 0) {
+		pick = ca_jump_hash_(*key, size);
+	}
+	else if(pool->policy == CA_POOL_LEAST_DEPTH) {
+		pick = ca_pool_shortest_(pool, size);
+	}
+	else {
+		pick = (int)(__atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % (unsigned long)size);
+	}
+	ca_actor_id_t member = CA_ATOMIC_LOAD(&pool->members[pick]);
+	ca_actor_t* target = ca_get_thread_info_(member);
+	int tries;
+	for(tries = 1; target == 0 && tries < size; tries++) {
+		pick = pick + 1 < size ? pick + 1 : 0;
+		member = CA_ATOMIC_LOAD(&pool->members[pick]);
+		target = ca_get_thread_info_(member);
+	}
+	// Retired, maybe handed to another pool, while we were at it
+	if(CA_ATOMIC_LOAD(&pool->id) != pool_id) {
+		return 0;
+	}
+	*id = member;
+	return target;
+}
+
+/*
+ * Private
+ * Actor that a message sent to *id goes to: that one, or if *id is a
+ * pool, the member it picks, *id becoming the member's. No key:
+ * ca_send_key() is the one way to route by one.
+ */
+ca_actor_t* ca_target_(ca_actor_id_t* id) {
+	ca_actor_t* ca_actor = ca_get_thread_info_(*id);
+	if(ca_actor != 0 && CA_ATOMIC_LOAD(&ca_actor->kind) == CA_ACTOR_POOL) {
+		return ca_pool_pick_(ca_actor, id, 0);
+	}
+	return ca_actor;
+}
+
+/*
+ * Private
+ * Grow or shrink pool to size members, its slot's mutex held. Members
+ * taken out are sent CA_MSG_TYPE_STOP, from the pool, once no longer
+ * picked; it gets in whether their mailbox is full or not.
+ * Returns the size reached, short of size if spawning failed.
+ */
+int ca_pool_resize_(ca_pool_t* pool, int size) {
+	static const ca_spawn_opts_t defaults = CA_SPAWN_OPTS_INIT;
+	int old_size = pool->size;
+	int i;
+	for(i = old_size; i < size; i++) {
+		ca_actor_t* member = ca_spawn_(pool->fn, 0, &defaults);
+		if(member == 0) {
+			size = i;
+			break;
+		}
+		CA_ATOMIC_STORE(&pool->members[i], ACTOR_ID(member));
+	}
+	CA_ATOMIC_STORE(&pool->size, size);
+	for(i = size; i < old_size; i++) {
+		ca_actor_t* member = ca_get_thread_info_(pool->members[i]);
+		ca_msg_t* ca_msg = member != 0 ? ca_new_msg_(pool->members[i], CA_MSG_TYPE_STOP, 0, 0) : 0;
+		if(ca_msg != 0) {
+			ca_msg->src_id = pool->id;
+			ca_deliver_msg_(member, ca_msg);
+		}
+	}
+	return size;
+}
+
+/*
+ * Private
+ * Retire pool slot ca_actor, counted as live, its members stopped:
+ * the pool goes back for the next one, the slot as an actor's does
+ */
+void ca_pool_retire_(ca_actor_t* ca_actor, ca_pool_t* pool) {
+	CA_ATOMIC_STORE(&pool->id, CA_INVALID_ACTOR_ID);
+	GUARD_SECTION("actors-ca_pool_retire_", thread_actor_table_mutex)
+	pool->next_free = ca_pools_free;
+	ca_pools_free = pool;
+	LEAVE_SECTION("actors-ca_pool_retire_", thread_actor_table_mutex)
+	ca_delete_actor_(ca_actor);
+}
+
+/*
+ * Spawn size actors running fn behind one id: whatever is sent to it
+ * goes to one of them, picked by policy, CA_POOL_*. That goes for
+ * every way of sending, timers and other nodes included. CA_POOL_HASH
+ * pools route by the key of ca_send_key(), other sends going round.
+ * The pool itself is not an actor: ca_join() waits for its members,
+ * not for it. See ca_pool_resize() to make it grow or shrink.
+ * Returns the pool's id, or 0 if size is not 1 to CA_POOL_MAX_SIZE,
+ * policy is unknown, or no member could be spawned.
+ */
+ca_actor_id_t ca_spawn_pool(void*(*fn)(void*), int size, int policy) {
+	if(size < 1 || size > CA_POOL_MAX_SIZE || policy < CA_POOL_ROUND_ROBIN || policy > CA_POOL_HASH) {
+		return CA_INVALID_ACTOR_ID;
+	}
+	ca_lib_init_();
+	GUARD_SECTION("actors-ca_spawn_pool", thread_actor_table_mutex)
+	ca_pool_t* pool = ca_pools_free;
+	if(pool != 0) {
+		ca_pools_free = pool->next_free;
+	}
+	LEAVE_SECTION("actors-ca_spawn_pool", thread_actor_table_mutex)
+	if(pool == 0 && posix_memalign((void**)&pool, CA_CACHE_LINE, sizeof(ca_pool_t)) != 0) {
+		return CA_INVALID_ACTOR_ID;
+	}
+	pool->policy = policy;
+	pool->size = 0;
+	pool->fn = fn;
+	pool->next = 0;
+	// Empty until its members are in: whatever finds the id first
+	// finds no member, not a mailbox nobody reads
+	ca_actor_t* ca_actor = ca_new_actor_(CA_ACTOR_POOL, pool);
+	if(ca_actor == 0) {
+		GUARD_SECTION("actors-ca_spawn_pool", thread_actor_table_mutex)
+		pool->next_free = ca_pools_free;
+		ca_pools_free = pool;
+		LEAVE_SECTION("actors-ca_spawn_pool", thread_actor_table_mutex)
+		return CA_INVALID_ACTOR_ID;
+	}
+	// Before its members: senders that still have it for the pool it
+	// was see it is not
+	CA_ATOMIC_STORE(&pool->id, ACTOR_ID(ca_actor));
+	GUARD_ACTOR_SECTION("1actor-ca_spawn_pool", ca_actor)
+	size = ca_pool_resize_(pool, size);
+	LEAVE_SECTION("1actor-ca_spawn_pool", ca_actor->thread_cond_mutex)
+	if(size == 0) {
+		ca_pool_retire_(ca_actor, pool);
+		return CA_INVALID_ACTOR_ID;
+	}
+	// Not an actor: its members are
+	ca_actors_live_drop_();
+	return ACTOR_ID(ca_actor);
+}
+
+/*
+ * Make pool id size members strong. New members are spawned; the last
+ * ones are taken out and sent CA_MSG_TYPE_STOP, after whatever was
+ * routed to them, though a message picking one of them right then may
+ * still get in behind it. 0 stops them all and retires the pool: its
+ * id then is that of an exited actor (see ca_monitor()).
+ * Returns 0, ESRCH if id is not a pool, EINVAL if size is over
+ * CA_POOL_MAX_SIZE, or EAGAIN if not every new member could be
+ * spawned: ca_pool_size() tells how far it got.
+ */
+int ca_pool_resize(ca_actor_id_t id, int size) {
+	if(size < 0 || size > CA_POOL_MAX_SIZE) {
+		return EINVAL;
+	}
+	ca_actor_t* ca_actor = ca_get_thread_info_(id);
+	if(ca_actor == 0 || CA_ATOMIC_LOAD(&ca_actor->kind) != CA_ACTOR_POOL) {
+		return ESRCH;
+	}
+	ca_pool_t* pool = (ca_pool_t*)CA_ATOMIC_LOAD(&ca_actor->state);
+	int reached = -1;
+	GUARD_ACTOR_SECTION("1actor-ca_pool_resize", ca_actor)
+	// Not retired by another resize meanwhile
+	if(CA_ATOMIC_LOAD(&ca_actor->id) == id && CA_ATOMIC_LOAD(&pool->id) == id) {
+		reached = ca_pool_resize_(pool, size);
+		if(reached == 0) {
+			CA_ATOMIC_STORE(&pool->id, CA_INVALID_ACTOR_ID);
+		}
+	}
+	LEAVE_SECTION("1actor-ca_pool_resize", ca_actor->thread_cond_mutex)
+	if(reached < 0) {
+		return ESRCH;
+	}
+	if(reached == 0) {
+		// Counted again, for ca_delete_actor_() to count out
+		CA_ATOMIC_ADD(&ca_actors_live, 1);
+		ca_pool_retire_(ca_actor, pool);
+		return 0;
+	}
+	return reached < size ? EAGAIN : 0;
+}
+
+/*
+ * Number of members pool id picks from, or -1 if id is not a pool
+ */
+int ca_pool_size(ca_actor_id_t id) {
+	ca_actor_t* ca_actor = ca_get_thread_info_(id);
+	if(ca_actor == 0 || CA_ATOMIC_LOAD(&ca_actor->kind) != CA_ACTOR_POOL) {
+		return -1;
+	}
+	ca_pool_t* pool = (ca_pool_t*)CA_ATOMIC_LOAD(&ca_actor->state);
+	if(CA_ATOMIC_LOAD(&ca_actor->id) != id) {
+		return -1;
+	}
+	int size = CA_ATOMIC_LOAD(&pool->size);
+	return CA_ATOMIC_LOAD(&pool->id) == id ? size : -1;
+}
+
+/*
+ * Same as ca_send(), routed by key if id is a CA_POOL_HASH pool:
+ * messages with the same key go to the same member as long as the
+ * pool keeps its size, and resizing moves as few keys as it can.
+ * To a pool of another node, the key is lost: it goes round.
+ */
+void ca_send_key(ca_actor_id_t id, uint64_t key, unsigned long type, void* data, size_t data_size) {
+	ca_actor_t* ca_actor = ca_get_thread_info_(id);
+	if(ca_actor != 0 && CA_ATOMIC_LOAD(&ca_actor->kind) == CA_ACTOR_POOL) {
+		(void)ca_pool_pick_(ca_actor, &id, &key);
+	}
+	ca_send(id, type, data, data_size);
+}
+
+/*
+ * Private
+ * Append message to mailbox, guarding in the fallback build
+ */
+void ca_post_msg_(ca_actor_t* ca_actor, int lane, ca_msg_t* first, ca_msg_t* last) {
+#if CA_MAILBOX_LOCKFREE == 1
+	ca_enqueue_msg_(ca_actor, lane, first, last);
+#else
+	GUARD_ACTOR_SECTION("1actor-ca_post_msg_", ca_actor)
+	ca_enqueue_msg_(ca_actor, lane, first, last);
+	LEAVE_SECTION("1actor-ca_post_msg_", ca_actor->thread_cond_mutex)
+#endif
+}
+
+/*
+ * Private
+ * Pop next message from own mailbox, guarding in the fallback build
+ */
+ca_msg_t* ca_try_dequeue_msg_(ca_actor_t* ca_actor) {
+#if CA_MAILBOX_LOCKFREE == 1
+	return ca_dequeue_msg_(ca_actor, MSG_RETRIEVE_ACTION);
+#else
+	GUARD_ACTOR_SECTION("1actor-ca_try_dequeue_msg_", ca_actor)
+	ca_msg_t* ca_msg = ca_dequeue_msg_(ca_actor, MSG_RETRIEVE_ACTION);
+	LEAVE_SECTION("1actor-ca_try_dequeue_msg_", ca_actor->thread_cond_mutex)
+	return ca_msg;
+#endif
+}
+
+/*
+ * Private
+ * Pop up to max messages from own mailbox into out.
+ * Fallback build: caller must be guarding the actor's condition mutex.
+ */
+int ca_dequeue_msgs_(ca_actor_t* ca_actor, ca_msg_t** out, int max) {
+	int count = 0;
+	while(count < max && (out[count] = ca_dequeue_msg_(ca_actor, MSG_RETRIEVE_ACTION)) != 0) {
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Let thread actors about to wait for a message spin on their mailbox
+ * for up to that many nanoseconds first, in case one comes soon: a
+ * reply often does, and catching it saves going to sleep and being
+ * woken up. 0 never spins; negative restores the default,
+ * CA_RECEIVE_SPIN_NS with more than one CPU online, 0 otherwise.
+ * Tasks never spin: parking costs them no system call.
+ */
+void ca_set_receive_spin(long nanoseconds) {
+	if(nanoseconds < 0) {
+		nanoseconds = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? CA_RECEIVE_SPIN_NS : 0;
+	}
+	__atomic_store_n(&ca_receive_spin, nanoseconds, __ATOMIC_RELAXED);
+}
+
+/*
+ * Private
+ * Thread actor with nothing to receive: spin a while in case messages
+ * come soon. Returns non-zero as soon as a sender queued anything.
+ * The budget adapts to the actor: twice the time messages took to come
+ * when it caught them spinning, shrinking whenever none came, and at
+ * least an eighth of ca_receive_spin so that it can grow back.
+ * Only the actor itself calls this.
+ */
+int ca_spin_for_msgs_(ca_actor_t* ca_actor) {
+	long limit = CA_STAT_READ(&ca_receive_spin);
+	if(limit <= 0) {
+		return 0;
+	}
+	long budget = 2 * (long)ca_actor->spin_ns + limit / 8;
+	if(budget > limit) {
+		budget = limit;
+	}
+	long sent = CA_ATOMIC_LOAD(&ca_actor->sent);
+	uint64_t start = ca_now_ns_();
+	unsigned int spins = 0;
+	for(;;) {
+		CA_CPU_RELAX();
+		if(CA_ATOMIC_LOAD(&ca_actor->sent) != sent) {
+			long waited = (long)(ca_now_ns_() - start);
+			ca_actor->spin_ns += (waited - ca_actor->spin_ns) / 8;
+			return 1;
+		}
+		// Reading the clock costs more than a look at the mailbox
+		if((++spins & 31) == 0 && ca_now_ns_() - start >= (uint64_t)budget) {
+			break;
+		}
+	}
+	ca_actor->spin_ns -= ca_actor->spin_ns / 8;
+	return 0;
+}
+
+/*
+ * Private
+ * Thread actor about to wait on its condition, guarding its mutex:
+ * from now on, the next sender signals it (see ca_wake_thread_()).
+ * The caller looks at its mailbox again before every wait, this
+ * first, then sets wake_state back to CA_TASK_RUNNING once done.
+ */
+void ca_thread_parking_(ca_actor_t* ca_actor) {
+	__atomic_store_n(&ca_actor->wake_state, CA_TASK_PARKED, __ATOMIC_RELAXED);
+	// Pairs with the fence in ca_wake_thread_(): either the sender
+	// sees us parked, or we see what it queued
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * Private
+ * Wake thread actor up, messages having just been queued, if it is
+ * waiting for them. Only the first sender to find it parked signals
+ * it; a busy actor, or one already woken up, costs its senders neither
+ * its mutex nor a signal. Holding the mutex to signal makes sure the
+ * actor either is waiting already, or has yet to look at its mailbox.
+ */
+void ca_wake_thread_(ca_actor_t* ca_actor) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ca_actor->wake_state, __ATOMIC_RELAXED) != CA_TASK_PARKED
+		|| CA_ATOMIC_XCHG(&ca_actor->wake_state, CA_TASK_RUNNING) != CA_TASK_PARKED) {
+		return;
+	}
+	GUARD_ACTOR_SECTION("1actor-ca_wake_thread_", ca_actor)
+	pthread_cond_signal(&ca_actor->thread_cond);
+	LEAVE_SECTION("1actor-ca_wake_thread_", ca_actor->thread_cond_mutex)
+}
+
+/*
+ * Wait for a message for this actor:
+ * spin a while, then lock, say we are parked, wait for signal, unlock
+ * Tasks park instead, letting their worker run other actors.
+ */
+ca_msg_t* ca_receive() {
+	ca_msg_t* ca_msg;
+	ca_actor_t* ca_actor = ca_self;
+	if(ca_actor == 0) {
+		// Not an actor: there is no mailbox to wait on
+		return 0;
+	}
+	if(ca_actor->kind == CA_ACTOR_HANDLER) {
+		// Must not hold its worker up: whatever is there, if anything
+		ca_msg = ca_try_dequeue_msg_(ca_actor);
+		if(ca_msg != 0) {
+			CA_TRACE_MSG(CA_TRACE_RECEIVE, ACTOR_ID(ca_actor), ca_msg->src_id, ca_msg);
+		}
+		return ca_msg;
+	}
+	if(ca_actor->kind == CA_ACTOR_TASK) {
+		ca_msg = ca_try_dequeue_msg_(ca_actor);
+		if(ca_msg == 0) {
+			uint64_t since = ca_now_ns_();
+			do {
+				ca_task_switch_(ca_actor, CA_SWITCH_PARK);
+			} while((ca_msg = ca_try_dequeue_msg_(ca_actor)) == 0);
+			ca_note_blocked_(ca_actor, since);
+		}
+		CA_TRACE_MSG(CA_TRACE_RECEIVE, ACTOR_ID(ca_actor), ca_msg->src_id, ca_msg);
+		return ca_msg;
+	}
+	// Maybe we already have messages in the pipeline...
+	// In that case we do not need to wait.
+#if CA_MAILBOX_LOCKFREE == 1
+	// ...nor even to guard anything.
+	ca_msg = ca_dequeue_msg_(ca_actor, MSG_RETRIEVE_ACTION);
+	if(ca_msg == 0 && ca_spin_for_msgs_(ca_actor)) {
+		ca_msg = ca_dequeue_msg_(ca_actor, MSG_RETRIEVE_ACTION);
+	}
+	if(ca_msg != 0) {
+		CA_TRACE_MSG(CA_TRACE_RECEIVE, ACTOR_ID(ca_actor), ca_msg->src_id, ca_msg);
+		return ca_msg;
+	}
+#endif
+	GUARD_ACTOR_SECTION("1actor-ca_receive", ca_actor)
+	ca_thread_parking_(ca_actor);
+	ca_msg = ca_dequeue_msg_(ca_actor, MSG_RETRIEVE_ACTION);
+	if(ca_msg == 0) {
+		uint64_t since = ca_now_ns_();
+		do {
+			// Looks like we will have to wait,,,
+			pthread_cond_wait(&ca_actor->thread_cond, &ca_actor->thread_cond_mutex);
+			// ...and whoever woke us up took the flag down
+			ca_thread_parking_(ca_actor);
+		} while((ca_msg = ca_dequeue_msg_(ca_actor, MSG_RETRIEVE_ACTION)) == 0);
+		ca_note_blocked_(ca_actor, since);
+	}
+	__atomic_store_n(&ca_actor->wake_state, CA_TASK_RUNNING, __ATOMIC_RELAXED);
+	LEAVE_SECTION("1actor-ca_receive", ca_actor->thread_cond_mutex)
+	CA_TRACE_MSG(CA_TRACE_RECEIVE, ACTOR_ID(ca_actor), ca_msg->src_id, ca_msg);
+	return ca_msg;
+}
+
+/*
+ * Private
+ * Something to try again every time the actor wakes up while waiting
+ * for messages; returns non-zero once it is satisfied.
+ */
+typedef int (*ca_attempt_fn_t)(ca_actor_t* ca_actor, void* context);
+
+/*
+ * Private
+ * Run an attempt, guarding the mailbox in the fallback build
+ */
+int ca_try_attempt_(ca_actor_t* ca_actor, ca_attempt_fn_t attempt, void* context) {
+#if CA_MAILBOX_LOCKFREE == 1
+	return attempt(ca_actor, context);
+#else
+	GUARD_ACTOR_SECTION("1actor-ca_try_attempt_", ca_actor)
+	int done = attempt(ca_actor, context);
+	LEAVE_SECTION("1actor-ca_try_attempt_", ca_actor->thread_cond_mutex)
+	return done;
+#endif
+}
+
+/*
+ * Private
+ * Make attempts until one succeeds or timeout milliseconds have gone
+ * by: forever if timeout is negative, once if it is 0.
+ * Tasks park between attempts; threads wait on their condition, with
+ * the timers thread to wake them up in time. Returns the last
+ * attempt's result.
+ */
+int ca_wait_for_(ca_actor_t* ca_actor, long timeout, ca_attempt_fn_t attempt, void* context) {
+	int done;
+	uint64_t deadline = 0;
+	uint64_t since;
+	ca_timer_id_t timer = 0;
+	if(ca_actor->kind == CA_ACTOR_HANDLER) {
+		// Never waits: it would hold its worker up
+		timeout = 0;
+	}
+	if(ca_actor->kind == CA_ACTOR_TASK) {
+		if(timeout > 0) {
+			// Only a message sent from now on may end the wait early
+			(void)CA_ATOMIC_CAS(&ca_actor->wake_state, CA_TASK_NOTIFIED, CA_TASK_RUNNING);
+		}
+		done = ca_try_attempt_(ca_actor, attempt, context);
+		if(done || timeout == 0) {
+			return done;
+		}
+		if(timeout > 0) {
+			deadline = ca_timer_deadline_(timeout);
+			timer = ca_timer_arm_(ACTOR_ID(ca_actor), deadline, 0);
+			if(timer == 0) {
+				// Nothing would unpark us in time: timed out
+				return 0;
+			}
+		}
+		since = ca_now_ns_();
+		do {
+			ca_task_switch_(ca_actor, CA_SWITCH_PARK);
+			done = ca_try_attempt_(ca_actor, attempt, context);
+		} while(!done && (timeout < 0 || !ca_timer_expired_(deadline)));
+		ca_note_blocked_(ca_actor, since);
+		(void)ca_timer_cancel_(timer);
+		return done;
+	}
+#if CA_MAILBOX_LOCKFREE == 1
+	done = attempt(ca_actor, context);
+	if(!done && timeout != 0 && ca_spin_for_msgs_(ca_actor)) {
+		done = attempt(ca_actor, context);
+	}
+	if(done || timeout == 0) {
+		return done;
+	}
+#endif
+	if(timeout > 0) {
+		// The timers thread signals us: no timed wait of our own
+		deadline = ca_timer_deadline_(timeout);
+		timer = ca_timer_arm_(ACTOR_ID(ca_actor), deadline, 0);
+		if(timer == 0) {
+			// Nothing would signal us in time: one last look, then
+			// timed out
+			timeout = 0;
+		}
+	}
+	GUARD_ACTOR_SECTION("1actor-ca_wait_for_", ca_actor)
+	ca_thread_parking_(ca_actor);
+	done = attempt(ca_actor, context);
+	if(!done && timeout != 0) {
+		since = ca_now_ns_();
+		while(!done && timeout != 0) {
+			if(timeout > 0 && ca_timer_expired_(deadline)) {
+				break;
+			}
+			pthread_cond_wait(&ca_actor->thread_cond, &ca_actor->thread_cond_mutex);
+			ca_thread_parking_(ca_actor);
+			done = attempt(ca_actor, context);
+		}
+		ca_note_blocked_(ca_actor, since);
+	}
+	__atomic_store_n(&ca_actor->wake_state, CA_TASK_RUNNING, __ATOMIC_RELAXED);
+	LEAVE_SECTION("1actor-ca_wait_for_", ca_actor->thread_cond_mutex)
+	(void)ca_timer_cancel_(timer);
+	return done;
+}
+
+// What ca_receive_many() is after
+struct ca_drain {
+	ca_msg_t** out;
+	int max;
+	int count;
+};
+
+/*
+ * Private
+ * ca_receive_many() attempt: take whatever is there
+ */
+int ca_attempt_drain_(ca_actor_t* ca_actor, void* context) {
+	struct ca_drain* drain = (struct ca_drain*)context;
+	drain->count = ca_dequeue_msgs_(ca_actor, drain->out, drain->max);
+	return drain->count > 0;
+}
+
+/*
+ * Drain own mailbox: wait for at least one message, then take as many
+ * as are already there, up to max, in one go.
+ * Waits at most timeout milliseconds; forever if timeout is negative,
+ * not at all if it is 0.
+ * Returns the number of messages stored in out, each to be released.
+ */
+int ca_receive_many(ca_msg_t** out, int max, long timeout) {
+	ca_actor_t* ca_actor = ca_self;
+	if(ca_actor == 0 || max <= 0) {
+		return 0;
+	}
+	struct ca_drain drain = { out, max, 0 };
+	(void)ca_wait_for_(ca_actor, timeout, &ca_attempt_drain_, &drain);
+#if CA_TRACE == 1
+	int i;
+	for(i = 0; i < drain.count; i++) {
+		CA_TRACE_MSG(CA_TRACE_RECEIVE, ACTOR_ID(ca_actor), out[i]->src_id, out[i]);
+	}
+#endif
+	return drain.count;
+}
+
+/*
+ * Wait for a message for at most timeout milliseconds (forever if
+ * negative). Returns nothing if none came in time.
+ */
+ca_msg_t* ca_receive_timeout(long timeout) {
+	ca_msg_t* ca_msg;
+	return ca_receive_many(&ca_msg, 1, timeout) == 1 ? ca_msg : 0;
+}
+
+// What a selective receive is after: types in type_mask, or
+// whatever match() accepts if set
+struct ca_selection {
+	uint64_t type_mask;
+	int (*match)(ca_msg_t*, void*);
+	void* arg;
+	ca_msg_t* found;
+};
+
+/*
+ * Private
+ * Selective receive attempt: go through the messages that came in
+ * since last time, setting aside those that do not match
+ */
+int ca_attempt_select_(ca_actor_t* ca_actor, void* context) {
+	struct ca_selection* selection = (struct ca_selection*)context;
+	ca_msg_t* ca_msg;
+	while((ca_msg = ca_dequeue_mailbox_(ca_actor)) != 0) {
+		if(selection->match ? selection->match(ca_msg, selection->arg)
+				: (selection->type_mask & CA_TYPE_BIT(ca_msg->type)) != 0) {
+			selection->found = ca_msg;
+			return 1;
+		}
+		ca_stash_put_(ca_actor->stash, ca_msg);
+	}
+	return 0;
+}
+
+/*
+ * Private
+ * Selective receive: oldest matching message, from the stash first.
+ * Messages that do not match stay queued, in order, for later receives.
+ */
+ca_msg_t* ca_receive_select_(struct ca_selection* selection, long timeout) {
+	ca_actor_t* ca_actor = ca_self;
+	if(ca_actor == 0) {
+		return 0;
+	}
+	ca_stash_t* stash = ca_stash_of_(ca_actor);
+	if(stash == 0) {
+		return 0;
+	}
+	if(stash->count > 0) {
+		ca_msg_t* ca_msg = selection->match
+			? ca_stash_take_fn_(stash, selection->match, selection->arg)
+			: ca_stash_take_mask_(stash, selection->type_mask);
+		if(ca_msg) {
+			CA_TRACE_MSG(CA_TRACE_RECEIVE, ACTOR_ID(ca_actor), ca_msg->src_id, ca_msg);
+			return ca_msg;
+		}
+	}
+	selection->found = 0;
+	(void)ca_wait_for_(ca_actor, timeout, &ca_attempt_select_, selection);
+	if(selection->found) {
+		CA_TRACE_MSG(CA_TRACE_RECEIVE, ACTOR_ID(ca_actor), selection->found->src_id, selection->found);
+	}
+	return selection->found;
+}
+
+/*
+ * Wait for the oldest message whose type is in type_mask, built with
+ * CA_TYPE_BIT(): types from 63 up all share the last bit. Other
+ * messages stay queued, in order. Finding a match among those set
+ * aside costs one check per type in the mask, however many there are.
+ * timeout as for ca_receive_timeout().
+ */
+ca_msg_t* ca_receive_match(uint64_t type_mask, long timeout) {
+	struct ca_selection selection = { type_mask, 0, 0, 0 };
+	return ca_receive_select_(&selection, timeout);
+}
+
+/*
+ * Same, for the oldest message match(msg, arg) returns non-zero for
+ */
+ca_msg_t* ca_receive_match_fn(int (*match)(ca_msg_t* msg, void* arg), void* arg, long timeout) {
+	struct ca_selection selection = { 0, match, arg, 0 };
+	return ca_receive_select_(&selection, timeout);
+}
+
+/*
+ * Private
+ * Hand messages first to last over to their (live) recipient,
+ * on the given lane, and wake it up, once
+ */
+void ca_deliver_msgs_(ca_actor_t* ca_actor, int lane, ca_msg_t* first, ca_msg_t* last) {
+	// Now or never: once queued, they may be gone any time
+	CA_TRACE_MSG(CA_TRACE_ENQUEUE, first->src_id, first->dest_id, first);
+	if(ca_actor->kind != CA_ACTOR_THREAD) {
+		ca_post_msg_(ca_actor, lane, first, last);
+		ca_unpark_task_(ca_actor);
+		return;
+	}
+#if CA_MAILBOX_LOCKFREE == 1
+	ca_enqueue_msg_(ca_actor, lane, first, last);
+	ca_wake_thread_(ca_actor);
+#else
+	GUARD_ACTOR_SECTION("1actor", ca_actor)
+	ca_enqueue_msg_(ca_actor, lane, first, last);
+	// Send signal, if it is waiting: there is a message!
+	if(ca_actor->wake_state == CA_TASK_PARKED) {
+		ca_actor->wake_state = CA_TASK_RUNNING;
+		pthread_cond_signal(&ca_actor->thread_cond);
+	}
+	LEAVE_SECTION("1actor", ca_actor->thread_cond_mutex)
+#endif
+}
+
+/*
+ * Private
+ * Raise actor's depth high water mark to the depth 'sent' makes,
+ * if higher, and return that depth. Racy, but only ever up.
+ */
+long ca_note_depth_(ca_actor_t* ca_actor, long sent) {
+	long depth = sent - CA_ATOMIC_LOAD(&ca_actor->taken);
+	long high = CA_STAT_READ(&ca_actor->depth_high_water);
+	while(depth > high && !__atomic_compare_exchange_n(&ca_actor->depth_high_water, &high, depth, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+	return depth;
+}
+
+/*
+ * Private
+ * Count count messages as queued for actor, no questions asked;
+ * returns its depth
+ */
+long ca_queued_(ca_actor_t* ca_actor, int count) {
+	return ca_note_depth_(ca_actor, CA_ATOMIC_ADD(&ca_actor->sent, count));
+}
+
+/*
+ * Private
+ * Same, for a message going to one of actor's priority lanes, which
+ * must have been allocated. Counted in the lanes first: trimming the
+ * mailbox proper must never take it for one of its own.
+ */
+void ca_lane_queued_(ca_actor_t* ca_actor) {
+	CA_ATOMIC_ADD(&ca_actor->prio_lanes->queued, 1);
+	(void)ca_queued_(ca_actor, 1);
+}
+
+/*
+ * Private
+ * Count count messages as sent by the calling actor, if any
+ */
+void ca_count_out_(int count) {
+	ca_actor_t* self = ca_self;
+	if(self != 0) {
+		CA_STAT_BUMP(&self->msgs_out, count);
+	}
+}
+
+/*
+ * Private
+ * Hand a message over to its (live) recipient and wake it up,
+ * whether its mailbox is full or not
+ */
+void ca_deliver_msg_(ca_actor_t* ca_actor, ca_msg_t* ca_msg) {
+	(void)ca_queued_(ca_actor, 1);
+	ca_deliver_msgs_(ca_actor, CA_PRIO_NORMAL, ca_msg, ca_msg);
+}
+
+/*
+ * Private
+ * Reserve room for up to count messages below capacity in actor's
+ * mailbox; returns how many fit.
+ */
+int ca_reserve_room_(ca_actor_t* ca_actor, long capacity, int count) {
+	long sent = __atomic_load_n(&ca_actor->sent, __ATOMIC_SEQ_CST);
+	long room;
+	do {
+		room = capacity - (sent - __atomic_load_n(&ca_actor->taken, __ATOMIC_SEQ_CST));
+		if(room <= 0) {
+			return 0;
+		}
+		if(room > count) {
+			room = count;
+		}
+	} while(!__atomic_compare_exchange_n(&ca_actor->sent, &sent, sent + room, 1,
+			__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+	(void)ca_note_depth_(ca_actor, sent + room);
+	return (int)room;
+}
+
+/*
+ * Private
+ * How many messages actor's mailbox proper holds: its whole depth but
+ * for what its priority lanes do
+ */
+long ca_mailbox_depth_(ca_actor_t* ca_actor) {
+	ca_prio_lanes_t* lanes = CA_ATOMIC_LOAD(&ca_actor->prio_lanes);
+	long depth = CA_ATOMIC_LOAD(&ca_actor->sent) - CA_ATOMIC_LOAD(&ca_actor->taken);
+	return lanes == 0 ? depth : depth - CA_ATOMIC_LOAD(&lanes->queued);
+}
+
+/*
+ * Private
+ * Drop the oldest messages in a CA_OVERFLOW_DROP_OLDEST actor's
+ * mailbox until it is back down to capacity
+ */
+void ca_trim_mailbox_(ca_actor_t* ca_actor, long capacity) {
+	ca_msg_t* ca_msg;
+#if CA_MAILBOX_LOCKFREE == 0
+	GUARD_ACTOR_SECTION("1actor-ca_trim_mailbox_", ca_actor)
+#endif
+	while(ca_mailbox_depth_(ca_actor) > capacity && (ca_msg = ca_mailbox_take_(ca_actor)) != 0) {
+		ca_popped_(ca_actor);
+		ca_delete_msg_(ca_msg);
+		CA_STAT_ADD(&ca_actor->dropped, 1);
+		CA_STAT_ADD(&ca_actor->trimmed, 1);
+	}
+#if CA_MAILBOX_LOCKFREE == 0
+	LEAVE_SECTION("1actor-ca_trim_mailbox_", ca_actor->thread_cond_mutex)
+#endif
+}
+
+/*
+ * Private
+ * Give back room reserved for count messages that were not sent after all
+ */
+void ca_unreserve_room_(ca_actor_t* ca_actor, int count) {
+	__atomic_sub_fetch(&ca_actor->sent, count, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ca_actor->room_waiters, __ATOMIC_SEQ_CST) != 0) {
+		ca_wake_room_waiters_(ca_actor);
+	}
+}
+
+/*
+ * Private
+ * Condition a thread waiting alone sleeps on, timed by the clock
+ * timer ticks go by
+ */
+void ca_wake_cond_init_(pthread_cond_t* cond) {
+	pthread_condattr_t condattr;
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+}
+
+/*
+ * Private
+ * Thread waiter: sleep on its own condition until signalled or, if
+ * not 0, tick deadline. Caller must be guarding thread_join_mutex.
+ */
+void ca_waiter_sleep_(ca_monitor_t* waiter, uint64_t deadline) {
+	if(deadline == 0) {
+		pthread_cond_wait(waiter->wake, &thread_join_mutex);
+		return;
+	}
+	struct timespec at = ca_wheel_time_(deadline);
+	pthread_cond_timedwait(waiter->wake, &thread_join_mutex, &at);
+}
+
+/*
+ * Private
+ * A sender waiting for room in actor id's mailbox: register, look
+ * again, then wait until woken up, the actor is gone or deadline
+ * (if not 0) has passed. Returns how many messages it could reserve
+ * room for after all, up to count.
+ * A thread sleeps on a condition of its own: whoever makes room wakes
+ * it alone, not every thread waiting on anything.
+ */
+int ca_wait_room_(ca_actor_t* ca_actor, ca_actor_id_t id, long capacity, int count, uint64_t deadline) {
+	ca_actor_t* self = ca_self;
+	int is_task = self != 0 && self->kind == CA_ACTOR_TASK;
+	volatile int done = 0;
+	pthread_cond_t wake;
+	ca_monitor_t waiter;
+	waiter.watcher = self ? ACTOR_ID(self) : CA_INVALID_ACTOR_ID;
+	waiter.kind = CA_MONITOR_WAIT;
+	waiter.done = &done;
+	waiter.wake = 0;
+	if(!is_task) {
+		ca_wake_cond_init_(&wake);
+		waiter.wake = &wake;
+	}
+	GUARD_SECTION("join-ca_wait_room_", thread_join_mutex)
+	waiter.next = ca_actor->room_waiters;
+	__atomic_store_n(&ca_actor->room_waiters, &waiter, __ATOMIC_SEQ_CST);
+	LEAVE_SECTION("join-ca_wait_room_", thread_join_mutex)
+	int reserved = ca_reserve_room_(ca_actor, capacity, count);
+	if(reserved == 0 && CA_ATOMIC_LOAD(&ca_actor->id) == id) {
+		if(is_task) {
+			while(!CA_ATOMIC_LOAD(&done) && (deadline == 0 || !ca_timer_expired_(deadline))) {
+				ca_task_switch_(self, CA_SWITCH_PARK);
+			}
+		}
+		else {
+			GUARD_SECTION("join-ca_wait_room_", thread_join_mutex)
+			while(!done && (deadline == 0 || !ca_timer_expired_(deadline))) {
+				ca_waiter_sleep_(&waiter, deadline);
+			}
+			LEAVE_SECTION("join-ca_wait_room_", thread_join_mutex)
+		}
+	}
+	// Leave the list, or, if the receiver took us off it already,
+	// let it finish with us before we are gone
+	int listed = 0;
+	GUARD_SECTION("join-ca_wait_room_", thread_join_mutex)
+	ca_monitor_t** link;
+	for(link = &ca_actor->room_waiters; *link != 0; link = &(*link)->next) {
+		if(*link == &waiter) {
+			*link = waiter.next;
+			listed = 1;
+			break;
+		}
+	}
+	while(!listed && !done && !is_task) {
+		ca_waiter_sleep_(&waiter, 0);
+	}
+	LEAVE_SECTION("join-ca_wait_room_", thread_join_mutex)
+	while(!listed && !CA_ATOMIC_LOAD(&done)) {
+		ca_task_switch_(self, CA_SWITCH_PARK);
+	}
+	if(!is_task) {
+		pthread_cond_destroy(&wake);
+	}
+	return reserved;
+}
+
+/*
+ * Private
+ * Make room for up to count messages in actor id's mailbox, as its
+ * overflow policy says: returns how many may be sent, room for them
+ * being reserved. Never blocks if may_block is 0, nor on the sender's
+ * own mailbox.
+ */
+int ca_admit_(ca_actor_t* ca_actor, ca_actor_id_t id, int count, int may_block) {
+	long capacity = CA_ATOMIC_LOAD(&ca_actor->capacity);
+	if(capacity == 0) {
+		(void)ca_queued_(ca_actor, count);
+		return count;
+	}
+	int policy = ca_actor->overflow;
+	if(policy == CA_OVERFLOW_DROP_OLDEST && may_block) {
+		if(ca_queued_(ca_actor, count) > capacity) {
+			ca_trim_mailbox_(ca_actor, capacity);
+		}
+		return count;
+	}
+	int admitted = ca_reserve_room_(ca_actor, capacity, count);
+	long timeout = ca_actor->send_timeout;
+	if(admitted == count || policy != CA_OVERFLOW_BLOCK || !may_block
+			|| timeout == 0 || ca_actor == ca_self
+			|| (ca_self != 0 && ca_self->kind == CA_ACTOR_HANDLER)) {
+		if(admitted < count) {
+			CA_STAT_ADD(&ca_actor->dropped, count - admitted);
+		}
+		return admitted;
+	}
+	uint64_t deadline = 0;
+	ca_timer_id_t timer = 0;
+	if(timeout > 0) {
+		ca_actor_t* self = ca_self;
+		deadline = ca_timer_deadline_(timeout);
+		// Tasks get unparked then; threads time their own wait
+		if(self != 0 && self->kind == CA_ACTOR_TASK
+				&& (timer = ca_timer_arm_(ACTOR_ID(self), deadline, 0)) == 0) {
+			// Nothing would wake us in time: timed out
+			CA_STAT_ADD(&ca_actor->dropped, count - admitted);
+			return admitted;
+		}
+	}
+	while(admitted < count && CA_ATOMIC_LOAD(&ca_actor->id) == id
+			&& (deadline == 0 || !ca_timer_expired_(deadline))) {
+		admitted += ca_wait_room_(ca_actor, id, capacity, count - admitted, deadline);
+		if(admitted < count) {
+			admitted += ca_reserve_room_(ca_actor, capacity, count - admitted);
+		}
+	}
+	(void)ca_timer_cancel_(timer);
+	if(admitted < count) {
+		CA_STAT_ADD(&ca_actor->dropped, count - admitted);
+	}
+	return admitted;
+}
+
+/*
+ * Send message to actor identified by id:
+ * Look it up (or hand it to its node), make room for the message if
+ * its mailbox is bounded, enqueue, and if it is waiting: lock, signal,
+ * unlock. It does not matter whether it has started receiving yet.
+ * (fallback build: enqueue while locked)
+ */
+void ca_send(ca_actor_id_t id, unsigned long type, void* data, size_t data_size) {
+	ca_actor_t* ca_actor = ca_target_(&id);
+	if(ca_actor == 0) {
+		if(CA_ACTOR_ID_NODE(id) != 0) {
+			// Another process's
+			(void)ca_node_send_(ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID, id, CA_PRIO_NORMAL, 0,
+				type, data, data_size, 1);
+		}
+		// Else no such actor (any more): drop message
+		return;
+	}
+	if(ca_admit_(ca_actor, id, 1, 1) == 0) {
+		// Mailbox full
+		return;
+	}
+	// Prepare message
+	ca_msg_t* ca_msg = ca_new_msg_(id, type, data, data_size);
+	if(ca_msg == 0) {
+		ca_unreserve_room_(ca_actor, 1);
+		return;
+	}
+	ca_deliver_msgs_(ca_actor, CA_PRIO_NORMAL, ca_msg, ca_msg);
+	ca_count_out_(1);
+}
+
+/*
+ * Same as ca_send(), but never waits for room in a bounded mailbox.
+ * Returns 0, EAGAIN if the mailbox is full, whatever its overflow
+ * policy, ESRCH if there is no such actor or ENOMEM.
+ * To another node: EAGAIN if the ring to it is full, EMSGSIZE if the
+ * payload is over CA_NODE_MSG_SIZE, ESRCH if there is no such node.
+ */
+int ca_try_send(ca_actor_id_t id, unsigned long type, void* data, size_t data_size) {
+	ca_actor_t* ca_actor = ca_target_(&id);
+	if(ca_actor == 0) {
+		if(CA_ACTOR_ID_NODE(id) != 0) {
+			return ca_node_send_(ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID, id, CA_PRIO_NORMAL, 0,
+				type, data, data_size, 0);
+		}
+		return ESRCH;
+	}
+	if(ca_admit_(ca_actor, id, 1, 0) == 0) {
+		return EAGAIN;
+	}
+	ca_msg_t* ca_msg = ca_new_msg_(id, type, data, data_size);
+	if(ca_msg == 0) {
+		ca_unreserve_room_(ca_actor, 1);
+		return ENOMEM;
+	}
+	ca_deliver_msgs_(ca_actor, CA_PRIO_NORMAL, ca_msg, ca_msg);
+	ca_count_out_(1);
+	return 0;
+}
+
+/*
+ * Bound actor id's mailbox to capacity messages, 0 for no bound.
+ * policy says what happens to messages sent once it is full; with
+ * CA_OVERFLOW_BLOCK, senders wait up to timeout milliseconds for room
+ * (forever if negative, not at all if 0), then drop theirs.
+ * Priority messages, timers, exit notifications and broadcasts always
+ * get in. Returns 0, ESRCH if there is no such actor, or EINVAL when
+ * switching to or from CA_OVERFLOW_DROP_OLDEST, which is for
+ * ca_spawn_bounded() to set.
+ */
+int ca_set_mailbox_limit(ca_actor_id_t id, long capacity, int policy, long timeout) {
+	ca_actor_t* ca_actor = ca_get_thread_info_(id);
+	if(ca_actor == 0) {
+		return ESRCH;
+	}
+	if((policy == CA_OVERFLOW_DROP_OLDEST) != (ca_actor->overflow == CA_OVERFLOW_DROP_OLDEST)) {
+		return EINVAL;
+	}
+	ca_actor->overflow = policy;
+	ca_actor->send_timeout = timeout;
+	CA_ATOMIC_STORE(&ca_actor->capacity, capacity > 0 ? capacity : 0);
+	// Blocked senders look again, under the new bound
+	ca_wake_room_waiters_(ca_actor);
+	return 0;
+}
+
+/*
+ * Number of messages queued for actor id, those being sent included,
+ * or -1 if there is no such actor. Messages set aside by selective
+ * receives are no longer queued. For a pool, those of all its members.
+ */
+long ca_queue_depth(ca_actor_id_t id) {
+	ca_actor_t* ca_actor = ca_get_thread_info_(id);
+	if(ca_actor == 0) {
+		return -1;
+	}
+	if(CA_ATOMIC_LOAD(&ca_actor->kind) == CA_ACTOR_POOL) {
+		ca_pool_t* pool = (ca_pool_t*)CA_ATOMIC_LOAD(&ca_actor->state);
+		if(CA_ATOMIC_LOAD(&ca_actor->id) != id) {
+			return -1;
+		}
+		int size = CA_ATOMIC_LOAD(&pool->size);
+		long depth = 0;
+		int i;
+		for(i = 0; i < size; i++) {
+			long member_depth = ca_queue_depth(CA_ATOMIC_LOAD(&pool->members[i]));
+			depth += member_depth > 0 ? member_depth : 0;
+		}
+		return depth;
+	}
+	long taken = CA_ATOMIC_LOAD(&ca_actor->taken);
+	long depth = CA_ATOMIC_LOAD(&ca_actor->sent) - taken;
+	return depth > 0 ? depth : 0;
+}
+
+/*
+ * Send count messages to the same actor: they are all copied, then
+ * queued at once, and the receiver is woken up once.
+ * Returns the number of messages sent, which may fall short of count
+ * if out of memory or if the mailbox is full, or be 0 if there is
+ * no such actor.
+ */
+int ca_send_batch(ca_actor_id_t id, ca_batch_msg_t* msgs, int count) {
+	// To a pool, all to the same member
+	ca_actor_t* ca_actor = ca_target_(&id);
+	int sent;
+	if(ca_actor == 0 && CA_ACTOR_ID_NODE(id) != 0) {
+		// One at a time: that is how ring cells are claimed anyway
+		ca_actor_id_t src_id = ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID;
+		for(sent = 0; sent < count; sent++) {
+			if(ca_node_send_(src_id, id, CA_PRIO_NORMAL, 0, msgs[sent].type, msgs[sent].data, msgs[sent].data_size, 1) != 0) {
+				break;
+			}
+		}
+		return sent;
+	}
+	if(ca_actor == 0 || count <= 0) {
+		return 0;
+	}
+	int admitted = ca_admit_(ca_actor, id, count, 1);
+	ca_msg_t* first = 0;
+	ca_msg_t* last = 0;
+	for(sent = 0; sent < admitted; sent++) {
+		ca_msg_t* ca_msg = ca_new_msg_(id, msgs[sent].type, msgs[sent].data, msgs[sent].data_size);
+		if(ca_msg == 0) {
+			break;
+		}
+		if(last) {
+			last->node.next = &ca_msg->node;
+		}
+		else {
+			first = ca_msg;
+		}
+		last = ca_msg;
+	}
+	if(sent < admitted) {
+		ca_unreserve_room_(ca_actor, admitted - sent);
+	}
+	if(first) {
+		ca_deliver_msgs_(ca_actor, CA_PRIO_NORMAL, first, last);
+		ca_count_out_(sent);
+	}
+	return sent;
+}
+
+/*
+ * Send a message on priority lane prio: the receiver drains higher
+ * lanes first, CA_PRIO_NORMAL being the one ca_send() uses, so control
+ * messages overtake a backlog of data. Order is only kept within a lane.
+ * prio is capped at CA_PRIO_HIGH. Priority messages count towards the
+ * mailbox depth but always get in, full or not.
+ */
+void ca_send_prio(ca_actor_id_t id, int prio, unsigned long type, void* data, size_t data_size) {
+	if(prio <= CA_PRIO_NORMAL) {
+		ca_send(id, type, data, data_size);
+		return;
+	}
+	if(prio > CA_PRIO_HIGH) {
+		prio = CA_PRIO_HIGH;
+	}
+	ca_actor_t* ca_actor = ca_target_(&id);
+	if(ca_actor == 0 && CA_ACTOR_ID_NODE(id) != 0) {
+		(void)ca_node_send_(ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID, id, prio, 0, type, data, data_size, 1);
+		return;
+	}
+	if(ca_actor == 0 || ca_prio_lanes_(ca_actor) == 0) {
+		return;
+	}
+	ca_msg_t* ca_msg = ca_new_msg_(id, type, data, data_size);
+	if(ca_msg == 0) {
+		return;
+	}
+	ca_lane_queued_(ca_actor);
+	ca_deliver_msgs_(ca_actor, prio, ca_msg, ca_msg);
+	ca_count_out_(1);
+}
+
+/*
+ * Send a heap buffer without copying it: the caller must not touch it
+ * afterwards. The receiver's ca_release_msg() calls release(data, data_size),
+ * or free(data) if release is 0. The buffer is released right away if
+ * the message cannot be delivered, the mailbox being full included.
+ * To another node, the payload is copied after all, then released.
+ */
+void ca_send_move(ca_actor_id_t id, unsigned long type, void* data, size_t data_size, ca_release_fn_t release) {
+	ca_actor_t* ca_actor = ca_target_(&id);
+	if(ca_actor == 0 && CA_ACTOR_ID_NODE(id) != 0) {
+		(void)ca_node_send_(ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID, id, CA_PRIO_NORMAL, 0,
+			type, data, data_size, 1);
+		ca_release_data_(data, data_size, release);
+		return;
+	}
+	if(ca_actor == 0 || ca_admit_(ca_actor, id, 1, 1) == 0) {
+		ca_release_data_(data, data_size, release);
+		return;
+	}
+	ca_msg_t* ca_msg = ca_wrap_msg_(id, type, data, data_size, release);
+	if(ca_msg == 0) {
+		ca_unreserve_room_(ca_actor, 1);
+		ca_release_data_(data, data_size, release);
+		return;
+	}
+	ca_deliver_msgs_(ca_actor, CA_PRIO_NORMAL, ca_msg, ca_msg);
+	ca_count_out_(1);
+}
+
+/*
+ * Get a message with room for data_size bytes of payload at msg->data,
+ * inside the message if they fit CA_MSG_INLINE_SIZE, for the caller to
+ * build the payload right there, then send it with ca_send_msg(). If
+ * the caller sets msg->release, ca_release_msg() calls it on the
+ * payload, inline or not, instead of freeing it: to destroy an object
+ * built in place, say (freeing it too if it is not inline).
+ * Returns 0 if out of memory.
+ */
+ca_msg_t* ca_msg_new(size_t data_size) {
+	ca_msg_t* ca_msg = ca_msg_alloc_();
+	if(ca_msg == 0) {
+		return 0;
+	}
+	ca_msg->dest_id = CA_INVALID_ACTOR_ID;
+	ca_msg->src_id  = ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID;
+	ca_msg->type = 0;
+	ca_msg->release = 0;
+	ca_msg->call_id = 0;
+	ca_msg->seq = 0;
+	if(data_size <= CA_MSG_INLINE_SIZE) {
+		ca_msg->data = ca_msg->inline_data;
+	}
+	else {
+		ca_msg->data = malloc(data_size);
+		if(ca_msg->data == 0) {
+			ca_msg_free_(ca_msg);
+			return 0;
+		}
+	}
+	ca_msg->data_size = data_size;
+	return ca_msg;
+}
+
+/*
+ * Send a message got from ca_msg_new() to actor id, as ca_send() would:
+ * it is handed over in any case, and released if it cannot be delivered.
+ * To another node, its payload is copied over as plain bytes, then it
+ * is released.
+ * Returns 0, EAGAIN if the mailbox is full or ESRCH if there is no such
+ * actor; to another node, as ca_try_send().
+ */
+int ca_send_msg(ca_actor_id_t id, unsigned long type, ca_msg_t* msg) {
+	ca_actor_t* ca_actor = ca_target_(&id);
+	if(ca_actor == 0) {
+		int err = ESRCH;
+		if(CA_ACTOR_ID_NODE(id) != 0) {
+			err = ca_node_send_(msg->src_id, id, CA_PRIO_NORMAL, 0, type, msg->data, msg->data_size, 1);
+		}
+		ca_delete_msg_(msg);
+		return err;
+	}
+	if(ca_admit_(ca_actor, id, 1, 1) == 0) {
+		ca_delete_msg_(msg);
+		return EAGAIN;
+	}
+	msg->dest_id = id;
+	msg->type = type;
+	CA_TRACE_SENT(msg->src_id, id, msg);
+	ca_deliver_msgs_(ca_actor, CA_PRIO_NORMAL, msg, msg);
+	ca_count_out_(1);
+	return 0;
+}
+
+/*
+ * Private
+ * Send a call to actor id, call_id being its future, as ca_send()
+ * does; or, CA_CALL_REPLY set, the reply to one: on the lane of its
+ * own above the others, full mailbox or not, its caller waiting for it. With move, data is handed
+ * over as by ca_send_move(), and released if it cannot be.
+ * Returns 0, EAGAIN if the mailbox is full, ESRCH if there is no such
+ * actor or ENOMEM; to another node, as ca_try_send().
+ */
+int ca_send_call_(ca_actor_id_t id, uint32_t call_id, unsigned long type, void* data, size_t data_size,
+		int move, ca_release_fn_t release) {
+	int reply = (call_id & CA_CALL_REPLY) != 0;
+	int prio = reply ? CA_PRIO_REPLY : CA_PRIO_NORMAL;
+	int err = ESRCH;
+	ca_actor_t* ca_actor = ca_target_(&id);
+	ca_msg_t* ca_msg = 0;
+	if(ca_actor == 0) {
+		if(CA_ACTOR_ID_NODE(id) != 0) {
+			err = ca_node_send_(ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID, id, prio, call_id,
+				type, data, data_size, 1);
+		}
+	}
+	else if(reply ? ca_prio_lanes_(ca_actor) == 0 : ca_admit_(ca_actor, id, 1, 1) == 0) {
+		err = reply ? ENOMEM : EAGAIN;
+	}
+	else {
+		ca_msg = move ? ca_wrap_msg_(id, type, data, data_size, release) : ca_new_msg_(id, type, data, data_size);
+		err = ENOMEM;
+		if(ca_msg == 0 && !reply) {
+			ca_unreserve_room_(ca_actor, 1);
+		}
+	}
+	if(ca_msg == 0) {
+		if(move) {
+			ca_release_data_(data, data_size, release);
+		}
+		return err;
+	}
+	ca_msg->call_id = call_id;
+	if(reply) {
+		ca_lane_queued_(ca_actor);
+	}
+	ca_deliver_msgs_(ca_actor, prio, ca_msg, ca_msg);
+	ca_count_out_(1);
+	return 0;
+}
+
+/*
+ * Reply to msg: to its caller's future if it came from ca_call_async()
+ */
+void ca_reply(ca_msg_t* msg, unsigned long type, void* data, size_t data_size) {
+	if(msg->call_id != 0 && !(msg->call_id & CA_CALL_REPLY)) {
+		(void)ca_send_call_(msg->src_id, msg->call_id | CA_CALL_REPLY, type, data, data_size, 0, 0);
+		return;
+	}
+	ca_send(msg->src_id, type, data, data_size);
+}
+
+void ca_reply_move(ca_msg_t* msg, unsigned long type, void* data, size_t data_size, ca_release_fn_t release) {
+	if(msg->call_id != 0 && !(msg->call_id & CA_CALL_REPLY)) {
+		(void)ca_send_call_(msg->src_id, msg->call_id | CA_CALL_REPLY, type, data, data_size, 1, release);
+		return;
+	}
+	ca_send_move(msg->src_id, type, data, data_size, release);
+}
+
+/*
+ * Send a request to actor id, as ca_send() would, and return at once
+ * with a future to get its reply from (see ca_future_wait()), so that
+ * many calls may be in flight together. The callee answers with
+ * ca_reply() as usual. A handler gets its replies as messages instead,
+ * call_id being future | CA_CALL_REPLY: it cannot wait for them.
+ * Returns 0 if the caller is no actor, the request could not be sent
+ * (no such actor, mailbox full...) or CA_CALL_INDEX_MASK + 1 calls of
+ * the caller's are in flight already.
+ */
+ca_future_t ca_call_async(ca_actor_id_t id, unsigned long type, void* data, size_t data_size) {
+	ca_actor_t* ca_actor = ca_self;
+	if(ca_actor == 0) {
+		return 0;
+	}
+	ca_stash_t* stash = ca_stash_of_(ca_actor);
+	ca_future_t future = stash ? ca_call_open_(stash) : 0;
+	if(future == 0) {
+		return 0;
+	}
+	if(ca_send_call_(id, future, type, data, data_size, 0, 0) != 0) {
+		ca_call_close_(stash, ca_call_slot_(stash, future));
+		return 0;
+	}
+	return future;
+}
+
+/*
+ * Private
+ * ca_future_wait() attempt: pop the replies lane, filing replies away
+ * (see ca_dequeue_lanes_()), until that call's came. Nothing else is
+ * popped: other messages stay in their lanes, in order, for later
+ * receives. Handlers leave their replies for their handler to get.
+ */
+int ca_attempt_reply_(ca_actor_t* ca_actor, void* context) {
+	ca_call_slot_t* slot = (ca_call_slot_t*)context;
+	if(slot->reply == 0 && ca_actor->kind != CA_ACTOR_HANDLER) {
+		(void)ca_dequeue_lanes_(ca_actor, 1u << CA_PRIO_REPLY);
+	}
+	return slot->reply != 0;
+}
+
+/*
+ * Wait for the reply to a call of ours, at most timeout milliseconds
+ * (forever if negative, not at all if 0), and return it, to be released; the call is then over. Replies to other
+ * calls in flight are kept for their own waits, however many there
+ * are, and other messages for the next receives.
+ * Returns nothing if the reply did not come in time, the future then
+ * staying good, or if future is no call of ours in flight. Always
+ * nothing for handlers: see ca_call_async().
+ */
+ca_msg_t* ca_future_wait(ca_future_t future, long timeout) {
+	ca_actor_t* ca_actor = ca_self;
+	if(ca_actor == 0) {
+		return 0;
+	}
+	ca_call_slot_t* slot = ca_call_slot_(ca_actor->stash, future);
+	if(slot == 0) {
+		return 0;
+	}
+	if(slot->reply == 0 && !ca_wait_for_(ca_actor, timeout, &ca_attempt_reply_, slot)) {
+		return 0;
+	}
+	ca_msg_t* ca_msg = slot->reply;
+	ca_call_close_(ca_actor->stash, slot);
+	CA_TRACE_MSG(CA_TRACE_RECEIVE, ACTOR_ID(ca_actor), ca_msg->src_id, ca_msg);
+	return ca_msg;
+}
+
+/*
+ * Give up on a call of ours: its reply, if it came already or when it
+ * comes, is dropped
+ */
+void ca_future_cancel(ca_future_t future) {
+	ca_actor_t* ca_actor = ca_self;
+	if(ca_actor == 0) {
+		return;
+	}
+	ca_call_slot_t* slot = ca_call_slot_(ca_actor->stash, future);
+	if(slot == 0) {
+		return;
+	}
+	if(slot->reply) {
+		ca_delete_msg_(slot->reply);
+	}
+	ca_call_close_(ca_actor->stash, slot);
+}
+
+/*
+ * Send a request to actor id and wait for its reply, at most timeout
+ * milliseconds (forever if negative). Returns the reply, to be
+ * released, or nothing if it did not come in time: should it come
+ * later, it is dropped.
+ */
+ca_msg_t* ca_call(ca_actor_id_t id, unsigned long type, void* data, size_t data_size, long timeout) {
+	ca_future_t future = ca_call_async(id, type, data, data_size);
+	if(future == 0) {
+		return 0;
+	}
+	ca_msg_t* ca_msg = ca_future_wait(future, timeout);
+	if(ca_msg == 0) {
+		ca_future_cancel(future);
+	}
+	return ca_msg;
+}
+
+/*
+ * Send a message in delay milliseconds. The payload is copied now.
+ * Returns a timer id for ca_cancel_timer(), or 0 if out of memory.
+ */
+ca_timer_id_t ca_send_after(ca_actor_id_t id, long delay, unsigned long type, void* data, size_t data_size) {
+	ca_msg_t* ca_msg = ca_new_msg_(id, type, data, data_size);
+	if(ca_msg == 0) {
+		return 0;
+	}
+	ca_timer_id_t timer_id = ca_timer_arm_(id, ca_timer_deadline_(delay), ca_msg);
+	if(timer_id == 0) {
+		ca_delete_msg_(ca_msg);
+	}
+	return timer_id;
+}
+
+/*
+ * Cancel a ca_send_after(): returns 1 if the message will not be
+ * sent, 0 if it was already (or is being) sent.
+ */
+int ca_cancel_timer(ca_timer_id_t timer_id) {
+	return ca_timer_cancel_(timer_id);
+}
+
+/*
+ * Take ownership of a received message's payload, e.g. to ca_send_move()
+ * it to the next actor down a pipeline. The message itself must still be
+ * released. A payload that was stored inline gets copied to the heap first,
+ * and so does a broadcast's, which other recipients share: the message
+ * keeps its reference, dropped when released.
+ * Returns 0 if the message has no payload, if out of memory, or if its
+ * payload was built in place with a release function (see ca_msg_new()):
+ * there is no telling whether it may be copied.
+ */
+void* ca_take_data(ca_msg_t* msg, ca_release_fn_t* release) {
+	void* data = msg->data;
+	*release = msg->release;
+	int shared = msg->release == ca_shared_release_;
+	if(data == msg->inline_data || shared) {
+		if(msg->release && !shared) {
+			return 0;
+		}
+		data = msg->data_size > 0 ? malloc(msg->data_size) : 0;
+		if(data == 0) {
+			return 0;
+		}
+		memcpy(data, msg->data, msg->data_size);
+		*release = 0;
+		if(shared) {
+			// The message keeps its reference
+			return data;
+		}
+	}
+	msg->data = 0;
+	msg->release = 0;
+	return data;
+}
+
+// ---------------------------------------------------------
+// Broadcast
+// The payload is copied once into a shared, reference counted
+// block; every recipient's message points into it and drops a
+// reference on release.
+// ---------------------------------------------------------
+
+// Initial reference count: more than there can ever be actors.
+// The broadcaster gives back what it did not use in one go.
+#define CA_SHARED_REFS_BIAS	(1L << 40)
+
+/*
+ * Private
+ * Release callback of broadcast messages
+ */
+void ca_shared_release_(void* data, size_t data_size) {
+	ca_shared_payload_t* shared = (ca_shared_payload_t*)((char*)data - offsetof(ca_shared_payload_t, data));
+	if(__atomic_sub_fetch(&shared->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(shared);
+	}
+}
+
+/*
+ * Private
+ * Copy the payload once for all recipients
+ */
+ca_shared_payload_t* ca_shared_new_(void* data, size_t data_size) {
+	ca_shared_payload_t* shared = (ca_shared_payload_t*)malloc(sizeof(ca_shared_payload_t) + data_size);
+	if(shared == 0) {
+		return 0;
+	}
+	shared->refs = CA_SHARED_REFS_BIAS;
+	if(data_size > 0) {
+		memcpy(shared->data, data, data_size);
+	}
+	return shared;
+}
+
+/*
+ * Private
+ * Queue a message referring to the shared payload in one actor's
+ * mailbox. Returns 1 if it was delivered.
+ */
+int ca_shared_deliver_(ca_actor_id_t id, unsigned long type, ca_shared_payload_t* shared, size_t data_size) {
+	ca_actor_t* ca_actor = ca_target_(&id);
+	if(ca_actor == 0) {
+		return 0;
+	}
+	ca_msg_t* ca_msg = ca_wrap_msg_(id, type, shared->data, data_size, ca_shared_release_);
+	if(ca_msg == 0) {
+		return 0;
+	}
+	ca_deliver_msg_(ca_actor, ca_msg);
+	return 1;
+}
+
+/*
+ * Private
+ * Give back the references no recipient took; may free the payload
+ * if all recipients are already done with it.
+ */
+void ca_shared_settle_(ca_shared_payload_t* shared, int delivered) {
+	if(__atomic_sub_fetch(&shared->refs, CA_SHARED_REFS_BIAS - delivered, __ATOMIC_ACQ_REL) == 0) {
+		free(shared);
+	}
+}
+
+/*
+ * Send the same message to every actor known at the time of the call
+ * but the caller. The payload is copied once and shared: recipients
+ * must not modify it. Returns the number of recipients, or -1 if out
+ * of memory.
+ */
+int ca_broadcast(unsigned long type, void* data, size_t data_size) {
+	ca_shared_payload_t* shared = ca_shared_new_(data, data_size);
+	if(shared == 0) {
+		return -1;
+	}
+	ca_actor_id_t self_id = ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID;
+	uint32_t high_water = CA_ATOMIC_LOAD(&ca_actors_high_water);
+	uint32_t index;
+	int delivered = 0;
+	for(index = 0; index < high_water; index++) {
+		ca_actor_t* ca_actor = ca_actor_slot_(index);
+		ca_actor_id_t id = CA_ATOMIC_LOAD(&ca_actor->id);
+		// Pool members get it as actors of their own
+		if(id == CA_INVALID_ACTOR_ID || id == self_id || CA_ATOMIC_LOAD(&ca_actor->kind) == CA_ACTOR_POOL) {
+			continue;
+		}
+		delivered += ca_shared_deliver_(id, type, shared, data_size);
+	}
+	ca_shared_settle_(shared, delivered);
+	ca_count_out_(delivered);
+	return delivered;
+}
+
+/*
+ * Same as ca_broadcast(), to an explicit group of actors.
+ * Unknown ids are skipped. Actors of other nodes get a copy each.
+ */
+int ca_broadcast_group(ca_actor_id_t* ids, int count, unsigned long type, void* data, size_t data_size) {
+	ca_shared_payload_t* shared = ca_shared_new_(data, data_size);
+	if(shared == 0) {
+		return -1;
+	}
+	ca_actor_id_t self_id = ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID;
+	int i;
+	int delivered = 0;
+	int remote = 0;
+	for(i = 0; i < count; i++) {
+		if(CA_ACTOR_ID_NODE(ids[i]) != 0) {
+			remote += ca_node_send_(self_id, ids[i], CA_PRIO_NORMAL, 0, type, data, data_size, 1) == 0;
+			continue;
+		}
+		delivered += ca_shared_deliver_(ids[i], type, shared, data_size);
+	}
+	ca_shared_settle_(shared, delivered);
+	ca_count_out_(delivered);
+	return delivered + remote;
+}
+
+// ---------------------------------------------------------
+// Nodes: actors of other processes
+// ---------------------------------------------------------
+
+/*
+ * Private
+ * Futex wait and wake on a word of the shared segment: not the
+ * private kind, other processes wait on and wake these words.
+ * Waits at most timeout (relative) if given, wakes up to count.
+ */
+void ca_futex_wait_(int* word, int value, const struct timespec* timeout) {
+	(void)syscall(SYS_futex, word, FUTEX_WAIT, value, timeout, 0, 0);
+}
+
+void ca_futex_wake_(int* word, int count) {
+	(void)syscall(SYS_futex, word, FUTEX_WAKE, count, 0, 0, 0);
+}
+
+/*
+ * Private
+ * Ring carrying messages from node 'from' to node 'to'
+ */
+ca_node_ring_t* ca_node_ring_(ca_node_segment_t* segment, int from, int to) {
+	return &segment->rings[(from - 1) * CA_NODES_MAX + to - 1];
+}
+
+/*
+ * Private
+ * Position a ring cell is at, from its index and relative seq
+ */
+#define CA_NODE_CELL_INDEX(pos)		((pos) & (CA_NODE_RING_CELLS - 1))
+#define CA_NODE_CELL_SEQ(cell, pos)	(CA_ATOMIC_LOAD(&(cell)->seq) + CA_NODE_CELL_INDEX(pos))
+
+/*
+ * Private
+ * Is process pid gone? A node being joined (-1) is not.
+ */
+int ca_node_gone_(int pid) {
+	if(pid == -1) {
+		return 0;
+	}
+	return pid == 0 || (kill(pid, 0) != 0 && errno == ESRCH);
+}
+
+/*
+ * Private
+ * Send a message to actor id of another node, from src_id: claim a
+ * cell in the ring from this node to that one, copy the payload in,
+ * publish it, and wake that node's dispatcher up if it sleeps. When
+ * the ring is full, waits for room if may_block, as long as the node
+ * is there; never on behalf of a handler, which would hold its worker
+ * up.
+ * Returns 0, EAGAIN if the ring is full, ESRCH if there is no such
+ * node (or we are none), EMSGSIZE if the payload does not fit a cell.
+ */
+int ca_node_send_(ca_actor_id_t src_id, ca_actor_id_t id, int prio, uint32_t call_id, unsigned long type, void* data, size_t data_size, int may_block) {
+	ca_node_segment_t* segment = CA_ATOMIC_LOAD(&ca_node_segment);
+	int node = CA_ACTOR_ID_NODE(id);
+	if(segment == 0 || node > CA_NODES_MAX) {
+		return ESRCH;
+	}
+	if(data_size > CA_NODE_MSG_SIZE) {
+		return EMSGSIZE;
+	}
+	ca_node_peer_t* peer = &segment->peers[node];
+	int epoch = CA_ACTOR_ID_EPOCH(id);
+	if(CA_ATOMIC_LOAD(&peer->pid) <= 0 || (epoch != 0 && epoch != CA_ATOMIC_LOAD(&peer->epoch))) {
+		return ESRCH;
+	}
+	ca_node_ring_t* ring = ca_node_ring_(segment, ca_node_self, node);
+	ca_node_cell_t* cell;
+	uint64_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	unsigned int waits = 0;
+	for(;;) {
+		cell = &ring->cells[CA_NODE_CELL_INDEX(pos)];
+		int64_t lag = (int64_t)(CA_NODE_CELL_SEQ(cell, pos) - pos);
+		if(lag == 0) {
+			if(__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+			continue;
+		}
+		if(lag < 0) {
+			// Full: its message from a lap ago is yet to be released
+			if(!may_block || (ca_self != 0 && ca_self->kind == CA_ACTOR_HANDLER)) {
+				return EAGAIN;
+			}
+			if((++waits & 1023) == 0 && ca_node_gone_(CA_ATOMIC_LOAD(&peer->pid))) {
+				return ESRCH;
+			}
+			ca_yield_();
+		}
+		pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	}
+	cell->src_id = src_id != CA_INVALID_ACTOR_ID && CA_ACTOR_ID_NODE(src_id) == 0
+		? CA_ACTOR_ID_WITH_EPOCH(CA_ACTOR_ID_ON_NODE(src_id, ca_node_self), ca_node_epoch) : src_id;
+	cell->dest_id = CA_ACTOR_ID_ON_NODE(id, 0);
+	cell->type = type;
+	cell->data_size = data_size;
+	cell->prio = prio > CA_PRIO_HIGH ? CA_PRIO_HIGH : prio;
+	cell->call_id = call_id;
+	if(data_size > 0) {
+		memcpy(cell->data, data, data_size);
+	}
+	CA_ATOMIC_STORE(&cell->seq, pos + 1 - CA_NODE_CELL_INDEX(pos));
+	// Same as ca_wake_thread_(), across processes
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&peer->parked, __ATOMIC_RELAXED) == 1 && CA_ATOMIC_XCHG(&peer->parked, 0) == 1) {
+		ca_futex_wake_(&peer->parked, 1);
+	}
+	ca_count_out_(1);
+	return 0;
+}
+
+/*
+ * Private
+ * Give a cell back to the senders: full for position p, it is free
+ * for p + CA_NODE_RING_CELLS
+ */
+void ca_node_release_(ca_node_cell_t* cell) {
+	CA_ATOMIC_STORE(&cell->seq, cell->seq - 1 + CA_NODE_RING_CELLS);
+}
+
+/*
+ * Private
+ * The cell at position pos was claimed by a process that died before
+ * publishing it, holding the ring up: publish it with no recipient,
+ * for the dispatcher to drop. Leaves it alone if it was published
+ * meanwhile; if it was even taken and given back, writing its
+ * recipient is harmless, the next sender writing it again.
+ */
+void ca_node_void_(ca_node_ring_t* ring, uint64_t pos) {
+	ca_node_cell_t* cell = &ring->cells[CA_NODE_CELL_INDEX(pos)];
+	uint64_t seq = pos - CA_NODE_CELL_INDEX(pos);
+	if(CA_ATOMIC_LOAD(&cell->seq) != seq) {
+		return;
+	}
+	cell->dest_id = CA_INVALID_ACTOR_ID;
+	(void)CA_ATOMIC_CAS(&cell->seq, seq, seq + 1);
+}
+
+/*
+ * Private
+ * Hand a cell over to its recipient, with a copy of its payload, and
+ * give it back. Leaving the payload in the cell until the message is
+ * released would save that copy, but cells go back in ring order: one
+ * message a receiver keeps would hold up every sender behind it, who
+ * may well be what that receiver waits for. Never waits for room: a
+ * full mailbox drops it.
+ */
+void ca_node_deliver_(ca_node_cell_t* cell) {
+	ca_actor_id_t id = cell->dest_id;
+	int epoch = CA_ACTOR_ID_EPOCH(id);
+	int prio = cell->call_id & CA_CALL_REPLY ? CA_PRIO_REPLY : cell->prio;
+	// Meant for whoever had our node number before: not ours to take
+	if(epoch != 0 && epoch != ca_node_epoch) {
+		ca_node_release_(cell);
+		return;
+	}
+	id = CA_ACTOR_ID_WITH_EPOCH(id, 0);
+	ca_actor_t* ca_actor = ca_target_(&id);
+	if(ca_actor == 0) {
+		ca_node_release_(cell);
+		return;
+	}
+	if(prio > CA_PRIO_NORMAL) {
+		if(ca_prio_lanes_(ca_actor) == 0) {
+			ca_node_release_(cell);
+			return;
+		}
+	}
+	else if(ca_admit_(ca_actor, id, 1, 0) == 0) {
+		ca_node_release_(cell);
+		return;
+	}
+	ca_msg_t* ca_msg = ca_new_msg_(id, cell->type, cell->data, cell->data_size);
+	if(ca_msg != 0) {
+		ca_msg->src_id = cell->src_id;
+		ca_msg->call_id = cell->call_id;
+	}
+	ca_node_release_(cell);
+	if(ca_msg == 0) {
+		if(prio == CA_PRIO_NORMAL) {
+			ca_unreserve_room_(ca_actor, 1);
+		}
+		return;
+	}
+	if(prio > CA_PRIO_NORMAL) {
+		ca_lane_queued_(ca_actor);
+	}
+	ca_deliver_msgs_(ca_actor, prio, ca_msg, ca_msg);
+}
+
+/*
+ * Private
+ * Hand over up to max messages from node from's ring to us; returns
+ * how many. A cell that was claimed but is yet to be published holds
+ * the rest up, unless its sender died (see ca_node_void_()): the
+ * process being gone, not just having left, as a thread of it could
+ * still be publishing.
+ */
+int ca_node_drain_(ca_node_segment_t* segment, int from, int max) {
+	ca_node_ring_t* ring = ca_node_ring_(segment, from, ca_node_self);
+	uint64_t pos = ring->head;
+	int count;
+	for(count = 0; count < max; count++) {
+		ca_node_cell_t* cell = &ring->cells[CA_NODE_CELL_INDEX(pos)];
+		if(CA_NODE_CELL_SEQ(cell, pos) != pos + 1) {
+			int pid = CA_ATOMIC_LOAD(&segment->peers[from].pid);
+			if(__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) <= pos || pid <= 0 || !ca_node_gone_(pid)) {
+				break;
+			}
+			ca_node_void_(ring, pos);
+			continue;
+		}
+		ring->head = ++pos;
+		ca_node_deliver_(cell);
+	}
+	return count;
+}
+
+/*
+ * Private
+ * Is there anything for us in any ring?
+ */
+int ca_node_pending_(ca_node_segment_t* segment) {
+	int from;
+	for(from = 1; from <= CA_NODES_MAX; from++) {
+		ca_node_ring_t* ring = ca_node_ring_(segment, from, ca_node_self);
+		uint64_t pos = ring->head;
+		if(CA_NODE_CELL_SEQ(&ring->cells[CA_NODE_CELL_INDEX(pos)], pos) == pos + 1) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Private
+ * Dispatcher thread: move messages from every ring to this node into
+ * our mailboxes, a batch per ring in turn. Once they are all empty,
+ * spin a while, then sleep on the futex as thread actors sleep on
+ * their condition (see ca_wake_thread_()).
+ */
+void* ca_node_dispatch_(void* args) {
+	ca_node_segment_t* segment = ca_node_segment;
+	ca_node_peer_t* self = &segment->peers[ca_node_self];
+	int from;
+	for(;;) {
+		int count = 0;
+		for(from = 1; from <= CA_NODES_MAX; from++) {
+			count += ca_node_drain_(segment, from, CA_HANDLER_BATCH);
+		}
+		if(count > 0) {
+			continue;
+		}
+		if(CA_ATOMIC_LOAD(&ca_node_stopping)) {
+			break;
+		}
+		long spin = CA_STAT_READ(&ca_receive_spin);
+		if(spin > 0) {
+			uint64_t start = ca_now_ns_();
+			while(!ca_node_pending_(segment) && ca_now_ns_() - start < (uint64_t)spin) {
+				CA_CPU_RELAX();
+			}
+		}
+		__atomic_store_n(&self->parked, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(!ca_node_pending_(segment) && !CA_ATOMIC_LOAD(&ca_node_stopping)) {
+			ca_futex_wait_(&self->parked, 1, 0);
+		}
+		__atomic_store_n(&self->parked, 0, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+/*
+ * Private
+ * Joining as node: drop what was sent to whichever process was that
+ * node before, and give back any cell it died before releasing. Cells
+ * it claimed on its way out to other nodes but died before publishing
+ * would hold their rings up for good: publish them empty.
+ */
+void ca_node_reset_(ca_node_segment_t* segment, int node) {
+	int from;
+	int to;
+	for(to = 1; to <= CA_NODES_MAX; to++) {
+		ca_node_ring_t* ring = ca_node_ring_(segment, node, to);
+		uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		uint64_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		for(; pos < tail; pos++) {
+			ca_node_void_(ring, pos);
+		}
+	}
+	for(from = 1; from <= CA_NODES_MAX; from++) {
+		ca_node_ring_t* ring = ca_node_ring_(segment, from, node);
+		uint64_t head = ring->head;
+		uint64_t pos = head >= CA_NODE_RING_CELLS ? head - CA_NODE_RING_CELLS : 0;
+		for(; pos < head; pos++) {
+			ca_node_cell_t* cell = &ring->cells[CA_NODE_CELL_INDEX(pos)];
+			if(CA_NODE_CELL_SEQ(cell, pos) == pos + 1) {
+				ca_node_release_(cell);
+			}
+		}
+		for(;;) {
+			ca_node_cell_t* cell = &ring->cells[CA_NODE_CELL_INDEX(head)];
+			if(CA_NODE_CELL_SEQ(cell, head) != head + 1) {
+				break;
+			}
+			ca_node_release_(cell);
+			head++;
+		}
+		ring->head = head;
+	}
+}
+
+/*
+ * Join the processes sharing actors through the shared memory segment
+ * called name (see shm_open()), created if need be, as node number
+ * node, 1 to CA_NODES_MAX. Actor ids from other nodes, such as the
+ * source of their messages or what ca_node_lookup() returns, can then
+ * be sent to like any other: the message goes through the ring from
+ * this node to theirs, with a copy of the payload, up to
+ * CA_NODE_MSG_SIZE bytes. Their dispatcher thread hands it over to
+ * the recipient, as a message of its own, and gives the cell back.
+ * Once per process, before sending anything to another node.
+ * Returns 0, EINVAL if node is out of range or the segment was laid
+ * out for another CA_NODES_MAX, CA_NODE_RING_CELLS or CA_NODE_CELL_SIZE,
+ * EBUSY if already joined, EEXIST if a live process is that node, or
+ * why the segment could not be opened or mapped.
+ */
+int ca_node_join(const char* name, int node) {
+	if(node < 1 || node > CA_NODES_MAX || CA_NODES_MAX > 255) {
+		return EINVAL;
+	}
+	if(ca_node_segment != 0) {
+		return EBUSY;
+	}
+	ca_lib_init_();
+	size_t size = sizeof(ca_node_segment_t) + (size_t)CA_NODES_MAX * CA_NODES_MAX * sizeof(ca_node_ring_t);
+	int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if(fd < 0) {
+		return errno;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || ((size_t)st.st_size < size && ftruncate(fd, size) != 0)) {
+		int error = errno;
+		close(fd);
+		return error;
+	}
+	ca_node_segment_t* segment = (ca_node_segment_t*)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(segment == MAP_FAILED) {
+		return errno;
+	}
+	// First one in lays the header out, the others check it
+	if(CA_ATOMIC_CAS(&segment->state, 0, 1)) {
+		segment->nodes = CA_NODES_MAX;
+		segment->ring_cells = CA_NODE_RING_CELLS;
+		segment->cell_size = CA_NODE_CELL_SIZE;
+		segment->magic = CA_NODE_SEGMENT_MAGIC;
+		CA_ATOMIC_STORE(&segment->state, 2);
+	}
+	while(CA_ATOMIC_LOAD(&segment->state) != 2) {
+		sched_yield();
+	}
+	if(segment->magic != CA_NODE_SEGMENT_MAGIC || segment->nodes != CA_NODES_MAX
+			|| segment->ring_cells != CA_NODE_RING_CELLS || segment->cell_size != CA_NODE_CELL_SIZE) {
+		munmap(segment, size);
+		return EINVAL;
+	}
+	// Take the node over if its process is gone: senders hold off
+	// until its rings are reset
+	ca_node_peer_t* self = &segment->peers[node];
+	int pid = CA_ATOMIC_LOAD(&self->pid);
+	if(!ca_node_gone_(pid) || !CA_ATOMIC_CAS(&self->pid, pid, -1)) {
+		munmap(segment, size);
+		return EEXIST;
+	}
+	ca_node_reset_(segment, node);
+	self->entry = CA_INVALID_ACTOR_ID;
+	self->parked = 0;
+	CA_ATOMIC_STORE(&self->epoch, self->epoch % 255 + 1);
+	ca_node_self = node;
+	ca_node_epoch = self->epoch;
+	ca_node_stopping = 0;
+	CA_ATOMIC_STORE(&ca_node_segment, segment);
+	int error = pthread_create(&ca_node_dispatcher, 0, &ca_node_dispatch_, 0);
+	if(error != 0) {
+		CA_ATOMIC_STORE(&ca_node_segment, (ca_node_segment_t*)0);
+		CA_ATOMIC_STORE(&self->pid, 0);
+		munmap(segment, size);
+		return error;
+	}
+	CA_ATOMIC_STORE(&self->pid, (int)getpid());
+	return 0;
+}
+
+/*
+ * Leave the segment: other nodes can no longer send to us, nor we to
+ * them, and messages already on their way to us are dropped. Those we
+ * received stay valid until released: the segment stays mapped.
+ */
+void ca_node_leave() {
+	ca_node_segment_t* segment = ca_node_segment;
+	if(segment == 0) {
+		return;
+	}
+	ca_node_peer_t* self = &segment->peers[ca_node_self];
+	CA_ATOMIC_STORE(&self->entry, CA_INVALID_ACTOR_ID);
+	CA_ATOMIC_STORE(&self->pid, 0);
+	CA_ATOMIC_STORE(&ca_node_stopping, 1);
+	if(CA_ATOMIC_XCHG(&self->parked, 0) == 1) {
+		ca_futex_wake_(&self->parked, 1);
+	}
+	pthread_join(ca_node_dispatcher, 0);
+	CA_ATOMIC_STORE(&ca_node_segment, (ca_node_segment_t*)0);
+}
+
+/*
+ * Make actor id the one other nodes find with ca_node_lookup(): a
+ * first actor to talk to, which can then hand out the ids of others.
+ * Returns 0, or ESRCH if not a node.
+ */
+int ca_node_publish(ca_actor_id_t id) {
+	ca_node_segment_t* segment = ca_node_segment;
+	if(segment == 0) {
+		return ESRCH;
+	}
+	ca_node_peer_t* self = &segment->peers[ca_node_self];
+	CA_ATOMIC_STORE(&self->entry, CA_ACTOR_ID_WITH_EPOCH(CA_ACTOR_ID_ON_NODE(id, ca_node_self), ca_node_epoch));
+	CA_ATOMIC_ADD(&self->published, 1);
+	ca_futex_wake_(&self->published, INT_MAX);
+	return 0;
+}
+
+/*
+ * Actor id node published, once it has, as long as its process is
+ * alive: waits up to timeout milliseconds for it, forever if negative,
+ * not at all if 0. Threads sleep on the node's futex word until it
+ * publishes; tasks cannot block their worker, and nap 1ms at a time.
+ * Returns 0 if there is none (yet).
+ */
+ca_actor_id_t ca_node_lookup(int node, long timeout) {
+	ca_node_segment_t* segment = ca_node_segment;
+	if(segment == 0 || node < 1 || node > CA_NODES_MAX) {
+		return CA_INVALID_ACTOR_ID;
+	}
+	ca_node_peer_t* peer = &segment->peers[node];
+	uint64_t deadline = ca_now_ns_() + (uint64_t)(timeout > 0 ? timeout : 0) * 1000000;
+	for(;;) {
+		// Read before looking: a publish from now on changes it
+		int published = CA_ATOMIC_LOAD(&peer->published);
+		ca_actor_id_t id = CA_ATOMIC_LOAD(&peer->entry);
+		int pid = CA_ATOMIC_LOAD(&peer->pid);
+		if(id != CA_INVALID_ACTOR_ID && pid > 0 && !ca_node_gone_(pid)) {
+			return id;
+		}
+		uint64_t now = ca_now_ns_();
+		if(timeout == 0 || (timeout > 0 && now >= deadline)) {
+			return CA_INVALID_ACTOR_ID;
+		}
+		if(ca_self != 0 && ca_self->kind == CA_ACTOR_TASK) {
+			ca_sleep(1);
+			continue;
+		}
+		struct timespec left;
+		if(timeout > 0) {
+			left.tv_sec = (deadline - now) / 1000000000;
+			left.tv_nsec = (deadline - now) % 1000000000;
+		}
+		ca_futex_wait_(&peer->published, published, timeout > 0 ? &left : 0);
+	}
+}
+
+void ca_sleep(long milliseconds) {
+	ca_actor_t* ca_actor = ca_self;
+	if(ca_actor == 0) {
+		usleep(milliseconds * 1000);
+		return;
+	}
+	uint64_t deadline = ca_timer_deadline_(milliseconds);
+	if(ca_actor->kind == CA_ACTOR_TASK) {
+		// Forget wakeups from before we went to sleep:
+		// only a message sent from now on cuts the nap short
+		(void)CA_ATOMIC_CAS(&ca_actor->wake_state, CA_TASK_NOTIFIED, CA_TASK_RUNNING);
+	}
+	ca_timer_id_t timer = ca_timer_arm_(ACTOR_ID(ca_actor), deadline, 0);
+	if(timer == 0) {
+		// Nothing would wake us up: sleep it all through, messages or not
+		while(!ca_timer_expired_(deadline)) {
+			if(ca_actor->kind == CA_ACTOR_TASK) {
+				ca_task_switch_(ca_actor, CA_SWITCH_YIELD);
+			}
+			else {
+				usleep(1000);
+			}
+		}
+		return;
+	}
+	if(ca_actor->kind == CA_ACTOR_TASK) {
+		ca_task_switch_(ca_actor, CA_SWITCH_PARK);
+		(void)ca_timer_cancel_(timer);
+		return;
+	}
+	GUARD_ACTOR_SECTION("1actor-ca_sleep", ca_actor)
+	if(!ca_timer_expired_(deadline)) {
+		// Parked, so that a message cuts the nap short
+		__atomic_store_n(&ca_actor->wake_state, CA_TASK_PARKED, __ATOMIC_RELAXED);
+		pthread_cond_wait(&ca_actor->thread_cond, &ca_actor->thread_cond_mutex);
+		__atomic_store_n(&ca_actor->wake_state, CA_TASK_RUNNING, __ATOMIC_RELAXED);
+	}
+	LEAVE_SECTION("1actor-ca_sleep", ca_actor->thread_cond_mutex)
+	(void)ca_timer_cancel_(timer);
+}
+
+/*
+ * Wait for all actors to have exited: until the number of live
+ * actors drops to 0, sleep on a condition of our own, which the
+ * last one out signals (see ca_actors_live_drop_())
+ */
+void ca_join() {
+#if DEBUG_ACTORS_LIST == 1
+	GUARD_SECTION("actors-ca_join", thread_actor_table_mutex)
+	PDEBUG_ACTORS_LIST
+	LEAVE_SECTION("actors-ca_join", thread_actor_table_mutex)
+#endif
+	volatile int done;
+	pthread_cond_t wake;
+	ca_monitor_t waiter;
+	waiter.watcher = ca_self ? ACTOR_ID(ca_self) : CA_INVALID_ACTOR_ID;
+	waiter.kind = CA_MONITOR_WAIT;
+	waiter.done = &done;
+	waiter.wake = &wake;
+	ca_wake_cond_init_(&wake);
+	GUARD_SECTION("join-ca_join", thread_join_mutex)
+	while(CA_ATOMIC_LOAD(&ca_actors_live) != 0) {
+		// Taken off the list when signalled: back on it if actors
+		// were spawned again meanwhile
+		done = 0;
+		waiter.next = ca_join_waiters;
+		ca_join_waiters = &waiter;
+		while(!done) {
+			ca_waiter_sleep_(&waiter, 0);
+		}
+	}
+	LEAVE_SECTION("join-ca_join", thread_join_mutex)
+	pthread_cond_destroy(&wake);
+}
+
+/*
+ * Block until actor id has exited. Returns 0 once it has (or if there
+ * never was such an actor), EDEADLK if an actor waits for itself.
+ * A task waiting gives its worker back meanwhile.
+ */
+int ca_wait_actor(ca_actor_id_t id) {
+	ca_actor_t* ca_actor = ca_self;
+	if(ca_actor != 0 && ACTOR_ID(ca_actor) == id) {
+		return EDEADLK;
+	}
+	volatile int done = 0;
+	ca_monitor_t monitor;
+	monitor.watcher = ca_actor ? ACTOR_ID(ca_actor) : CA_INVALID_ACTOR_ID;
+	monitor.kind = CA_MONITOR_WAIT;
+	monitor.done = &done;
+	monitor.wake = 0;
+	if(ca_actor != 0 && ca_actor->kind == CA_ACTOR_TASK) {
+		if(ca_add_monitor_(id, &monitor) == 0) {
+			while(!CA_ATOMIC_LOAD(&done)) {
+				ca_task_switch_(ca_actor, CA_SWITCH_PARK);
+			}
+		}
+		return 0;
+	}
+	// Woken up alone once it exits
+	pthread_cond_t wake;
+	ca_wake_cond_init_(&wake);
+	monitor.wake = &wake;
+	if(ca_add_monitor_(id, &monitor) == 0) {
+		GUARD_SECTION("join-ca_wait_actor", thread_join_mutex)
+		while(!done) {
+			ca_waiter_sleep_(&monitor, 0);
+		}
+		LEAVE_SECTION("join-ca_wait_actor", thread_join_mutex)
+	}
+	pthread_cond_destroy(&wake);
+	return 0;
+}
+
+/*
+ * Get a CA_MSG_TYPE_EXIT message, from id, when actor id exits
+ * (right away if it already has). Only actors can monitor others.
+ * Returns 0, EINVAL if the caller is not an actor, or ENOMEM.
+ */
+int ca_monitor(ca_actor_id_t id) {
+	ca_actor_t* ca_actor = ca_self;
+	if(ca_actor == 0) {
+		return EINVAL;
+	}
+	ca_monitor_t* monitor = (ca_monitor_t*)malloc(sizeof(ca_monitor_t));
+	if(monitor == 0) {
+		return ENOMEM;
+	}
+	monitor->watcher = ACTOR_ID(ca_actor);
+	monitor->kind = CA_MONITOR_MSG;
+	monitor->done = 0;
+	monitor->wake = 0;
+	if(ca_add_monitor_(id, monitor) != 0) {
+		ca_notify_monitor_(monitor, id);
+	}
+	return 0;
+}
+
+// ---------------------------------------------------------
+// Statistics
+// Totals add up the live actors' counters to what the actors
+// gone left behind. Nothing is frozen while reading: figures
+// are each exact, but not from one and the same instant.
+// ---------------------------------------------------------
+
+/*
+ * Private
+ * A GUARD_SECTION found mutex taken: count it against its kind.
+ * Off the fast path.
+ */
+__attribute__((noinline, cold)) void ca_lock_contended_(pthread_mutex_t* mutex) {
+	int kind;
+	if(mutex == &thread_actor_table_mutex) {
+		kind = CA_LOCK_ACTORS;
+	} else if(mutex == &thread_msg_depot_mutex) {
+		kind = CA_LOCK_MSG_DEPOT;
+	} else if(mutex == &thread_runq_mutex || mutex == &thread_idle_mutex
+			|| mutex == &thread_task_pool_mutex) {
+		kind = CA_LOCK_SCHED;
+	} else if(mutex == &thread_timers_mutex) {
+		kind = CA_LOCK_TIMERS;
+	} else if(mutex == &thread_join_mutex) {
+		kind = CA_LOCK_JOIN;
+	} else if(mutex == &thread_trace_mutex) {
+		kind = CA_LOCK_TRACE;
+	} else {
+		kind = CA_LOCK_OTHER;
+	}
+	CA_STAT_ADD(&ca_lock_contended[kind], 1);
+}
+
+/*
+ * Private
+ * A GUARD_ACTOR_SECTION found ca_actor's condition mutex taken
+ */
+__attribute__((noinline, cold)) void ca_actor_contended_(ca_actor_t* ca_actor) {
+	CA_STAT_ADD(&ca_actor->contended, 1);
+	CA_STAT_ADD(&ca_lock_contended[CA_LOCK_ACTOR], 1);
+}
+
+/*
+ * Private
+ * Fill stats in for actor, known as id
+ */
+void ca_actor_stats_fill_(ca_actor_t* ca_actor, ca_actor_id_t id, ca_actor_stats_t* stats) {
+	long taken = CA_ATOMIC_LOAD(&ca_actor->taken);
+	long depth = CA_ATOMIC_LOAD(&ca_actor->sent) - taken;
+	stats->id = id;
+	stats->depth = depth > 0 ? depth : 0;
+	stats->depth_high_water = CA_STAT_READ(&ca_actor->depth_high_water);
+	stats->received = (unsigned long)(taken - ca_actor->taken_base) - CA_STAT_READ(&ca_actor->trimmed);
+	stats->sent = CA_STAT_READ(&ca_actor->msgs_out);
+	stats->dropped = CA_STAT_READ(&ca_actor->dropped);
+	stats->blocked_ns = CA_STAT_READ(&ca_actor->blocked_ns);
+	stats->contended = CA_STAT_READ(&ca_actor->contended);
+}
+
+/*
+ * Get runtime-wide totals
+ */
+void ca_stats_get(ca_stats_t* stats) {
+	memset(stats, 0, sizeof(ca_stats_t));
+	GUARD_SECTION("actors-ca_stats_get", thread_actor_table_mutex)
+	uint32_t high_water = ca_actors_high_water;
+	uint32_t index;
+	stats->actors_spawned = ca_actors_spawned;
+	stats->msgs_dropped = CA_STAT_READ(&ca_retired_dropped);
+	stats->blocked_ns = CA_STAT_READ(&ca_retired_blocked_ns);
+	for(index = 0; index < high_water; index++) {
+		// Slots are reused, never freed: their mailbox counters
+		// keep counting across the actors that had them
+		ca_actor_t* ca_actor = ca_actor_slot_(index);
+		stats->msgs_queued += CA_ATOMIC_LOAD(&ca_actor->sent);
+		stats->msgs_taken += CA_ATOMIC_LOAD(&ca_actor->taken);
+		if(CA_ATOMIC_LOAD(&ca_actor->id) != CA_INVALID_ACTOR_ID && ca_actor->kind != CA_ACTOR_POOL) {
+			stats->actors_live++;
+			stats->msgs_dropped += CA_STAT_READ(&ca_actor->dropped);
+			stats->blocked_ns += CA_STAT_READ(&ca_actor->blocked_ns);
+		}
+	}
+	LEAVE_SECTION("actors-ca_stats_get", thread_actor_table_mutex)
+	for(index = 0; index < CA_LOCK_KINDS; index++) {
+		stats->contended[index] = CA_STAT_READ(&ca_lock_contended[index]);
+	}
+}
+
+/*
+ * Get actor id's counters, since it was spawned.
+ * Returns 0, or ESRCH if there is no such actor.
+ */
+int ca_actor_stats_get(ca_actor_id_t id, ca_actor_stats_t* stats) {
+	ca_actor_t* ca_actor = ca_get_thread_info_(id);
+	if(ca_actor == 0) {
+		return ESRCH;
+	}
+	ca_actor_stats_fill_(ca_actor, id, stats);
+	return 0;
+}
+
+/*
+ * Print totals, then one line per live actor, as key=value pairs
+ */
+void ca_stats_dump(FILE* out) {
+	static const char* lock_names[CA_LOCK_KINDS] = {
+		"actors", "actor", "msg_depot", "sched", "timers", "join", "trace", "other"
+	};
+	ca_stats_t stats;
+	int kind;
+	ca_stats_get(&stats);
+	fprintf(out, "cactor spawned=%lu live=%lu queued=%lu taken=%lu dropped=%lu blocked_ns=%lu\n",
+		stats.actors_spawned, stats.actors_live, stats.msgs_queued, stats.msgs_taken,
+		stats.msgs_dropped, stats.blocked_ns);
+	fprintf(out, "cactor contended");
+	for(kind = 0; kind < CA_LOCK_KINDS; kind++) {
+		fprintf(out, " %s=%lu", lock_names[kind], stats.contended[kind]);
+	}
+	fprintf(out, "\n");
+	uint32_t high_water = CA_ATOMIC_LOAD(&ca_actors_high_water);
+	uint32_t index;
+	for(index = 0; index < high_water; index++) {
+		ca_actor_t* ca_actor = ca_actor_slot_(index);
+		ca_actor_id_t id = CA_ATOMIC_LOAD(&ca_actor->id);
+		ca_actor_stats_t actor_stats;
+		if(id == CA_INVALID_ACTOR_ID || ca_actor->kind == CA_ACTOR_POOL) {
+			continue;
+		}
+		ca_actor_stats_fill_(ca_actor, id, &actor_stats);
+		fprintf(out, "actor id=%lu depth=%ld high_water=%ld received=%lu sent=%lu dropped=%lu blocked_ns=%lu contended=%lu\n",
+			(unsigned long)actor_stats.id, actor_stats.depth, actor_stats.depth_high_water,
+			actor_stats.received, actor_stats.sent, actor_stats.dropped,
+			actor_stats.blocked_ns, actor_stats.contended);
+	}
+}
+
+// ---------------------------------------------------------
+// Tracing
+// Every thread records events into a ring of its own, which it
+// alone writes: no lock, no RMW, just a store releasing the new
+// head. Rings are handed over to new threads as old ones exit,
+// keeping their events. Dumps copy a ring, then check its head
+// again, to skip whatever its thread overwrote meanwhile.
+// Time stamps are raw ticks, turned into time when dumping.
+// ---------------------------------------------------------
+
+/*
+ * Private
+ * Cheapest clock there is: the time stamp counter, where there is one
+ */
+uint64_t ca_trace_ticks_() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return ca_now_ns_();
+#endif
+}
+
+#if CA_TRACE == 1
+/*
+ * Private
+ * A thread exits: its ring is up for grabs, and may be freed
+ * from now on
+ */
+void ca_trace_detach_(void* ring) {
+	ca_trace_ring = 0;
+	GUARD_SECTION("trace-ca_trace_detach_", thread_trace_mutex)
+	((ca_trace_ring_t*)ring)->in_use = 0;
+	LEAVE_SECTION("trace-ca_trace_detach_", thread_trace_mutex)
+}
+
+/*
+ * Private
+ * Free the rings no thread has, but those of the current size if
+ * keep_sized: they are worth reusing.
+ * Caller must be guarding thread_trace_mutex.
+ */
+void ca_trace_free_idle_(int keep_sized) {
+	ca_trace_ring_t** link = &ca_trace_rings;
+	while(*link != 0) {
+		ca_trace_ring_t* ring = *link;
+		if(ring->in_use || (keep_sized && ring->size == ca_trace_ring_size)) {
+			link = &ring->next;
+			continue;
+		}
+		*link = ring->next;
+		free(ring);
+	}
+}
+
+void ca_trace_init_() {
+	pthread_key_create(&ca_trace_key, &ca_trace_detach_);
+}
+
+/*
+ * Private
+ * Give the calling thread a ring: one left by a thread gone, or
+ * a new one. Rings left of another size than asked for now are
+ * freed instead. Returns nothing if out of memory.
+ */
+ca_trace_ring_t* ca_trace_attach_() {
+	ca_trace_ring_t* ring;
+	pthread_once(&ca_trace_once, &ca_trace_init_);
+	GUARD_SECTION("trace-ca_trace_attach_", thread_trace_mutex)
+	ca_trace_free_idle_(1);
+	for(ring = ca_trace_rings; ring != 0 && ring->in_use; ring = ring->next) {
+	}
+	if(ring == 0 && (ring = (ca_trace_ring_t*)malloc(sizeof(ca_trace_ring_t)
+			+ ca_trace_ring_size * sizeof(ca_trace_event_t))) != 0) {
+		ring->head = 0;
+		ring->size = ca_trace_ring_size;
+		ring->next = ca_trace_rings;
+		ca_trace_rings = ring;
+	}
+	if(ring != 0) {
+		ring->in_use = 1;
+	}
+	LEAVE_SECTION("trace-ca_trace_attach_", thread_trace_mutex)
+	if(ring != 0) {
+		ca_trace_ring = ring;
+		pthread_setspecific(ca_trace_key, ring);
+	}
+	return ring;
+}
+
+/*
+ * Private
+ * Record an event into the calling thread's ring.
+ * Not inlined: tasks must not reuse the ring address of a worker
+ * they ran on before switching.
+ */
+__attribute__((noinline)) void ca_trace_record_(int kind, ca_actor_id_t actor, ca_actor_id_t peer, uint64_t arg, unsigned long type) {
+	ca_trace_ring_t* ring = ca_trace_ring;
+	if(ring == 0 && (ring = ca_trace_attach_()) == 0) {
+		return;
+	}
+	uint64_t head = ring->head;
+	ca_trace_event_t* event = &ring->events[head & (ring->size - 1)];
+	event->ticks = ca_trace_ticks_();
+	event->actor = actor;
+	event->peer = peer;
+	event->arg = arg;
+	event->type = type;
+	event->kind = kind;
+	CA_ATOMIC_STORE(&ring->head, head + 1);
+}
+
+/*
+ * Private
+ * Write one event out as Chrome trace JSON; sends and receives also
+ * get a flow event, which draws the message going from one to the
+ * other. ts is in microseconds since tracing was turned on.
+ */
+void ca_trace_write_(FILE* out, ca_trace_event_t* event, double ts, int pid) {
+	static const char* names[CA_TRACE_KINDS] = {
+		"spawn", "send", "enqueue", "blocked", "receive", "release", "exit"
+	};
+	unsigned long long tid = (unsigned long long)event->actor;
+	if(event->kind == CA_TRACE_WAKEUP) {
+		// Drawn as a slice, over the time waited
+		double waited = event->arg / 1000.0;
+		fprintf(out, "{\"name\":\"%s\",\"cat\":\"cactor\",\"ph\":\"X\",\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f}",
+			names[event->kind], pid, tid, ts - waited, waited);
+		return;
+	}
+	if((event->kind == CA_TRACE_SEND || event->kind == CA_TRACE_RECEIVE) && event->arg != 0) {
+		fprintf(out, "{\"name\":\"%s\",\"cat\":\"cactor\",\"ph\":\"X\",\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,\"dur\":0,"
+			"\"args\":{\"%s\":%llu,\"type\":%lu}},\n",
+			names[event->kind], pid, tid, ts, event->kind == CA_TRACE_SEND ? "to" : "from",
+			(unsigned long long)event->peer, event->type);
+		// Flow from the send to the receive: binds to their slices
+		fprintf(out, "{\"name\":\"msg\",\"cat\":\"msg\",\"ph\":\"%s\",\"bp\":\"e\",\"id\":%llu,\"pid\":%d,\"tid\":%llu,\"ts\":%.3f}",
+			event->kind == CA_TRACE_SEND ? "s" : "f",
+			(unsigned long long)event->arg, pid, tid, ts);
+		return;
+	}
+	fprintf(out, "{\"name\":\"%s\",\"cat\":\"cactor\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,"
+		"\"args\":{\"actor\":%llu,\"type\":%lu}}",
+		names[event->kind], pid, tid, ts, (unsigned long long)event->peer, event->type);
+}
+#endif
+
+/*
+ * Start or stop recording events. Starting afresh discards
+ * whatever was recorded before, as far as dumps go, and frees
+ * the rings of threads gone.
+ * Does nothing if built with CA_TRACE set to 0.
+ */
+void ca_trace_enable(int on) {
+#if CA_TRACE == 1
+	if(on && !CA_ATOMIC_LOAD(&ca_trace_on)) {
+		GUARD_SECTION("trace-ca_trace_enable", thread_trace_mutex)
+		ca_trace_free_idle_(0);
+		ca_trace_since = ca_trace_ticks_();
+		ca_trace_since_ns = ca_now_ns_();
+		LEAVE_SECTION("trace-ca_trace_enable", thread_trace_mutex)
+	}
+	CA_ATOMIC_STORE(&ca_trace_on, on != 0);
+#endif
+}
+
+/*
+ * Events each thread's ring holds, rounded up to a power of two:
+ * rings already recording keep theirs, the others are freed as
+ * they come up for reuse. Does nothing if built with CA_TRACE set
+ * to 0.
+ */
+void ca_set_trace_ring_size(size_t events) {
+#if CA_TRACE == 1
+	uint64_t size = 2;
+	while(size < events) {
+		size <<= 1;
+	}
+	GUARD_SECTION("trace-ca_set_trace_ring_size", thread_trace_mutex)
+	ca_trace_ring_size = size;
+	LEAVE_SECTION("trace-ca_set_trace_ring_size", thread_trace_mutex)
+#else
+	(void)events;
+#endif
+}
+
+/*
+ * Write events recorded since tracing was last turned on, as Chrome
+ * trace JSON (chrome://tracing, ui.perfetto.dev): one track per actor,
+ * and one, tid 0, for whatever happens outside actors. Recording may
+ * go on meanwhile. Returns the number of events written, or -1 if
+ * out of memory.
+ */
+int ca_trace_dump(FILE* out) {
+	int count = 0;
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"cactor\"}}", (int)getpid());
+#if CA_TRACE == 1
+	int pid = (int)getpid();
+	GUARD_SECTION("trace-ca_trace_dump", thread_trace_mutex)
+	ca_trace_ring_t* ring;
+	uint64_t largest = 0;
+	for(ring = ca_trace_rings; ring != 0; ring = ring->next) {
+		largest = ring->size > largest ? ring->size : largest;
+	}
+	ca_trace_event_t* copy = (ca_trace_event_t*)malloc(sizeof(ca_trace_event_t) * (largest ? largest : 1));
+	if(copy == 0) {
+		LEAVE_SECTION("trace-ca_trace_dump", thread_trace_mutex)
+		fprintf(out, "\n]}\n");
+		return -1;
+	}
+	// Ticks to microseconds, from how far both clocks went since
+	uint64_t ticks = ca_trace_ticks_();
+	uint64_t since = ca_trace_since;
+	double us_per_tick = ticks > since ? (ca_now_ns_() - ca_trace_since_ns) / 1000.0 / (ticks - since) : 0.001;
+	for(ring = ca_trace_rings; ring != 0; ring = ring->next) {
+		uint64_t head = CA_ATOMIC_LOAD(&ring->head);
+		uint64_t low = head > ring->size ? head - ring->size : 0;
+		uint64_t index;
+		for(index = low; index < head; index++) {
+			copy[index - low] = ring->events[index & (ring->size - 1)];
+		}
+		// Whatever its thread may have started overwriting since is void
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		uint64_t later = CA_ATOMIC_LOAD(&ring->head);
+		uint64_t valid = later >= ring->size ? later - ring->size + 1 : 0;
+		for(index = valid > low ? valid : low; index < head; index++) {
+			ca_trace_event_t* event = &copy[index - low];
+			if(event->ticks < since) {
+				continue;
+			}
+			fprintf(out, ",\n");
+			ca_trace_write_(out, event, (event->ticks - since) * us_per_tick, pid);
+			count++;
+		}
 	}
+	LEAVE_SECTION("trace-ca_trace_dump", thread_trace_mutex)
+	free(copy);
+#endif
+	fprintf(out, "\n]}\n");
+	return count;
 }
@@ -29,34 +29,463 @@
 #include <sched.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <time.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <linux/futex.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define	DEBUG_LOCKING		0
 #define DEBUG_ACTORS_LIST	0
 
+// Mailboxes are lock-free multi-producer/single-consumer queues.
+// Build with -DCA_MAILBOX_LOCKFREE=0 to fall back to a FIFO
+// guarded by the receiving actor's condition mutex.
+#ifndef CA_MAILBOX_LOCKFREE
+#define CA_MAILBOX_LOCKFREE	1
+#endif
+
+#define CA_CACHE_LINE		64
+
+// Scheduling modes:
+// CA_SCHED_THREADS: every actor runs on its own pthread (default)
+// CA_SCHED_WORKERS: actors are user-space tasks multiplexed onto a
+//                   fixed pool of worker threads; ca_receive() and
+//                   ca_sleep() yield to the worker instead of blocking it
+#define CA_SCHED_THREADS	0
+#define CA_SCHED_WORKERS	1
+#ifndef CA_SCHED_DEFAULT
+#define CA_SCHED_DEFAULT	CA_SCHED_THREADS
+#endif
+
+// Payloads up to this size are stored inside the message itself
+#ifndef CA_MSG_INLINE_SIZE
+#define CA_MSG_INLINE_SIZE	64
+#endif
+
+// Free messages are cached per thread, and moved to or from a
+// global depot by batches when a thread has too many or none
+#ifndef CA_MSG_BATCH
+#define CA_MSG_BATCH		64
+#endif
+
+// Messages sent with ca_send_prio() above CA_PRIO_NORMAL go to extra
+// lanes, drained highest first, ahead of the normal mailbox (31 at most:
+// replies to calls have one more above them all)
+#ifndef CA_PRIO_LANES
+#define CA_PRIO_LANES		4
+#endif
+#define CA_PRIO_NORMAL		0
+#define CA_PRIO_HIGH		(CA_PRIO_LANES - 1)
+#define CA_PRIO_REPLY		CA_PRIO_LANES	// See ca_call_async()
+
+// What sending to a full bounded mailbox does
+// (see ca_set_mailbox_limit())
+enum {
+	CA_OVERFLOW_BLOCK = 0,		// Wait for room, up to the actor's send timeout
+	CA_OVERFLOW_FAIL,			// Drop the new message
+	CA_OVERFLOW_DROP_OLDEST		// Queue it, dropping the oldest (set at spawn only)
+};
+
+// Stack size of actors running as tasks (CA_SCHED_WORKERS)
+#ifndef CA_TASK_STACK_SIZE
+#define CA_TASK_STACK_SIZE	(64 * 1024)
+#endif
+
+// Messages a handler actor goes through before letting others run
+#ifndef CA_HANDLER_BATCH
+#define CA_HANDLER_BATCH	64
+#endif
+
+// How long, in nanoseconds, a thread actor about to wait for a
+// message first spins on its mailbox in case one comes soon; only
+// with more than one CPU online (see ca_set_receive_spin())
+#ifndef CA_RECEIVE_SPIN_NS
+#define CA_RECEIVE_SPIN_NS	10000
+#endif
+
+// Stack size of actors running on their own thread, 0 for the
+// system's default (see ca_spawn_opts())
+#ifndef CA_THREAD_STACK_SIZE
+#define CA_THREAD_STACK_SIZE	0
+#endif
+
+// Processes on one machine send to each other's actors through a
+// shared memory segment (see ca_node_join()): up to CA_NODES_MAX of
+// them (255 at most), each pair linked by a ring of CA_NODE_RING_CELLS
+// cells (a power of 2) of CA_NODE_CELL_SIZE bytes, one message per
+// cell, payload included. All processes sharing a segment must agree.
+#ifndef CA_NODES_MAX
+#define CA_NODES_MAX		8
+#endif
+#ifndef CA_NODE_RING_CELLS
+#define CA_NODE_RING_CELLS	256
+#endif
+#ifndef CA_NODE_CELL_SIZE
+#define CA_NODE_CELL_SIZE	1024
+#endif
+
+// CPUs a spawn's affinity mask can name
+#ifndef CA_MAX_CPUS
+#define CA_MAX_CPUS			1024
+#endif
+#define CA_CPU_MASK_BITS	(8 * sizeof(unsigned long))
+
+// How to spawn an actor (see ca_spawn_opts()).
+// Start from CA_SPAWN_OPTS_INIT, then change what matters.
+struct ca_spawn_opts {
+	size_t stack_size;		// 0: CA_THREAD_STACK_SIZE or CA_TASK_STACK_SIZE
+	unsigned long cpus[(CA_MAX_CPUS + CA_CPU_MASK_BITS - 1) / CA_CPU_MASK_BITS];	// None set: any
+	int numa_node;			// Keep it and its memory on that node, -1 for any
+	long capacity;			// Mailbox limit, as for ca_set_mailbox_limit()
+	int overflow;
+	long send_timeout;
+};
+typedef struct ca_spawn_opts ca_spawn_opts_t;
+
+#define CA_SPAWN_OPTS_INIT	{ 0, { 0 }, -1, 0, CA_OVERFLOW_BLOCK, -1 }
+#define CA_SPAWN_OPTS_CPU(opts, cpu) \
+	((opts)->cpus[(cpu) / CA_CPU_MASK_BITS] |= 1UL << ((cpu) % CA_CPU_MASK_BITS))
+
+// Event tracing (see ca_trace_enable()) is compiled in unless built
+// with -DCA_TRACE=0, and off until turned on. Every thread records
+// into its own ring of CA_TRACE_RING_SIZE events by default (a power
+// of two, see ca_set_trace_ring_size()), the newest overwriting the
+// oldest.
+#ifndef CA_TRACE
+#define CA_TRACE			1
+#endif
+#ifndef CA_TRACE_RING_SIZE
+#define CA_TRACE_RING_SIZE	8192
+#endif
+
 // ---------------------------------------------------------
+// Actor ids are handles into the actors table:
+// low 32 bits: slot index, next 24 bits: slot generation.
+// A slot's generation changes every time it is recycled,
+// so the id of an actor that has exited never matches
+// whichever actor is later given the same slot.
+// Id 0 is never handed out.
+// ---------------------------------------------------------
+
+typedef uint64_t ca_actor_id_t;
+
+struct ca_actor;
+typedef struct ca_actor ca_actor_t;
+
+#define CA_INVALID_ACTOR_ID				((ca_actor_id_t)0)
+#define CA_ACTOR_ID_MAKE(gen, index)	(((ca_actor_id_t)(gen) << 32) | (uint32_t)(index))
+#define CA_ACTOR_ID_INDEX(id)			((uint32_t)(id))
+#define CA_ACTOR_ID_GENERATION(id)		((uint32_t)((id) >> 32) & CA_ACTOR_GENERATION_MAX)
 
-typedef pthread_t ca_actor_id_t;
+// Index bits the actors table never reaches (see below) name the
+// process an actor lives in, for ids that came from another process:
+// its node number (see ca_node_join()). 0: this process.
+#define CA_ACTOR_ID_NODE_SHIFT			24
+#define CA_ACTOR_ID_NODE(id)			((int)(((id) >> CA_ACTOR_ID_NODE_SHIFT) & 0xff))
+#define CA_ACTOR_ID_ON_NODE(id, node) \
+	(((id) & ~((ca_actor_id_t)0xff << CA_ACTOR_ID_NODE_SHIFT)) | ((ca_actor_id_t)(node) << CA_ACTOR_ID_NODE_SHIFT))
+
+// Generation bits the table never reaches either name the incarnation
+// of that node: every ca_node_join() of a node number gets a new one,
+// so ids that went round before a node restarted find nothing in the
+// process that took the number over. 0: not checked.
+#define CA_ACTOR_ID_EPOCH_SHIFT			56
+#define CA_ACTOR_ID_EPOCH(id)			((int)((id) >> CA_ACTOR_ID_EPOCH_SHIFT))
+#define CA_ACTOR_ID_WITH_EPOCH(id, epoch) \
+	(((id) & ~((ca_actor_id_t)0xff << CA_ACTOR_ID_EPOCH_SHIFT)) | ((ca_actor_id_t)(epoch) << CA_ACTOR_ID_EPOCH_SHIFT))
+#define CA_ACTOR_GENERATION_MAX			0xffffff
+
+// The actors table grows by chunks of 2^CA_ACTORS_CHUNK_BITS slots,
+// 2^24 slots in all: slot indexes stay below CA_ACTOR_ID_NODE_SHIFT bits
+#define CA_ACTORS_CHUNK_BITS	10
+#define CA_ACTORS_CHUNK_SIZE	(1 << CA_ACTORS_CHUNK_BITS)
+#define CA_ACTORS_MAX_CHUNKS	16384
 
 typedef struct ca_actor_args ca_actor_args_t;
 
+// What a handler actor runs for each message (see ca_spawn_handler()):
+// returns non-zero for the actor to exit
+struct ca_msg;
+typedef int (*ca_handler_fn_t)(void* state, struct ca_msg* msg);
+
+// ---------------------------------------------------------
+// Messages are linked into mailboxes through this node,
+// which is embedded in every message: queueing a message
+// never allocates.
+// ---------------------------------------------------------
+struct ca_msg_list_node;
+typedef struct ca_msg_list_node ca_msg_list_node_t;
+struct ca_msg_list_node {
+	ca_msg_list_node_t* next;
+};
+
+// ---------------------------------------------------------
+// Every actor owns its mailbox, so that sending to or
+// receiving from one actor never contends with the others.
+//
+// Lock-free (Vyukov intrusive MPSC queue): producers swap
+// themselves in at 'last', the owner pops from 'first'.
+// 'stub' keeps the queue non-empty so that neither end ever
+// needs a lock.
+// Fallback: plain FIFO guarded by thread_cond_mutex.
+// ---------------------------------------------------------
+struct ca_mailbox {
+	ca_msg_list_node_t* last;
+	char pad[CA_CACHE_LINE - sizeof(ca_msg_list_node_t*)];
+	ca_msg_list_node_t* first;
+#if CA_MAILBOX_LOCKFREE == 1
+	ca_msg_list_node_t stub;
+#endif
+};
+typedef struct ca_mailbox ca_mailbox_t;
+
+// An actor's priority lanes, and how many messages they hold between
+// them: the mailbox proper holds the rest of its depth
+struct ca_prio_lanes {
+	ca_mailbox_t lanes[CA_PRIO_REPLY];	// Lanes 1 to CA_PRIO_REPLY
+	long queued;
+};
+typedef struct ca_prio_lanes ca_prio_lanes_t;
+
+// ---------------------------------------------------------
+// Execution context of an actor running as a task.
+// Pooled, along with its stack, once the actor exits.
+// ---------------------------------------------------------
+struct ca_task;
+typedef struct ca_task ca_task_t;
+struct ca_task {
+	ucontext_t context;
+	void* stack;			// Lowest page is a guard page
+	size_t stack_size;
+	ca_task_t* next_free;
+};
+
+enum {
+	CA_ACTOR_THREAD = 0,
+	CA_ACTOR_TASK,
+	CA_ACTOR_HANDLER,		// No stack: run by workers, one message at a time
+	CA_ACTOR_POOL			// Not an actor: an id that routes to others
+};
+
+// Task wakeup states; thread actors use the first two, parked
+// meaning senders have to signal their condition
+enum {
+	CA_TASK_RUNNING = 0,	// Running, runnable, or about to park
+	CA_TASK_PARKED,			// Waiting for ca_unpark_task_()
+	CA_TASK_NOTIFIED		// Woken up before it could park
+};
+
+// ---------------------------------------------------------
+// Someone waiting for an actor to exit: either another actor
+// that gets a CA_MSG_TYPE_EXIT message, or a ca_wait_actor()
+// caller that gets 'done' set and is woken up.
+// Senders blocked on a full mailbox wait the same way.
+// ---------------------------------------------------------
+enum {
+	CA_MONITOR_MSG = 0,
+	CA_MONITOR_WAIT
+};
+
+struct ca_monitor {
+	struct ca_monitor* next;
+	ca_actor_id_t watcher;	// 0: not an actor
+	int kind;
+	volatile int* done;		// CA_MONITOR_WAIT only
+	pthread_cond_t* wake;	// CA_MONITOR_WAIT threads: their own, signalled once done
+};
+typedef struct ca_monitor ca_monitor_t;
+
+// Type of the message a monitoring actor gets when the actor it
+// watches exits; src_id is the id of the actor that exited
+#define CA_MSG_TYPE_EXIT	((unsigned long)-1)
+
+// Type of the message a pool member gets when the pool shrinks it
+// away (see ca_pool_resize()): it should return once it has it.
+// Whatever was routed to it before is queued ahead.
+#define CA_MSG_TYPE_STOP	((unsigned long)-2)
+
+// What ca_call_async() returns: the call id its reply comes back with.
+// Low bits index the caller's calls table, the others tell reuses of
+// a slot apart; 0 is no call.
+typedef uint32_t ca_future_t;
+#define CA_CALL_REPLY		0x80000000u
+#define CA_CALL_INDEX_BITS	16
+#define CA_CALL_INDEX_MASK	((1u << CA_CALL_INDEX_BITS) - 1)
+
+// ---------------------------------------------------------
+// An actor lives in a slot of the actors table. Slots are
+// never freed, only recycled, so looking up a stale id is
+// always safe.
+// ---------------------------------------------------------
 struct ca_actor {
-	volatile int up;
+	ca_actor_id_t id;		// 0 while the slot is free
+	uint32_t generation;
+	uint32_t next_free;		// Free slots list, by index
+	int kind;				// CA_ACTOR_THREAD, CA_ACTOR_TASK or CA_ACTOR_HANDLER
+	int wake_state;			// CA_TASK_*; threads: parked on thread_cond or not
 	pthread_t thread;
+	ca_task_t* task;
+	ca_actor_t* run_next;	// Run queue link, tasks and handlers only
 	ca_actor_args_t* args;
+	ca_handler_fn_t handler;	// Handlers only, with:
+	void* state;			// Pools: their ca_pool_t
+	struct ca_stash* stash;	// Allocated on first selective receive
+	ca_monitor_t* monitors;	// Guarded by thread_cond_mutex
+	int exiting;			// Same: no more monitors once set
+	uint32_t prio_used;		// Non-empty priority lanes, one bit per lane
+	long sent;				// Messages queued so far, room reserved by senders included
+	long taken;				// Messages popped so far: depth is sent - taken
+	long capacity;			// 0: unbounded
+	int overflow;			// CA_OVERFLOW_* policy once full
+	int spin_ns;			// Threads: how soon messages came while spinning, itself only
+	long send_timeout;		// CA_OVERFLOW_BLOCK: ms, negative for no limit
+	ca_monitor_t* room_waiters;	// Blocked senders, guarded by thread_join_mutex
+	int trim_locked;		// Slot has had CA_OVERFLOW_DROP_OLDEST: pops take 'trimming'
+	int trimming;			// Lock word, senders dropping the oldest vs the owner
+	// Statistics (see ca_actor_stats_get()), reset at spawn.
+	// Relaxed atomics; fields written by the actor alone are plain stores.
+	long depth_high_water;
+	long taken_base;		// 'taken' at spawn
+	unsigned long msgs_out;	// Sent by this actor: itself only
+	unsigned long dropped;	// Refused or dropped for want of room
+	unsigned long trimmed;	// Of which taken out by senders, CA_OVERFLOW_DROP_OLDEST
+	unsigned long blocked_ns;	// Waiting for messages: itself only
+	unsigned long contended;	// Condition mutex found taken
+	ca_prio_lanes_t* prio_lanes;	// Allocated on first use
 	pthread_mutex_t thread_cond_mutex;
 	pthread_cond_t  thread_cond;
+	ca_mailbox_t mailbox;
+} __attribute__((aligned(CA_CACHE_LINE)));
+
+// ---------------------------------------------------------
+// A pool of identical actors behind a single id (see
+// ca_spawn_pool()). The id is that of an actor slot of kind
+// CA_ACTOR_POOL, which has no thread and gets no messages:
+// senders find the pool through it and pick a member, among
+// members[0, size), by the pool's policy.
+// Once retired, a pool is kept for the next one, never freed:
+// senders that looked it up just before may still be reading
+// it. They check 'id' again once they have picked.
+// ---------------------------------------------------------
+#ifndef CA_POOL_MAX_SIZE
+#define CA_POOL_MAX_SIZE	256
+#endif
+
+enum {
+	CA_POOL_ROUND_ROBIN = 0,	// Each member in turn
+	CA_POOL_LEAST_DEPTH,		// Shortest mailbox (see ca_queue_depth())
+	CA_POOL_HASH				// Same key, same member, as long as the size holds
 };
-typedef struct ca_actor ca_actor_t;
 
-struct ca_actor_list_node;
-typedef struct ca_actor_list_node ca_actor_list_node_t;
-struct ca_actor_list_node {
-	ca_actor_list_node_t* prev;
-	ca_actor_list_node_t* next;
-	ca_actor_t* actor;
+struct ca_pool {
+	ca_actor_id_t id;		// 0 once retired
+	int policy;
+	int size;
+	void*(*fn)(void*);		// What members run
+	struct ca_pool* next_free;
+	char pad[CA_CACHE_LINE - 3 * sizeof(void*) - 2 * sizeof(int)];
+	unsigned long next;		// Round robin turns, every sender's
+	char pad2[CA_CACHE_LINE - sizeof(unsigned long)];
+	ca_actor_id_t members[CA_POOL_MAX_SIZE];
 };
+typedef struct ca_pool ca_pool_t;
+
+// ---------------------------------------------------------
+// A worker thread, when running actors as tasks.
+// Tasks switch back to the worker's context whenever they
+// yield, park or exit, telling it why in switch_reason.
+//
+// Each worker owns a run deque (Chase-Lev): it pushes and
+// pops runnable tasks at the bottom, idle workers steal from
+// the top. 'runnext' holds the task most recently woken up by
+// a message sent from this worker: it runs next, here, while
+// that message is still in cache.
+// ---------------------------------------------------------
+#ifndef CA_RUN_DEQUE_SIZE
+#define CA_RUN_DEQUE_SIZE	4096	// Power of 2; overflow goes to the global queue
+#endif
+
+struct ca_worker {
+	ucontext_t context;
+	int switch_reason;
+	int index;
+	unsigned int rand_state;		// Victim selection
+	unsigned long ticks;			// Tasks resumed so far
+	unsigned long* seen_ticks;		// Other workers' ticks, as last seen
+	ca_actor_t* runnext;
+	char pad0[CA_CACHE_LINE];
+	long top;						// Thieves' end
+	char pad1[CA_CACHE_LINE - sizeof(long)];
+	long bottom;					// Owner's end
+	char pad2[CA_CACHE_LINE - sizeof(long)];
+	ca_actor_t* deque[CA_RUN_DEQUE_SIZE];
+};
+typedef struct ca_worker ca_worker_t;
+
+enum {
+	CA_SWITCH_YIELD = 0,	// Still runnable: requeue
+	CA_SWITCH_PARK,			// Waiting for ca_unpark_task_()
+	CA_SWITCH_EXIT			// Actor function returned
+};
+
+// ---------------------------------------------------------
+// Timers live in a hierarchical wheel: CA_WHEEL_LEVELS levels
+// of CA_WHEEL_SLOTS slots each, 1 ms per slot on the first
+// level, CA_WHEEL_SLOTS times coarser on each next one.
+// A timer sits in the slot of its expiry tick at the finest
+// level that reaches that far, and moves down a level every
+// time the level below wraps around.
+// Timer ids are handles into the timers table, just like
+// actor ids: generation << 32 | slot index. Id 0 is invalid.
+// ---------------------------------------------------------
+
+typedef uint64_t ca_timer_id_t;
+
+#define CA_WHEEL_BITS		6
+#define CA_WHEEL_SLOTS		(1 << CA_WHEEL_BITS)
+#define CA_WHEEL_LEVELS		4
+
+// The timers table grows by chunks of 2^CA_TIMERS_CHUNK_BITS timers
+#define CA_TIMERS_CHUNK_BITS	10
+#define CA_TIMERS_CHUNK_SIZE	(1 << CA_TIMERS_CHUNK_BITS)
+#define CA_TIMERS_MAX_CHUNKS	1024
+
+enum {
+	CA_TIMER_FREE = 0,
+	CA_TIMER_ARMED,		// In the wheel
+	CA_TIMER_FIRING		// Out of the wheel, being delivered
+};
+
+// A one-shot timer: wakes actor_id up or, if msg is set,
+// delivers msg when it fires.
+struct ca_timer {
+	struct ca_timer* prev;	// Wheel slot list
+	struct ca_timer* next;
+	uint64_t expires;		// Tick: ms since the wheel started
+	ca_timer_id_t id;
+	uint32_t generation;
+	uint32_t next_free;		// Free list link: index + 1, 0 ends it
+	int state;
+	int level;
+	int slot;
+	ca_actor_id_t actor_id;
+	struct ca_msg* msg;
+};
+typedef struct ca_timer ca_timer_t;
 
 // ---------------------------------------------------------
 // Used to invoke an actor. Keep actor and associated
@@ -65,41 +494,124 @@ struct ca_actor_list_node {
 struct ca_actor_args {
 	ca_actor_t* ca_actor;
 	void*(*fn)(void*);
+	void* arg;
 };
 
 // ---------------------------------------------------------
 
+// Releases a payload handed over with ca_send_move()/ca_reply_move()
+typedef void (*ca_release_fn_t)(void* data, size_t data_size);
+
+// ---------------------------------------------------------
+// Messages come from per-thread pools. 'data' points to
+// 'inline_data' when the payload fits, to a separate heap
+// copy otherwise, or to a buffer the sender gave away, in
+// which case 'release' (or free() if 0) gets rid of it.
+// ---------------------------------------------------------
 struct ca_msg {
+	ca_msg_list_node_t node; // Mailbox link: keep first
 	ca_actor_id_t dest_id;
 	ca_actor_id_t src_id;
 	unsigned long type;
 	void* data;
 	size_t data_size;
-};
+	ca_release_fn_t release;
+	uint32_t seq;			// Trace flow id (0: none), then arrival order once set aside (see ca_stash_t)
+	uint32_t call_id;		// ca_call_async() request or, CA_CALL_REPLY set, reply; 0: neither
+	char inline_data[CA_MSG_INLINE_SIZE] __attribute__((aligned(16)));
+} __attribute__((aligned(CA_CACHE_LINE)));
 typedef struct ca_msg ca_msg_t;
 
-struct ca_msg_list_node;
-typedef struct ca_msg_list_node ca_msg_list_node_t;
-struct ca_msg_list_node {
-	ca_msg_list_node_t* next;
-	ca_msg_t* msg;
+// One of the messages passed to ca_send_batch()
+struct ca_batch_msg {
+	unsigned long type;
+	void* data;
+	size_t data_size;
+};
+typedef struct ca_batch_msg ca_batch_msg_t;
+
+// A payload shared by all the messages of a broadcast: freed
+// when the last of them is released
+struct ca_shared_payload {
+	long refs;
+	char data[] __attribute__((aligned(16)));
 };
+typedef struct ca_shared_payload ca_shared_payload_t;
+
+// ---------------------------------------------------------
+// Messages a selective receive went past are set aside in
+// their actor's stash, one FIFO per type (types from 63 up
+// share the last one), linked through node.next. 'seq' keeps
+// track of their overall order. Only the owner touches it.
+// ---------------------------------------------------------
+#define CA_STASH_QUEUES		64
+#define CA_TYPE_BIT(type)	((type) < CA_STASH_QUEUES - 1 ? 1ULL << (type) : 1ULL << (CA_STASH_QUEUES - 1))
+
+// A call made with ca_call_async(), waiting for its reply
+struct ca_call_slot {
+	uint32_t id;			// Future of the call; bumped once it is over
+	uint32_t next_free;		// Free: next free slot + 1, 0 for none
+	int busy;
+	ca_msg_t* reply;		// Once it came
+};
+typedef struct ca_call_slot ca_call_slot_t;
+
+struct ca_stash {
+	ca_msg_t* head[CA_STASH_QUEUES];
+	ca_msg_t* tail[CA_STASH_QUEUES];
+	uint64_t used;			// Bit set: queue not empty
+	uint32_t seq;
+	size_t count;
+	ca_call_slot_t* calls;	// Calls in flight, by future & CA_CALL_INDEX_MASK
+	uint32_t calls_size;
+	uint32_t calls_free;	// First free slot + 1, 0 for none
+};
+typedef struct ca_stash ca_stash_t;
+
+// A thread's cache of free messages, linked through node.next
+struct ca_msg_cache {
+	ca_msg_list_node_t* head;
+	int count;
+};
+typedef struct ca_msg_cache ca_msg_cache_t;
+
+// Free messages in the depot: CA_MSG_BATCH of them, or fewer once a
+// thread gave back its last ones
+struct ca_msg_batch {
+	ca_msg_list_node_t* head;
+	int count;
+};
+typedef struct ca_msg_batch ca_msg_batch_t;
 
 #define PDEBUG(txt, name) printf("- LINE_%u:%s:%lu: %s\n", __LINE__, name, (unsigned long)pthread_self(), txt)
 #if DEBUG_LOCKING == 1
-#define GUARD_SECTION(name, id) PDEBUG("Attempt to guard", name); pthread_mutex_lock(&id); PDEBUG("Guarding", name);
+#define GUARD_SECTION(name, id) PDEBUG("Attempt to guard", name); \
+	if(pthread_mutex_trylock(&id) != 0) { ca_lock_contended_(&id); pthread_mutex_lock(&id); } \
+	PDEBUG("Guarding", name);
+#define GUARD_ACTOR_SECTION(name, actor) PDEBUG("Attempt to guard", name); \
+	if(pthread_mutex_trylock(&(actor)->thread_cond_mutex) != 0) { \
+		ca_actor_contended_(actor); pthread_mutex_lock(&(actor)->thread_cond_mutex); } \
+	PDEBUG("Guarding", name);
 #define LEAVE_SECTION(name, id) PDEBUG("Attempt to stop guarding", name); pthread_mutex_unlock(&id); PDEBUG("Stopped guarding", name);
 #else
-#define GUARD_SECTION(name, id) pthread_mutex_lock(&id);
+#define GUARD_SECTION(name, id) \
+	if(pthread_mutex_trylock(&id) != 0) { ca_lock_contended_(&id); pthread_mutex_lock(&id); }
+// An actor's condition mutex: contention counts against that actor too
+#define GUARD_ACTOR_SECTION(name, actor) \
+	if(pthread_mutex_trylock(&(actor)->thread_cond_mutex) != 0) { \
+		ca_actor_contended_(actor); pthread_mutex_lock(&(actor)->thread_cond_mutex); }
 #define LEAVE_SECTION(name, id) pthread_mutex_unlock(&id);
 #endif
 
 #if DEBUG_ACTORS_LIST == 1
 #define PDEBUG_ACTORS_LIST	{ \
-	printf("Actors list dump:\n"); \
-	ca_actor_list_node_t* debug_node; \
-	for(debug_node = ca_actor_list_head; debug_node != 0; debug_node = debug_node->next) { \
-		printf("Node: id == %lu\n", (unsigned long)debug_node->actor->id); \
+	printf("Actors table dump:\n"); \
+	uint32_t debug_index; \
+	for(debug_index = 0; debug_index < ca_actors_high_water; debug_index++) { \
+		ca_actor_t* debug_actor = ca_actor_slot_(debug_index); \
+		if(debug_actor->id != CA_INVALID_ACTOR_ID) { \
+			printf("Slot %u: id == %llu\n", debug_index, (unsigned long long)debug_actor->id); \
+		} \
 	} \
 	printf("------\n"); \
 }
@@ -108,17 +620,149 @@ struct ca_msg_list_node {
 #endif
 
 /*
- * Convert thread to actor id.
- * Not using a real id field means that pthread_create() can
- * be thought of atomically (since no post-call id assignment)
+ * Convert actor information to actor id.
+ * The id is assigned, and the actor reachable through it,
+ * before the actor's thread is even created.
  */
-#define ACTOR_ID(x) (ca_actor_id_t)(x->thread)
+#define ACTOR_ID(x) ((x)->id)
 
 enum {
 	MSG_PRUNE_ACTION = 1,
 	MSG_RETRIEVE_ACTION
 };
 
+// ---------------------------------------------------------
+// Statistics. Counters are always on: relaxed atomics, or
+// plain stores where only one thread writes.
+// Locks are counted as contended when a first try fails.
+// ---------------------------------------------------------
+enum {
+	CA_LOCK_ACTORS = 0,		// Actors table
+	CA_LOCK_ACTOR,			// Actors' condition mutexes, all of them
+	CA_LOCK_MSG_DEPOT,		// Free messages depot
+	CA_LOCK_SCHED,			// Run queue, idle workers, task pool
+	CA_LOCK_TIMERS,
+	CA_LOCK_JOIN,
+	CA_LOCK_TRACE,			// Trace rings list
+	CA_LOCK_OTHER,			// Any other GUARD_SECTION
+	CA_LOCK_KINDS
+};
+
+struct ca_actor_stats {
+	ca_actor_id_t id;
+	long depth;					// Messages waiting in its mailbox
+	long depth_high_water;
+	unsigned long received;		// Taken out of its mailbox
+	unsigned long sent;			// Sent by it
+	unsigned long dropped;		// Meant for it, refused or dropped for want of room
+	unsigned long blocked_ns;	// Time spent waiting for messages
+	unsigned long contended;	// Times its condition mutex was found taken
+};
+typedef struct ca_actor_stats ca_actor_stats_t;
+
+struct ca_stats {
+	unsigned long actors_spawned;
+	unsigned long actors_live;
+	unsigned long msgs_queued;	// Into any mailbox
+	unsigned long msgs_taken;	// Out of any mailbox, received or dropped
+	unsigned long msgs_dropped;
+	unsigned long blocked_ns;
+	unsigned long contended[CA_LOCK_KINDS];
+};
+typedef struct ca_stats ca_stats_t;
+
+// ---------------------------------------------------------
+// Tracing. An event is recorded by the thread it happens on,
+// into that thread's ring, on behalf of an actor (its track
+// once dumped) or of none.
+// ---------------------------------------------------------
+enum {
+	CA_TRACE_SPAWN = 0,		// peer: the new actor
+	CA_TRACE_SEND,			// Message built; peer: recipient
+	CA_TRACE_ENQUEUE,		// Queued, first of a batch; peer: recipient
+	CA_TRACE_WAKEUP,		// Done waiting for messages; arg: ns waited
+	CA_TRACE_RECEIVE,		// Handed over; peer: sender
+	CA_TRACE_RELEASE,
+	CA_TRACE_EXIT,
+	CA_TRACE_KINDS
+};
+
+struct ca_trace_event {
+	uint64_t ticks;			// Time stamp counter, or ns where there is none
+	ca_actor_id_t actor;
+	ca_actor_id_t peer;
+	uint64_t arg;			// Message flow id (links send to receive, 0: none), or as above
+	unsigned long type;		// Message type
+	int kind;
+};
+typedef struct ca_trace_event ca_trace_event_t;
+
+struct ca_trace_ring {
+	uint64_t head;				// Events ever recorded: written by its thread only
+	uint64_t size;				// Events it holds, a power of two
+	int in_use;					// Has a thread; else up for grabs, events and all
+	struct ca_trace_ring* next;	// All rings, guarded by thread_trace_mutex
+	ca_trace_event_t events[];
+};
+typedef struct ca_trace_ring ca_trace_ring_t;
+
+// ---------------------------------------------------------
+// Nodes: processes sharing actors through a shared memory
+// segment. It holds a header, then a ring for every ordered
+// pair of nodes, sender's then receiver's, loopback included.
+// Rings are bounded lock-free queues (Vyukov): the sending
+// process's threads claim cells at 'tail', the receiving
+// node's dispatcher thread takes them at 'head', copies them
+// into messages of their own and gives them straight back.
+// A cell's 'seq' is kept minus its index in the ring, so that
+// a zero-filled segment is a set of empty rings.
+// ---------------------------------------------------------
+#define CA_NODE_SEGMENT_MAGIC	0x323045444f4e4143ULL	// "CANODE02"
+
+// Largest payload a message to another node can carry
+#define CA_NODE_MSG_SIZE		(CA_NODE_CELL_SIZE - 48)
+
+struct ca_node_cell {
+	uint64_t seq;			// Free for position p: p; full: p + 1
+	ca_actor_id_t src_id;	// Node number included
+	ca_actor_id_t dest_id;	// Node number left out
+	uint64_t type;
+	uint64_t data_size;
+	int prio;
+	uint32_t call_id;		// See ca_msg_t
+	char data[CA_NODE_MSG_SIZE] __attribute__((aligned(16)));
+} __attribute__((aligned(CA_CACHE_LINE)));
+typedef struct ca_node_cell ca_node_cell_t;
+
+struct ca_node_ring {
+	uint64_t tail;			// Next position senders claim
+	char pad[CA_CACHE_LINE - sizeof(uint64_t)];
+	uint64_t head;			// Next position the dispatcher takes
+	char pad2[CA_CACHE_LINE - sizeof(uint64_t)];
+	ca_node_cell_t cells[CA_NODE_RING_CELLS];
+};
+typedef struct ca_node_ring ca_node_ring_t;
+
+struct ca_node_peer {
+	int pid;				// 0: none, -1: being joined
+	int parked;				// Dispatcher asleep: futex word
+	ca_actor_id_t entry;	// See ca_node_publish()
+	int epoch;				// Incarnation, 1 to 255: see CA_ACTOR_ID_EPOCH()
+	int published;			// Bumped by ca_node_publish(): futex word of ca_node_lookup()
+} __attribute__((aligned(CA_CACHE_LINE)));
+typedef struct ca_node_peer ca_node_peer_t;
+
+struct ca_node_segment {
+	uint64_t magic;
+	int state;				// 0: blank, 1: being laid out, 2: ready
+	int nodes;				// CA_NODES_MAX, CA_NODE_RING_CELLS and
+	int ring_cells;			// CA_NODE_CELL_SIZE of whoever laid it out
+	int cell_size;
+	ca_node_peer_t peers[CA_NODES_MAX + 1];	// By node number, 0 unused
+	ca_node_ring_t rings[];	// (from - 1) * CA_NODES_MAX + to - 1
+};
+typedef struct ca_node_segment ca_node_segment_t;
+
 // ---------------------------------------------------------
 // PUBLIC API
 // ---------------------------------------------------------
@@ -128,7 +772,54 @@ ca_actor_t* ca_spawn(void*(*fn)(void*));
 ca_msg_t* ca_receive();
 void ca_send(ca_actor_id_t id, unsigned long type, void* data, size_t data_size);
 void ca_reply(ca_msg_t* msg, unsigned long type, void* data, size_t data_size);
+int ca_send_batch(ca_actor_id_t id, ca_batch_msg_t* msgs, int count);
+void ca_send_prio(ca_actor_id_t id, int prio, unsigned long type, void* data, size_t data_size);
+int ca_try_send(ca_actor_id_t id, unsigned long type, void* data, size_t data_size);
+ca_actor_t* ca_spawn_bounded(void*(*fn)(void*), long capacity, int policy, long timeout);
+ca_actor_t* ca_spawn_opts(void*(*fn)(void*), void* arg, const ca_spawn_opts_t* opts);
+ca_actor_t* ca_spawn_handler(ca_handler_fn_t handler, void* state);
+ca_actor_id_t ca_spawn_pool(void*(*fn)(void*), int size, int policy);
+int ca_pool_resize(ca_actor_id_t id, int size);
+int ca_pool_size(ca_actor_id_t id);
+void ca_send_key(ca_actor_id_t id, uint64_t key, unsigned long type, void* data, size_t data_size);
+int ca_set_mailbox_limit(ca_actor_id_t id, long capacity, int policy, long timeout);
+long ca_queue_depth(ca_actor_id_t id);
+int ca_receive_many(ca_msg_t** out, int max, long timeout);
+ca_msg_t* ca_receive_timeout(long timeout);
+ca_msg_t* ca_receive_match(uint64_t type_mask, long timeout);
+ca_msg_t* ca_receive_match_fn(int (*match)(ca_msg_t* msg, void* arg), void* arg, long timeout);
+ca_timer_id_t ca_send_after(ca_actor_id_t id, long delay, unsigned long type, void* data, size_t data_size);
+int ca_cancel_timer(ca_timer_id_t timer_id);
+void ca_send_move(ca_actor_id_t id, unsigned long type, void* data, size_t data_size, ca_release_fn_t release);
+void ca_reply_move(ca_msg_t* msg, unsigned long type, void* data, size_t data_size, ca_release_fn_t release);
+ca_future_t ca_call_async(ca_actor_id_t id, unsigned long type, void* data, size_t data_size);
+ca_msg_t* ca_future_wait(ca_future_t future, long timeout);
+void ca_future_cancel(ca_future_t future);
+ca_msg_t* ca_call(ca_actor_id_t id, unsigned long type, void* data, size_t data_size, long timeout);
+void* ca_take_data(ca_msg_t* msg, ca_release_fn_t* release);
+ca_msg_t* ca_msg_new(size_t data_size);
+int ca_send_msg(ca_actor_id_t id, unsigned long type, ca_msg_t* msg);
+int ca_broadcast(unsigned long type, void* data, size_t data_size);
+int ca_broadcast_group(ca_actor_id_t* ids, int count, unsigned long type, void* data, size_t data_size);
 void ca_sleep(long milliseconds);
 void ca_join();
+int ca_wait_actor(ca_actor_id_t id);
+int ca_monitor(ca_actor_id_t id);
+int ca_set_scheduler(int mode, int num_workers);
+void ca_set_receive_spin(long nanoseconds);
+int ca_node_join(const char* name, int node);
+void ca_node_leave();
+int ca_node_publish(ca_actor_id_t id);
+ca_actor_id_t ca_node_lookup(int node, long timeout);
+void ca_stats_get(ca_stats_t* stats);
+int ca_actor_stats_get(ca_actor_id_t id, ca_actor_stats_t* stats);
+void ca_stats_dump(FILE* out);
+void ca_trace_enable(int on);
+void ca_set_trace_ring_size(size_t events);
+int ca_trace_dump(FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* CA_DEFINES_H */
@@ -0,0 +1,283 @@
+/*
+ * This file is part of the CActor library.
+ *
+ * Copyright (c) 2012 Chris Ravenscroft
+ *
+ * This code is dual-licensed under the terms of the Apache License Version 2.0 and
+ * the terms of the General Public License (GPL) Version 2.
+ * You may use this code according to either of these licenses as is most appropriate
+ * for your project on a case-by-case basis.
+ *
+ * The terms of each license can be found in the root directory of this project's repository as well as at:
+ *
+ * * http://www.apache.org/licenses/LICENSE-2.0
+ * * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under these Licenses is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See each License for the specific language governing permissions and
+ * limitations under that License.
+ */
+
+/*
+ * C++ layer, header only (C++17): typed messages.
+ * ca::send() builds a C++ object right inside a message from the pool
+ * (see ca_msg_new()), moving it there, and the receiver's release
+ * destroys it in place: no copy, no allocation for objects that fit
+ * CA_MSG_INLINE_SIZE. A ca::actor<Msgs...> gets every message whose
+ * type is one of Msgs passed to its on() overload for that type.
+ *
+ *     struct add { int n; };
+ *     struct total { ca::actor_id to; };
+ *     struct counter : ca::actor<add, total> {
+ *         long sum = 0;
+ *         void on(add& msg) override { sum += msg.n; }
+ *         void on(total& msg) override { ca::send(msg.to, sum); }
+ *     };
+ *     ca::actor_id id = ca::spawn<counter>();
+ *     ca::send(id, add{ 2 });
+ */
+
+#ifndef CA_DEFINES_HPP
+#define CA_DEFINES_HPP
+#include <new>
+#include <utility>
+#include <type_traits>
+#include "cactor.h"
+
+namespace ca {
+
+typedef ca_actor_id_t actor_id;
+
+namespace detail {
+
+// What the message_type<T> a type was not given a number for derives from
+struct address_type {};
+
+}
+
+/*
+ * Message type number of T: by default the address of a variable of
+ * its own, the same all over the process (shared libraries included,
+ * unless built with hidden visibility) and far above the small numbers
+ * C code uses. That address is not the same in another process, not
+ * even one running the same program (address space randomisation):
+ * specialise it to pin a number, to talk to C actors or to actors of
+ * other nodes, which ca::send() refuses to send T to otherwise:
+ *
+ *     template<> struct ca::message_type<add> {
+ *         static unsigned long value() { return 7; }
+ *     };
+ */
+template<class T>
+struct message_type : detail::address_type {
+	static const char tag;
+	static unsigned long value() {
+		return (unsigned long)&tag;
+	}
+};
+
+template<class T>
+const char message_type<T>::tag = 0;
+
+namespace detail {
+
+// Release of an object built inside its message
+template<class T>
+void destroy(void* data, size_t) {
+	static_cast<T*>(data)->~T();
+}
+
+// Release of an object too big for that, ca_msg_new() having
+// allocated its room
+template<class T>
+void destroy_free(void* data, size_t) {
+	static_cast<T*>(data)->~T();
+	free(data);
+}
+
+template<class A>
+void* run(void* arg) {
+	A* self = static_cast<A*>(arg);
+	self->run();
+	delete self;
+	return 0;
+}
+
+// Handler of an actor spawned with spawn_handler(): one message at a
+// time, the worker releasing it
+template<class A>
+int handle(void* state, ca_msg_t* msg) {
+	A* self = static_cast<A*>(state);
+	self->dispatch(msg);
+	if(!self->stopped()) {
+		return 0;
+	}
+	delete self;
+	return 1;
+}
+
+}
+
+/*
+ * Send value to actor id, moved (or copied, if an lvalue) into a new
+ * message: its type is message_type<T>. The receiver gets it as a T&
+ * and it is destroyed when the message is released.
+ * Objects that are not trivially copyable, or whose message_type is
+ * not specialised, cannot go to another node: EXDEV. Otherwise returns
+ * as ca_send_msg(). Whatever U's constructor throws is thrown again,
+ * the message given back.
+ */
+template<class T>
+int send(actor_id id, T&& value) {
+	typedef typename std::decay<T>::type U;
+	static_assert(alignof(U) <= 16, "messages are only 16 byte aligned");
+	if(CA_ACTOR_ID_NODE(id) != 0 && (!std::is_trivially_copyable<U>::value
+			|| std::is_base_of<detail::address_type, message_type<U> >::value)) {
+		return EXDEV;
+	}
+	ca_msg_t* msg = ca_msg_new(sizeof(U));
+	if(msg == 0) {
+		return ENOMEM;
+	}
+	try {
+		new(msg->data) U(std::forward<T>(value));
+	}
+	catch(...) {
+		// No release set yet: nothing to destroy, only room to free
+		ca_release_msg(msg);
+		throw;
+	}
+	if(!std::is_trivially_destructible<U>::value) {
+		msg->release = msg->data == msg->inline_data ? &detail::destroy<U> : &detail::destroy_free<U>;
+	}
+	return ca_send_msg(id, message_type<U>::value(), msg);
+}
+
+// What an actor<..., T, ...> must override
+template<class T>
+class handles {
+public:
+	virtual void on(T& msg) = 0;
+protected:
+	~handles() {}
+};
+
+/*
+ * Actor that takes messages of types Msgs: run() passes each one to
+ * on(), until stop(). Finding the overload to call is a chain of
+ * comparisons the compiler unrolls, one per type in Msgs. Messages of
+ * any other type, CA_MSG_TYPE_EXIT included, go to on_other().
+ * on() must not throw: there is no C++ frame to catch it above run().
+ */
+template<class... Msgs>
+class actor : public handles<Msgs>... {
+public:
+	virtual ~actor() {}
+
+	// Receive and dispatch until stop()
+	void run() {
+		while(!stopped_) {
+			ca_msg_t* msg = ca_receive();
+			if(msg == 0) {
+				break;
+			}
+			dispatch(msg);
+			ca_release_msg(msg);
+		}
+	}
+
+	// Pass msg to its on() overload, or to on_other(); msg is not
+	// released
+	void dispatch(ca_msg_t* msg) {
+		current_ = msg;
+		if(!(dispatch_as<Msgs>(msg) || ...)) {
+			on_other(msg);
+		}
+		current_ = 0;
+	}
+
+	bool stopped() const {
+		return stopped_;
+	}
+
+protected:
+	actor() : current_(0), stopped_(false) {}
+
+	// The message being handled, within on() and on_other() only
+	const ca_msg_t* current() const {
+		return current_;
+	}
+	actor_id sender() const {
+		return current_->src_id;
+	}
+	actor_id self() const {
+		return current_->dest_id;
+	}
+
+	// Return from run(), or exit if a handler, once done with the
+	// message being handled
+	void stop() {
+		stopped_ = true;
+	}
+
+	virtual void on_other(ca_msg_t* msg) {
+		(void)msg;
+	}
+
+private:
+	template<class T>
+	bool dispatch_as(ca_msg_t* msg) {
+		if(msg->type != message_type<T>::value()) {
+			return false;
+		}
+		static_cast<handles<T>*>(this)->on(*static_cast<T*>(msg->data));
+		return true;
+	}
+
+	ca_msg_t* current_;
+	bool stopped_;
+};
+
+/*
+ * Spawn an actor of class A, built from args, as ca_spawn_opts() would
+ * with opts (all defaults if none): it runs A::run(), then is deleted.
+ * opts have no say in what kind of actor it is: see spawn_handler().
+ * Returns its id, or CA_INVALID_ACTOR_ID if it could not be spawned.
+ */
+template<class A, class... Args>
+actor_id spawn_opts(const ca_spawn_opts_t* opts, Args&&... args) {
+	A* a = new A(std::forward<Args>(args)...);
+	ca_actor_t* ca_actor = ca_spawn_opts(&detail::run<A>, a, opts);
+	if(ca_actor == 0) {
+		delete a;
+		return CA_INVALID_ACTOR_ID;
+	}
+	return ACTOR_ID(ca_actor);
+}
+
+template<class A, class... Args>
+actor_id spawn(Args&&... args) {
+	return spawn_opts<A>(0, std::forward<Args>(args)...);
+}
+
+/*
+ * Same, as a handler actor (see ca_spawn_handler()): run() is never
+ * called, workers pass messages to dispatch() one at a time instead,
+ * and the actor is deleted once it stop()s. on() must not block.
+ */
+template<class A, class... Args>
+actor_id spawn_handler(Args&&... args) {
+	A* a = new A(std::forward<Args>(args)...);
+	ca_actor_t* ca_actor = ca_spawn_handler(&detail::handle<A>, a);
+	if(ca_actor == 0) {
+		delete a;
+		return CA_INVALID_ACTOR_ID;
+	}
+	return ACTOR_ID(ca_actor);
+}
+
+}
+
+#endif /* CA_DEFINES_HPP */
@@ -0,0 +1,1522 @@
+/* 
+ * This file is part of the CActor library.
+ *  
+ * Copyright (c) 2012 Chris Ravenscroft
+ *  
+ * This code is dual-licensed under the terms of the Apache License Version 2.0 and
+ * the terms of the General Public License (GPL) Version 2.
+ * You may use this code according to either of these licenses as is most appropriate
+ * for your project on a case-by-case basis.
+ * 
+ * The terms of each license can be found in the root directory of this project's repository as well as at:
+ * 
+ * * http://www.apache.org/licenses/LICENSE-2.0
+ * * http://www.gnu.org/licenses/gpl-2.0.txt
+ *  
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under these Licenses is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See each License for the specific language governing permissions and
+ * limitations under that License.
+ */
+
+/*
+ * Actor runtime benchmarks.
+ * Each prints one line per run: the benchmark's name, then key=value
+ * pairs. Build with make.sh (optimised).
+ *
+ *     cactor_bench all
+ *         Every benchmark below that runs with thread actors, with
+ *         default counts
+ *     cactor_bench fanin [producers] [messages per producer]
+ *         N producers flood one aggregator actor
+ *     cactor_bench fanout [consumers] [messages per consumer] [workers]
+ *         One producer spreads messages over N consumers, round robin
+ *     cactor_bench pingpong [round trips] [workers] [spin ns]
+ *         Two actors bounce a message: round trip latency percentiles.
+ *         'spin ns' sets ca_set_receive_spin() (default: the library's)
+ *     cactor_bench ring [actors] [laps] [workers]
+ *         A token goes round a ring of actors
+ *     cactor_bench handlers [actors] [laps] [workers]
+ *         The same ring, with handler actors (ca_spawn_handler): also
+ *         reports spawn time and resident memory per actor
+ *     cactor_bench payload [messages] [max bytes]
+ *         One sender, one receiver: payloads from 64 bytes up to
+ *         'max bytes', 4 times bigger each run, fewer messages once
+ *         they add up to more than 1GB
+ *     cactor_bench skewed [workers] [children] [rounds] [work]
+ *         CA_SCHED_WORKERS mode: one hot actor spawns children, then
+ *         repeatedly fans a message out to all of them and waits for
+ *         every reply; each child spins for 'work' iterations per message
+ *     cactor_bench pipeline [stages] [messages] [bytes]
+ *         Buffers of 'bytes' bytes flow down a chain of actors, first copied
+ *         at each hop with ca_send, then handed over with ca_send_move
+ *     cactor_bench broadcast [recipients] [rounds] [bytes]
+ *         One actor sends the same payload to every recipient, first with
+ *         a ca_send loop, then with ca_broadcast_group
+ *     cactor_bench batch [messages] [batch size]
+ *         One producer, one consumer: ca_send/ca_receive one message at
+ *         a time, then ca_send_batch/ca_receive_many
+ *     cactor_bench timers [timers]
+ *         One actor arms that many ca_send_after timers to itself, 1 to
+ *         1000 ms away, cancels every other one, then collects the rest
+ *     cactor_bench spawn [actors] [workers] [in flight]
+ *         Spawn actors and send each a first message right away; each
+ *         replies, recording how long that message took to get through,
+ *         and exits. Up to 'in flight' actors are alive at once.
+ *         workers > 0 runs them as tasks (CA_SCHED_WORKERS)
+ *     cactor_bench prio [backlog] [controls] [work]
+ *         A feeder queues 'backlog' data messages, each costing the
+ *         consumer 'work' iterations, then a control message the consumer
+ *         answers at once, 'controls' times over; control messages go
+ *         first with ca_send, then with ca_send_prio
+ *     cactor_bench trace [messages] [workers] [file]
+ *         The single message run of 'batch', with tracing off then on:
+ *         each message makes four events (send, enqueue, receive,
+ *         release). The trace is written to 'file' if given, as Chrome
+ *         trace JSON
+ *     cactor_bench pool [members] [messages] [work] [workers]
+ *         A feeder keeps 4 messages per member in flight to a pool
+ *         (ca_spawn_pool), each costing 'work' iterations; one member
+ *         also waits 1ms on every message. Once per policy: round robin,
+ *         least depth, hash. Reports the slow member's share, latencies
+ *     cactor_bench call [calls] [in flight] [servers] [workers]
+ *         One actor calls a round robin pool of 'servers' echo actors,
+ *         whose replies come back out of order: one call at a time with
+ *         ca_send/ca_receive then ca_call, then with 'in flight' calls
+ *         pipelined, waiting for the oldest reply with
+ *         ca_receive_match_fn then with ca_call_async/ca_future_wait
+ *     cactor_bench node [messages] [bytes]
+ *         Two processes, nodes of one shared memory segment (see
+ *         ca_node_join): one floods an actor of the other with messages
+ *         of 'bytes' bytes, then bounces one back and forth for round trip
+ *         latency percentiles; then the same over a Unix socketpair, raw
+ *         bytes with no actors at either end. Not part of 'all': it forks
+ *         before starting any actor
+ *
+ * 'workers' > 0 runs actors as tasks on that many worker threads
+ * (CA_SCHED_WORKERS), 0 (default) on their own threads.
+ */
+
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "cactor.h"
+
+#define BENCH_MSG_TYPE_DATA	1
+
+struct timespec start_time, end_time;
+
+double elapsed(struct timespec* from, struct timespec* to) {
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+int sched_workers = 0;
+
+// Pick the scheduler from a [workers] argument; must come before any spawn
+void use_workers(int argc, char **argv, int index) {
+	if(argc > index && atoi(argv[index]) > 0) {
+		sched_workers = atoi(argv[index]);
+		ca_set_scheduler(CA_SCHED_WORKERS, sched_workers);
+	}
+}
+
+const char* sched_name() {
+	return sched_workers > 0 ? "workers" : "threads";
+}
+
+int compare_doubles(const void* a, const void* b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+// Percentile of sorted values
+double percentile(double* sorted, long count, double p) {
+	long index = (long)(count * p);
+	return sorted[index < count ? index : count - 1];
+}
+
+// ---------------------------------------------------------
+// Fan-in
+// ---------------------------------------------------------
+
+int num_producers = 4;
+long msgs_per_producer = 250000;
+
+ca_actor_id_t aggregator_id;
+
+void* aggregatorfn(void* args) {
+	long total = (long)num_producers * msgs_per_producer;
+	long i;
+	for(i = 0; i < total; i++) {
+		ca_release_msg(ca_receive());
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	return 0;
+}
+
+void* producerfn(void* args) {
+	long i;
+	for(i = 0; i < msgs_per_producer; i++) {
+		ca_send(aggregator_id, BENCH_MSG_TYPE_DATA, &i, sizeof(i));
+	}
+	return 0;
+}
+
+void bench_fanin(int argc, char **argv) {
+	if(argc > 0) {
+		num_producers = atoi(argv[0]);
+	}
+	if(argc > 1) {
+		msgs_per_producer = atol(argv[1]);
+	}
+
+	ca_actor_t* aggregator = ca_spawn(aggregatorfn);
+	aggregator_id = ACTOR_ID(aggregator);
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	int i;
+	for(i = 0; i < num_producers; i++) {
+		(void)ca_spawn(producerfn);
+	}
+	ca_join();
+
+	double secs = elapsed(&start_time, &end_time);
+	long total = (long)num_producers * msgs_per_producer;
+	printf("fan-in mailbox=%s producers=%d msgs=%ld secs=%.3f msgs_per_sec=%.0f\n",
+		CA_MAILBOX_LOCKFREE ? "lockfree" : "mutex",
+		num_producers, total, secs, total / secs);
+}
+
+// ---------------------------------------------------------
+// Fan-out
+// ---------------------------------------------------------
+
+int num_consumers = 4;
+long msgs_per_consumer = 250000;
+int consumers_done = 0;
+
+void* consumerfn(void* args) {
+	long i;
+	for(i = 0; i < msgs_per_consumer; i++) {
+		ca_release_msg(ca_receive());
+	}
+	if(__atomic_add_fetch(&consumers_done, 1, __ATOMIC_ACQ_REL) == num_consumers) {
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+	}
+	return 0;
+}
+
+void* distributorfn(void* args) {
+	ca_actor_id_t* consumers = (ca_actor_id_t*)malloc(num_consumers * sizeof(ca_actor_id_t));
+	int c;
+	for(c = 0; c < num_consumers; c++) {
+		consumers[c] = ACTOR_ID(ca_spawn(consumerfn));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	long i;
+	for(i = 0; i < msgs_per_consumer; i++) {
+		for(c = 0; c < num_consumers; c++) {
+			ca_send(consumers[c], BENCH_MSG_TYPE_DATA, &i, sizeof(i));
+		}
+	}
+	free(consumers);
+	return 0;
+}
+
+void bench_fanout(int argc, char **argv) {
+	if(argc > 0) {
+		num_consumers = atoi(argv[0]) > 0 ? atoi(argv[0]) : 1;
+	}
+	if(argc > 1) {
+		msgs_per_consumer = atol(argv[1]);
+	}
+	use_workers(argc, argv, 2);
+	consumers_done = 0;
+	(void)ca_spawn(distributorfn);
+	ca_join();
+
+	double secs = elapsed(&start_time, &end_time);
+	long total = (long)num_consumers * msgs_per_consumer;
+	printf("fan-out sched=%s consumers=%d msgs=%ld secs=%.3f msgs_per_sec=%.0f\n",
+		sched_name(), num_consumers, total, secs, total / secs);
+}
+
+// ---------------------------------------------------------
+// Skewed fan-out
+// ---------------------------------------------------------
+
+int num_workers = 1;
+int num_children = 64;
+long num_rounds = 2000;
+long work_per_msg = 2000;
+
+volatile unsigned long work_sink;
+
+void* childfn(void* args) {
+	for(;;) {
+		ca_msg_t* msg = ca_receive();
+		if(msg->type != BENCH_MSG_TYPE_DATA) {
+			ca_release_msg(msg);
+			break;
+		}
+		unsigned long acc = 0;
+		long i;
+		for(i = 0; i < work_per_msg; i++) {
+			acc = acc * 31 + i;
+		}
+		work_sink = acc;
+		ca_reply(msg, BENCH_MSG_TYPE_DATA, &acc, sizeof(acc));
+		ca_release_msg(msg);
+	}
+	return 0;
+}
+
+void* hotfn(void* args) {
+	ca_actor_id_t* children = (ca_actor_id_t*)malloc(num_children * sizeof(ca_actor_id_t));
+	int i;
+	for(i = 0; i < num_children; i++) {
+		children[i] = ACTOR_ID(ca_spawn(childfn));
+	}
+	long round;
+	for(round = 0; round < num_rounds; round++) {
+		for(i = 0; i < num_children; i++) {
+			ca_send(children[i], BENCH_MSG_TYPE_DATA, &round, sizeof(round));
+		}
+		for(i = 0; i < num_children; i++) {
+			ca_release_msg(ca_receive());
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	for(i = 0; i < num_children; i++) {
+		ca_send(children[i], BENCH_MSG_TYPE_DATA + 1, &round, sizeof(round));
+	}
+	free(children);
+	return 0;
+}
+
+void bench_skewed(int argc, char **argv) {
+	if(argc > 0) {
+		num_workers = atoi(argv[0]);
+	}
+	if(argc > 1) {
+		num_children = atoi(argv[1]);
+	}
+	if(argc > 2) {
+		num_rounds = atol(argv[2]);
+	}
+	if(argc > 3) {
+		work_per_msg = atol(argv[3]);
+	}
+	ca_set_scheduler(CA_SCHED_WORKERS, num_workers);
+
+	struct timespec cpu_start, cpu_end;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	(void)ca_spawn(hotfn);
+	ca_join();
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+
+	double secs = elapsed(&start_time, &end_time);
+	long total = 2 * (long)num_children * num_rounds;
+	printf("skewed workers=%d children=%d rounds=%ld work=%ld secs=%.3f msgs_per_sec=%.0f busy_cores=%.2f\n",
+		num_workers, num_children, num_rounds, work_per_msg, secs, total / secs,
+		elapsed(&cpu_start, &cpu_end) / secs);
+}
+
+// ---------------------------------------------------------
+// Pipeline
+// ---------------------------------------------------------
+
+int num_stages = 4;
+long num_buffers = 200;
+size_t buffer_size = 4 << 20;
+int pipeline_move = 0;
+
+ca_actor_id_t* stage_ids;
+
+void* stagefn(void* args) {
+	// Find out which stage we are
+	ca_msg_t* msg = ca_receive();
+	long stage = *(long*)msg->data;
+	ca_release_msg(msg);
+	ca_actor_id_t next = stage + 1 < num_stages ? stage_ids[stage + 1] : CA_INVALID_ACTOR_ID;
+	long i;
+	for(i = 0; i < num_buffers; i++) {
+		msg = ca_receive();
+		((char*)msg->data)[stage] += 1;
+		if(next == CA_INVALID_ACTOR_ID) {
+			ca_release_msg(msg);
+			continue;
+		}
+		if(pipeline_move) {
+			ca_release_fn_t release;
+			size_t size = msg->data_size;
+			void* data = ca_take_data(msg, &release);
+			ca_send_move(next, BENCH_MSG_TYPE_DATA, data, size, release);
+		}
+		else {
+			ca_send(next, BENCH_MSG_TYPE_DATA, msg->data, msg->data_size);
+		}
+		ca_release_msg(msg);
+	}
+	if(next == CA_INVALID_ACTOR_ID) {
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+	}
+	return 0;
+}
+
+void run_pipeline(int move) {
+	pipeline_move = move;
+	stage_ids = (ca_actor_id_t*)malloc(num_stages * sizeof(ca_actor_id_t));
+	long i;
+	for(i = 0; i < num_stages; i++) {
+		stage_ids[i] = ACTOR_ID(ca_spawn(stagefn));
+	}
+	// Stages look up their successor once they know their rank
+	for(i = 0; i < num_stages; i++) {
+		ca_send(stage_ids[i], BENCH_MSG_TYPE_DATA, &i, sizeof(i));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	for(i = 0; i < num_buffers; i++) {
+		void* data = calloc(1, buffer_size);
+		if(move) {
+			ca_send_move(stage_ids[0], BENCH_MSG_TYPE_DATA, data, buffer_size, 0);
+		}
+		else {
+			ca_send(stage_ids[0], BENCH_MSG_TYPE_DATA, data, buffer_size);
+			free(data);
+		}
+	}
+	ca_join();
+	free(stage_ids);
+
+	double secs = elapsed(&start_time, &end_time);
+	printf("pipeline send=%s stages=%d msgs=%ld bytes=%lu secs=%.3f msgs_per_sec=%.0f\n",
+		move ? "move" : "copy", num_stages, num_buffers, (unsigned long)buffer_size,
+		secs, num_buffers / secs);
+}
+
+void bench_pipeline(int argc, char **argv) {
+	if(argc > 0) {
+		num_stages = atoi(argv[0]);
+	}
+	if(argc > 1) {
+		num_buffers = atol(argv[1]);
+	}
+	if(argc > 2) {
+		buffer_size = (size_t)atol(argv[2]);
+	}
+	run_pipeline(0);
+	run_pipeline(1);
+}
+
+// ---------------------------------------------------------
+// Broadcast
+// ---------------------------------------------------------
+
+int num_recipients = 64;
+long num_broadcasts = 2000;
+size_t broadcast_size = 4096;
+int broadcast_shared = 0;
+
+void* recipientfn(void* args) {
+	long i;
+	for(i = 0; i < num_broadcasts; i++) {
+		ca_release_msg(ca_receive());
+	}
+	return 0;
+}
+
+void* broadcasterfn(void* args) {
+	ca_actor_id_t* recipients = (ca_actor_id_t*)malloc(num_recipients * sizeof(ca_actor_id_t));
+	void* payload = calloc(1, broadcast_size);
+	int i;
+	for(i = 0; i < num_recipients; i++) {
+		recipients[i] = ACTOR_ID(ca_spawn(recipientfn));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	long round;
+	for(round = 0; round < num_broadcasts; round++) {
+		if(broadcast_shared) {
+			ca_broadcast_group(recipients, num_recipients, BENCH_MSG_TYPE_DATA, payload, broadcast_size);
+			continue;
+		}
+		for(i = 0; i < num_recipients; i++) {
+			ca_send(recipients[i], BENCH_MSG_TYPE_DATA, payload, broadcast_size);
+		}
+	}
+	free(payload);
+	free(recipients);
+	return 0;
+}
+
+void run_broadcast(int shared) {
+	broadcast_shared = shared;
+	(void)ca_spawn(broadcasterfn);
+	ca_join();
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+	double secs = elapsed(&start_time, &end_time);
+	long total = (long)num_recipients * num_broadcasts;
+	printf("broadcast send=%s recipients=%d rounds=%ld bytes=%lu secs=%.3f msgs_per_sec=%.0f\n",
+		shared ? "shared" : "loop", num_recipients, num_broadcasts, (unsigned long)broadcast_size,
+		secs, total / secs);
+}
+
+void bench_broadcast(int argc, char **argv) {
+	if(argc > 0) {
+		num_recipients = atoi(argv[0]);
+	}
+	if(argc > 1) {
+		num_broadcasts = atol(argv[1]);
+	}
+	if(argc > 2) {
+		broadcast_size = (size_t)atol(argv[2]);
+	}
+	run_broadcast(0);
+	run_broadcast(1);
+}
+
+// ---------------------------------------------------------
+// Batch
+// ---------------------------------------------------------
+
+long num_batched = 1000000;
+int batch_size = 32;
+int batch_mode = 0;
+
+ca_actor_id_t batch_consumer_id;
+
+void* batchconsumerfn(void* args) {
+	ca_msg_t** msgs = (ca_msg_t**)malloc(batch_size * sizeof(ca_msg_t*));
+	long received = 0;
+	while(received < num_batched) {
+		if(batch_mode) {
+			int count = ca_receive_many(msgs, batch_size, -1);
+			int i;
+			for(i = 0; i < count; i++) {
+				ca_release_msg(msgs[i]);
+			}
+			received += count;
+		}
+		else {
+			ca_release_msg(ca_receive());
+			received++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	free(msgs);
+	return 0;
+}
+
+void* batchproducerfn(void* args) {
+	ca_batch_msg_t* batch = (ca_batch_msg_t*)malloc(batch_size * sizeof(ca_batch_msg_t));
+	long i;
+	int j;
+	for(i = 0; i < num_batched; i += batch_size) {
+		int count = num_batched - i < batch_size ? (int)(num_batched - i) : batch_size;
+		if(batch_mode) {
+			for(j = 0; j < count; j++) {
+				batch[j].type = BENCH_MSG_TYPE_DATA;
+				batch[j].data = &i;
+				batch[j].data_size = sizeof(i);
+			}
+			ca_send_batch(batch_consumer_id, batch, count);
+		}
+		else {
+			for(j = 0; j < count; j++) {
+				ca_send(batch_consumer_id, BENCH_MSG_TYPE_DATA, &i, sizeof(i));
+			}
+		}
+	}
+	free(batch);
+	return 0;
+}
+
+void run_batch(int mode) {
+	batch_mode = mode;
+	batch_consumer_id = ACTOR_ID(ca_spawn(batchconsumerfn));
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	(void)ca_spawn(batchproducerfn);
+	ca_join();
+
+	double secs = elapsed(&start_time, &end_time);
+	printf("batch send=%s msgs=%ld batch=%d secs=%.3f msgs_per_sec=%.0f\n",
+		mode ? "batch" : "single", num_batched, batch_size, secs, num_batched / secs);
+}
+
+void bench_batch(int argc, char **argv) {
+	if(argc > 0) {
+		num_batched = atol(argv[0]);
+	}
+	if(argc > 1) {
+		batch_size = atoi(argv[1]);
+	}
+	run_batch(0);
+	run_batch(1);
+}
+
+// ---------------------------------------------------------
+// Timers
+// ---------------------------------------------------------
+
+long num_timers = 100000;
+
+ca_actor_id_t timers_actor_id;
+
+void* timersfn(void* args) {
+	// Wait for the go: our id is known by then
+	ca_release_msg(ca_receive());
+	ca_timer_id_t* timers = (ca_timer_id_t*)malloc(num_timers * sizeof(ca_timer_id_t));
+	struct timespec armed_time, cancelled_time;
+	unsigned int seed = 1;
+	long i;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	for(i = 0; i < num_timers; i++) {
+		timers[i] = ca_send_after(timers_actor_id, 1 + rand_r(&seed) % 1000, BENCH_MSG_TYPE_DATA, &i, sizeof(i));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &armed_time);
+	long cancelled = 0;
+	for(i = 0; i < num_timers; i += 2) {
+		cancelled += ca_cancel_timer(timers[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &cancelled_time);
+	long received;
+	for(received = 0; received < num_timers - cancelled; received++) {
+		ca_release_msg(ca_receive());
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	printf("timers timers=%ld arm_ns=%.0f cancel_ns=%.0f cancelled=%ld received=%ld secs=%.3f\n",
+		num_timers, elapsed(&start_time, &armed_time) * 1e9 / num_timers,
+		elapsed(&armed_time, &cancelled_time) * 1e9 / ((num_timers + 1) / 2),
+		cancelled, received, elapsed(&start_time, &end_time));
+	free(timers);
+	return 0;
+}
+
+void bench_timers(int argc, char **argv) {
+	if(argc > 0) {
+		num_timers = atol(argv[0]);
+	}
+	timers_actor_id = ACTOR_ID(ca_spawn(timersfn));
+	ca_send(timers_actor_id, BENCH_MSG_TYPE_DATA, 0, 0);
+	ca_join();
+}
+
+// ---------------------------------------------------------
+// Spawn
+// ---------------------------------------------------------
+
+long num_spawns = 20000;
+long spawns_in_flight = 1;
+
+double* spawn_latencies;
+
+double now_us() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+void* spawnedfn(void* args) {
+	ca_msg_t* msg = ca_receive();
+	double latency = now_us() - *(double*)msg->data;
+	ca_reply(msg, BENCH_MSG_TYPE_DATA, &latency, sizeof(latency));
+	ca_release_msg(msg);
+	return 0;
+}
+
+void* spawnerfn(void* args) {
+	long i;
+	for(i = 0; i < num_spawns; i++) {
+		double sent = now_us();
+		ca_send(ACTOR_ID(ca_spawn(spawnedfn)), BENCH_MSG_TYPE_DATA, &sent, sizeof(sent));
+		// Keep a bounded number of actors around
+		if(i + 1 >= spawns_in_flight) {
+			ca_msg_t* msg = ca_receive();
+			spawn_latencies[i + 1 - spawns_in_flight] = *(double*)msg->data;
+			ca_release_msg(msg);
+		}
+	}
+	for(i = num_spawns > spawns_in_flight - 1 ? num_spawns - spawns_in_flight + 1 : 0; i < num_spawns; i++) {
+		ca_msg_t* msg = ca_receive();
+		spawn_latencies[i] = *(double*)msg->data;
+		ca_release_msg(msg);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	return 0;
+}
+
+void bench_spawn(int argc, char **argv) {
+	if(argc > 0) {
+		num_spawns = atol(argv[0]);
+	}
+	use_workers(argc, argv, 1);
+	if(argc > 2) {
+		spawns_in_flight = atol(argv[2]) > 0 ? atol(argv[2]) : 1;
+	}
+	spawn_latencies = (double*)malloc(num_spawns * sizeof(double));
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	(void)ca_spawn(spawnerfn);
+	ca_join();
+
+	double secs = elapsed(&start_time, &end_time);
+	qsort(spawn_latencies, num_spawns, sizeof(double), compare_doubles);
+	printf("spawn sched=%s actors=%ld in_flight=%ld secs=%.3f actors_per_sec=%.0f first_msg_p50_us=%.1f first_msg_p99_us=%.1f\n",
+		sched_name(), num_spawns, spawns_in_flight, secs, num_spawns / secs,
+		percentile(spawn_latencies, num_spawns, 0.5), percentile(spawn_latencies, num_spawns, 0.99));
+	free(spawn_latencies);
+}
+
+// ---------------------------------------------------------
+// Ping-pong
+// ---------------------------------------------------------
+
+long num_round_trips = 100000;
+double* round_trips;
+
+void* pongfn(void* args) {
+	for(;;) {
+		ca_msg_t* msg = ca_receive();
+		if(msg->type != BENCH_MSG_TYPE_DATA) {
+			ca_release_msg(msg);
+			break;
+		}
+		ca_reply(msg, BENCH_MSG_TYPE_DATA, msg->data, msg->data_size);
+		ca_release_msg(msg);
+	}
+	return 0;
+}
+
+void* pingfn(void* args) {
+	ca_actor_id_t pong = ACTOR_ID(ca_spawn(pongfn));
+	struct timespec sent, received;
+	long i;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	for(i = 0; i < num_round_trips; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &sent);
+		ca_send(pong, BENCH_MSG_TYPE_DATA, &i, sizeof(i));
+		ca_release_msg(ca_receive());
+		clock_gettime(CLOCK_MONOTONIC, &received);
+		round_trips[i] = elapsed(&sent, &received) * 1e9;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	ca_send(pong, BENCH_MSG_TYPE_DATA + 1, 0, 0);
+	return 0;
+}
+
+void bench_pingpong(int argc, char **argv) {
+	if(argc > 0) {
+		num_round_trips = atol(argv[0]) > 0 ? atol(argv[0]) : 1;
+	}
+	use_workers(argc, argv, 1);
+	if(argc > 2) {
+		ca_set_receive_spin(atol(argv[2]));
+	}
+	round_trips = (double*)malloc(num_round_trips * sizeof(double));
+	(void)ca_spawn(pingfn);
+	ca_join();
+
+	double secs = elapsed(&start_time, &end_time);
+	qsort(round_trips, num_round_trips, sizeof(double), compare_doubles);
+	printf("pingpong sched=%s round_trips=%ld secs=%.3f round_trips_per_sec=%.0f p50_ns=%.0f p99_ns=%.0f p999_ns=%.0f max_ns=%.0f\n",
+		sched_name(), num_round_trips, secs, num_round_trips / secs,
+		percentile(round_trips, num_round_trips, 0.5), percentile(round_trips, num_round_trips, 0.99),
+		percentile(round_trips, num_round_trips, 0.999), round_trips[num_round_trips - 1]);
+	free(round_trips);
+}
+
+// ---------------------------------------------------------
+// Ring
+// ---------------------------------------------------------
+
+#define BENCH_MSG_TYPE_NEXT	2
+
+int ring_size = 100;
+long ring_laps = 1000;
+
+void* ringfn(void* args) {
+	// First message: who comes next
+	ca_msg_t* msg = ca_receive();
+	ca_actor_id_t next = *(ca_actor_id_t*)msg->data;
+	ca_release_msg(msg);
+	for(;;) {
+		msg = ca_receive();
+		long hops = *(long*)msg->data;
+		ca_release_msg(msg);
+		if(hops == 0) {
+			// Done: the end token goes round once more to stop everyone
+			clock_gettime(CLOCK_MONOTONIC, &end_time);
+			hops = -1;
+			ca_send(next, BENCH_MSG_TYPE_DATA, &hops, sizeof(hops));
+			break;
+		}
+		if(hops > 0) {
+			hops--;
+		}
+		ca_send(next, BENCH_MSG_TYPE_DATA, &hops, sizeof(hops));
+		if(hops < 0) {
+			break;
+		}
+	}
+	return 0;
+}
+
+void bench_ring(int argc, char **argv) {
+	if(argc > 0) {
+		ring_size = atoi(argv[0]) > 1 ? atoi(argv[0]) : 2;
+	}
+	if(argc > 1) {
+		ring_laps = atol(argv[1]) > 0 ? atol(argv[1]) : 1;
+	}
+	use_workers(argc, argv, 2);
+	ca_actor_id_t* ring = (ca_actor_id_t*)malloc(ring_size * sizeof(ca_actor_id_t));
+	int i;
+	for(i = 0; i < ring_size; i++) {
+		ring[i] = ACTOR_ID(ca_spawn(ringfn));
+	}
+	for(i = 0; i < ring_size; i++) {
+		ca_send(ring[i], BENCH_MSG_TYPE_NEXT, &ring[(i + 1) % ring_size], sizeof(ca_actor_id_t));
+	}
+	long hops = (long)ring_size * ring_laps;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	ca_send(ring[0], BENCH_MSG_TYPE_DATA, &hops, sizeof(hops));
+	ca_join();
+	free(ring);
+
+	double secs = elapsed(&start_time, &end_time);
+	printf("ring sched=%s actors=%d laps=%ld hops=%ld secs=%.3f hops_per_sec=%.0f ns_per_hop=%.0f\n",
+		sched_name(), ring_size, ring_laps, hops, secs, hops / secs, secs * 1e9 / hops);
+}
+
+// ---------------------------------------------------------
+// Handler ring
+// ---------------------------------------------------------
+
+int handler_ring_size = 100000;
+
+typedef struct {
+	ca_actor_id_t next;
+} handler_state_t;
+
+int ringhandler(void* state, ca_msg_t* msg) {
+	handler_state_t* self = (handler_state_t*)state;
+	if(msg->type == BENCH_MSG_TYPE_NEXT) {
+		self->next = *(ca_actor_id_t*)msg->data;
+		return 0;
+	}
+	long hops = *(long*)msg->data;
+	if(hops == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		hops = -1;
+	}
+	else if(hops > 0) {
+		hops--;
+	}
+	ca_send(self->next, BENCH_MSG_TYPE_DATA, &hops, sizeof(hops));
+	// Non-zero: this handler is done
+	return hops < 0;
+}
+
+long resident_bytes() {
+	long size = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if(statm != 0) {
+		if(fscanf(statm, "%ld %ld", &size, &resident) != 2) {
+			resident = 0;
+		}
+		fclose(statm);
+	}
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+void bench_handlers(int argc, char **argv) {
+	long laps = 10;
+	if(argc > 0) {
+		handler_ring_size = atoi(argv[0]) > 1 ? atoi(argv[0]) : 2;
+	}
+	if(argc > 1) {
+		laps = atol(argv[1]) > 0 ? atol(argv[1]) : 1;
+	}
+	use_workers(argc, argv, 2);
+	handler_state_t* states = (handler_state_t*)calloc(handler_ring_size, sizeof(handler_state_t));
+	ca_actor_id_t* ring = (ca_actor_id_t*)malloc(handler_ring_size * sizeof(ca_actor_id_t));
+	long rss_before = resident_bytes();
+	struct timespec spawn_start;
+	clock_gettime(CLOCK_MONOTONIC, &spawn_start);
+	int i;
+	for(i = 0; i < handler_ring_size; i++) {
+		ring[i] = ACTOR_ID(ca_spawn_handler(ringhandler, &states[i]));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	double spawn_secs = elapsed(&spawn_start, &start_time);
+	long rss_after = resident_bytes();
+	for(i = 0; i < handler_ring_size; i++) {
+		ca_send(ring[i], BENCH_MSG_TYPE_NEXT, &ring[(i + 1) % handler_ring_size], sizeof(ca_actor_id_t));
+	}
+	long hops = (long)handler_ring_size * laps;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	ca_send(ring[0], BENCH_MSG_TYPE_DATA, &hops, sizeof(hops));
+	ca_join();
+	free(ring);
+	free(states);
+
+	double secs = elapsed(&start_time, &end_time);
+	printf("handlers sched=%s actors=%d spawn_secs=%.3f bytes_per_actor=%.0f laps=%ld hops=%ld secs=%.3f hops_per_sec=%.0f ns_per_hop=%.0f\n",
+		sched_name(), handler_ring_size, spawn_secs, (double)(rss_after - rss_before) / handler_ring_size,
+		laps, hops, secs, hops / secs, secs * 1e9 / hops);
+}
+
+// ---------------------------------------------------------
+// Payload sizes
+// ---------------------------------------------------------
+
+#define BENCH_PAYLOAD_BUDGET	(1L << 30)	// Bytes per run, at most
+
+long num_payloads = 100000;
+size_t max_payload = 1 << 20;
+size_t payload_size;
+long payload_msgs;
+
+void* payloadreceiverfn(void* args) {
+	long i;
+	for(i = 0; i < payload_msgs; i++) {
+		ca_release_msg(ca_receive());
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	return 0;
+}
+
+void* payloadsenderfn(void* args) {
+	ca_actor_id_t receiver = ACTOR_ID(ca_spawn(payloadreceiverfn));
+	void* payload = malloc(payload_size);
+	memset(payload, 1, payload_size);
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	long i;
+	for(i = 0; i < payload_msgs; i++) {
+		ca_send(receiver, BENCH_MSG_TYPE_DATA, payload, payload_size);
+	}
+	free(payload);
+	return 0;
+}
+
+void bench_payload(int argc, char **argv) {
+	if(argc > 0) {
+		num_payloads = atol(argv[0]) > 0 ? atol(argv[0]) : 1;
+	}
+	if(argc > 1) {
+		max_payload = (size_t)atol(argv[1]);
+	}
+	for(payload_size = 64; payload_size <= max_payload; payload_size *= 4) {
+		payload_msgs = num_payloads;
+		if(payload_msgs * (long)payload_size > BENCH_PAYLOAD_BUDGET) {
+			payload_msgs = BENCH_PAYLOAD_BUDGET / payload_size;
+		}
+		(void)ca_spawn(payloadsenderfn);
+		ca_join();
+		double secs = elapsed(&start_time, &end_time);
+		printf("payload bytes=%lu msgs=%ld secs=%.3f msgs_per_sec=%.0f mb_per_sec=%.0f\n",
+			(unsigned long)payload_size, payload_msgs, secs, payload_msgs / secs,
+			payload_msgs * (double)payload_size / secs / 1e6);
+	}
+}
+
+// ---------------------------------------------------------
+// Priority lanes
+// ---------------------------------------------------------
+
+#define BENCH_MSG_TYPE_CONTROL	2
+#define BENCH_MSG_TYPE_DONE		3
+
+long prio_backlog = 10000;
+long prio_controls = 100;
+long prio_work = 200;
+int prio_mode = 0;
+
+ca_actor_id_t prio_consumer_id;
+double* prio_latencies;
+
+void* prioconsumerfn(void* args) {
+	volatile long spin;
+	for(;;) {
+		ca_msg_t* msg = ca_receive();
+		if(msg->type == BENCH_MSG_TYPE_CONTROL) {
+			double latency = now_us() - *(double*)msg->data;
+			ca_reply(msg, BENCH_MSG_TYPE_CONTROL, &latency, sizeof(latency));
+		}
+		else if(msg->type == BENCH_MSG_TYPE_DATA) {
+			for(spin = 0; spin < prio_work; spin++) {
+			}
+		}
+		else {
+			ca_release_msg(msg);
+			break;
+		}
+		ca_release_msg(msg);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	return 0;
+}
+
+void* priofeederfn(void* args) {
+	ca_batch_msg_t* batch = (ca_batch_msg_t*)malloc(CA_MSG_BATCH * sizeof(ca_batch_msg_t));
+	long i, j;
+	for(j = 0; j < CA_MSG_BATCH; j++) {
+		batch[j].type = BENCH_MSG_TYPE_DATA;
+		batch[j].data = 0;
+		batch[j].data_size = 0;
+	}
+	for(i = 0; i < prio_controls; i++) {
+		for(j = 0; j < prio_backlog; j += CA_MSG_BATCH) {
+			ca_send_batch(prio_consumer_id, batch, prio_backlog - j < CA_MSG_BATCH ? (int)(prio_backlog - j) : CA_MSG_BATCH);
+		}
+		double sent = now_us();
+		ca_send_prio(prio_consumer_id, prio_mode ? CA_PRIO_HIGH : CA_PRIO_NORMAL, BENCH_MSG_TYPE_CONTROL, &sent, sizeof(sent));
+		ca_msg_t* msg = ca_receive();
+		prio_latencies[i] = *(double*)msg->data;
+		ca_release_msg(msg);
+	}
+	ca_send(prio_consumer_id, BENCH_MSG_TYPE_DONE, 0, 0);
+	free(batch);
+	return 0;
+}
+
+void run_prio(int mode) {
+	prio_mode = mode;
+	prio_consumer_id = ACTOR_ID(ca_spawn(prioconsumerfn));
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	(void)ca_spawn(priofeederfn);
+	ca_join();
+
+	double secs = elapsed(&start_time, &end_time);
+	qsort(prio_latencies, prio_controls, sizeof(double), compare_doubles);
+	printf("prio send=%s backlog=%ld controls=%ld work=%ld secs=%.3f control_p50_us=%.1f control_p99_us=%.1f\n",
+		mode ? "prio" : "normal", prio_backlog, prio_controls, prio_work, secs,
+		prio_latencies[prio_controls / 2], prio_latencies[prio_controls * 99 / 100]);
+}
+
+void bench_prio(int argc, char **argv) {
+	if(argc > 0) {
+		prio_backlog = atol(argv[0]);
+	}
+	if(argc > 1) {
+		prio_controls = atol(argv[1]) > 0 ? atol(argv[1]) : 1;
+	}
+	if(argc > 2) {
+		prio_work = atol(argv[2]);
+	}
+	prio_latencies = (double*)malloc(prio_controls * sizeof(double));
+	run_prio(0);
+	run_prio(1);
+	free(prio_latencies);
+}
+
+// ---------------------------------------------------------
+// Tracing overhead
+// ---------------------------------------------------------
+
+void bench_trace(int argc, char **argv) {
+	if(argc > 0) {
+		num_batched = atol(argv[0]);
+	}
+	use_workers(argc, argv, 1);
+	double secs[2];
+	int on;
+	for(on = 0; on < 2; on++) {
+		ca_trace_enable(on);
+		batch_mode = 0;
+		batch_consumer_id = ACTOR_ID(ca_spawn(batchconsumerfn));
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		(void)ca_spawn(batchproducerfn);
+		ca_join();
+		ca_trace_enable(0);
+		secs[on] = elapsed(&start_time, &end_time);
+		printf("trace tracing=%s sched=%s msgs=%ld secs=%.3f msgs_per_sec=%.0f\n",
+			on ? "on" : "off", sched_name(), num_batched, secs[on], num_batched / secs[on]);
+	}
+	FILE* out = fopen(argc > 2 ? argv[2] : "/dev/null", "w");
+	int events = -1;
+	if(out != 0) {
+		events = ca_trace_dump(out);
+		fclose(out);
+	}
+	printf("trace overhead_ns_per_msg=%.1f dumped_events=%d\n",
+		(secs[1] - secs[0]) * 1e9 / num_batched, events);
+}
+
+// ---------------------------------------------------------
+// Pool
+// ---------------------------------------------------------
+
+int pool_members = 4;
+long pool_msgs = 4000;
+long pool_work = 2000;
+long pool_window = 16;
+int pool_policy;
+ca_actor_id_t pool_slow_id;
+long pool_slow_msgs;
+double* pool_latencies;
+
+struct pool_job {
+	long index;
+	double sent;
+};
+
+void* poolmemberfn(void* args) {
+	for(;;) {
+		ca_msg_t* msg = ca_receive();
+		if(msg->type == CA_MSG_TYPE_STOP) {
+			ca_release_msg(msg);
+			break;
+		}
+		// Whoever gets the first message is the slow one
+		if(pool_slow_id == CA_INVALID_ACTOR_ID) {
+			(void)__sync_bool_compare_and_swap(&pool_slow_id, CA_INVALID_ACTOR_ID, msg->dest_id);
+		}
+		unsigned long acc = 0;
+		long i;
+		for(i = 0; i < pool_work; i++) {
+			acc = acc * 31 + i;
+		}
+		work_sink = acc;
+		if(msg->dest_id == pool_slow_id) {
+			// Waits on something else every time, a disk say, for
+			// 1ms: messages coming in cut naps short
+			double until = now_us() + 1000;
+			pool_slow_msgs++;
+			while(now_us() < until) {
+				ca_sleep(1);
+			}
+		}
+		struct pool_job* job = (struct pool_job*)msg->data;
+		pool_latencies[job->index] = now_us() - job->sent;
+		ca_reply(msg, BENCH_MSG_TYPE_DATA, 0, 0);
+		ca_release_msg(msg);
+	}
+	return 0;
+}
+
+// Keeps 'pool_window' messages in flight: a new one for every reply
+void* poolfeederfn(void* args) {
+	ca_actor_id_t pool = ca_spawn_pool(poolmemberfn, pool_members, pool_policy);
+	struct pool_job job;
+	long i;
+	for(i = 0; i < pool_msgs; i++) {
+		if(i >= pool_window) {
+			ca_release_msg(ca_receive());
+		}
+		job.index = i;
+		job.sent = now_us();
+		ca_send_key(pool, i, BENCH_MSG_TYPE_DATA, &job, sizeof(job));
+	}
+	for(i = 0; i < pool_msgs && i < pool_window; i++) {
+		ca_release_msg(ca_receive());
+	}
+	// Members stop once done with what they have
+	ca_pool_resize(pool, 0);
+	return 0;
+}
+
+void run_pool(int policy) {
+	static const char* names[] = { "round_robin", "least_depth", "hash" };
+	pool_policy = policy;
+	pool_slow_id = CA_INVALID_ACTOR_ID;
+	pool_slow_msgs = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	(void)ca_spawn(poolfeederfn);
+	ca_join();
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	double secs = elapsed(&start_time, &end_time);
+	qsort(pool_latencies, pool_msgs, sizeof(double), compare_doubles);
+	printf("pool policy=%s sched=%s members=%d msgs=%ld work=%ld secs=%.3f msgs_per_sec=%.0f slow_share=%.3f p50_us=%.1f p99_us=%.1f max_us=%.1f\n",
+		names[policy], sched_name(), pool_members, pool_msgs, pool_work, secs, pool_msgs / secs,
+		(double)pool_slow_msgs / pool_msgs,
+		percentile(pool_latencies, pool_msgs, 0.5), percentile(pool_latencies, pool_msgs, 0.99),
+		pool_latencies[pool_msgs - 1]);
+}
+
+void bench_pool(int argc, char **argv) {
+	if(argc > 0) {
+		pool_members = atoi(argv[0]) > 0 ? atoi(argv[0]) : 1;
+	}
+	if(argc > 1) {
+		pool_msgs = atol(argv[1]) > 0 ? atol(argv[1]) : 1;
+	}
+	if(argc > 2) {
+		pool_work = atol(argv[2]);
+	}
+	use_workers(argc, argv, 3);
+	pool_window = 4 * pool_members;
+	pool_latencies = (double*)malloc(pool_msgs * sizeof(double));
+	run_pool(CA_POOL_ROUND_ROBIN);
+	run_pool(CA_POOL_LEAST_DEPTH);
+	run_pool(CA_POOL_HASH);
+	free(pool_latencies);
+}
+
+// ---------------------------------------------------------
+// Calls
+// ---------------------------------------------------------
+
+#define BENCH_CALL_SEND_RECEIVE	0
+#define BENCH_CALL_CALL			1
+#define BENCH_CALL_SEND_MATCH	2
+#define BENCH_CALL_ASYNC		3
+
+long num_calls = 50000;
+long calls_in_flight = 256;
+int call_servers = 4;
+int call_mode;
+
+// Reply to call number *arg (echoed by pongfn)
+int match_call_index(ca_msg_t* msg, void* arg) {
+	return *(long*)msg->data == *(long*)arg;
+}
+
+void* callerfn(void* args) {
+	ca_actor_id_t pool = ca_spawn_pool(pongfn, call_servers, CA_POOL_ROUND_ROBIN);
+	ca_future_t* futures = (ca_future_t*)malloc(calls_in_flight * sizeof(ca_future_t));
+	long window = call_mode == BENCH_CALL_SEND_MATCH || call_mode == BENCH_CALL_ASYNC ? calls_in_flight : 1;
+	long i;
+	long oldest;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	for(i = 0; i < num_calls + window; i++) {
+		oldest = i - window;
+		if(oldest >= 0) {
+			// Its reply, whatever came before
+			if(call_mode == BENCH_CALL_ASYNC) {
+				ca_release_msg(ca_future_wait(futures[oldest % window], -1));
+			}
+			else if(call_mode == BENCH_CALL_SEND_MATCH) {
+				ca_release_msg(ca_receive_match_fn(&match_call_index, &oldest, -1));
+			}
+			else if(call_mode == BENCH_CALL_SEND_RECEIVE) {
+				ca_release_msg(ca_receive());
+			}
+		}
+		if(i >= num_calls) {
+			continue;
+		}
+		if(call_mode == BENCH_CALL_ASYNC) {
+			futures[i % window] = ca_call_async(pool, BENCH_MSG_TYPE_DATA, &i, sizeof(i));
+		}
+		else if(call_mode == BENCH_CALL_CALL) {
+			ca_release_msg(ca_call(pool, BENCH_MSG_TYPE_DATA, &i, sizeof(i), -1));
+		}
+		else {
+			ca_send(pool, BENCH_MSG_TYPE_DATA, &i, sizeof(i));
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	ca_pool_resize(pool, 0);
+	free(futures);
+	return 0;
+}
+
+void run_call(int mode) {
+	static const char* names[] = { "send_receive", "call", "send_match", "call_async" };
+	call_mode = mode;
+	(void)ca_spawn(callerfn);
+	ca_join();
+	double secs = elapsed(&start_time, &end_time);
+	printf("call mode=%s sched=%s servers=%d calls=%ld in_flight=%ld secs=%.3f calls_per_sec=%.0f\n",
+		names[mode], sched_name(), call_servers, num_calls,
+		mode == BENCH_CALL_SEND_MATCH || mode == BENCH_CALL_ASYNC ? calls_in_flight : 1,
+		secs, num_calls / secs);
+}
+
+void bench_call(int argc, char **argv) {
+	if(argc > 0) {
+		num_calls = atol(argv[0]) > 0 ? atol(argv[0]) : 1;
+	}
+	if(argc > 1) {
+		calls_in_flight = atol(argv[1]) > 0 ? atol(argv[1]) : 1;
+	}
+	if(argc > 2) {
+		call_servers = atoi(argv[2]) > 0 ? atoi(argv[2]) : 1;
+	}
+	use_workers(argc, argv, 3);
+	run_call(BENCH_CALL_SEND_RECEIVE);
+	run_call(BENCH_CALL_CALL);
+	run_call(BENCH_CALL_SEND_MATCH);
+	run_call(BENCH_CALL_ASYNC);
+}
+
+// ---------------------------------------------------------
+// Nodes: two processes
+// ---------------------------------------------------------
+
+#define BENCH_NODE_SEGMENT		"/cactor_bench_node"
+#define BENCH_MSG_TYPE_PING		2
+#define BENCH_MSG_TYPE_SYNC		3
+#define BENCH_MSG_TYPE_QUIT		4
+
+long node_msgs = 100000;
+long node_bytes = 64;
+double node_secs;
+double* node_round_trips;
+
+void* nodeechofn(void* args) {
+	long received = 0;
+	for(;;) {
+		ca_msg_t* msg = ca_receive();
+		unsigned long type = msg->type;
+		if(type == BENCH_MSG_TYPE_DATA) {
+			received++;
+		}
+		else if(type == BENCH_MSG_TYPE_PING) {
+			ca_reply(msg, BENCH_MSG_TYPE_PING, msg->data, msg->data_size);
+		}
+		else if(type == BENCH_MSG_TYPE_SYNC) {
+			ca_reply(msg, BENCH_MSG_TYPE_SYNC, &received, sizeof(received));
+		}
+		ca_release_msg(msg);
+		if(type == BENCH_MSG_TYPE_QUIT) {
+			break;
+		}
+	}
+	return 0;
+}
+
+void* nodeclientfn(void* args) {
+	ca_actor_id_t echo = ca_node_lookup(2, 5000);
+	if(echo == CA_INVALID_ACTOR_ID) {
+		fprintf(stderr, "node: no echo actor on node 2\n");
+		return 0;
+	}
+	char* payload = (char*)calloc(1, node_bytes);
+	struct timespec sent, received;
+	long i;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	for(i = 0; i < node_msgs; i++) {
+		ca_send(echo, BENCH_MSG_TYPE_DATA, payload, node_bytes);
+	}
+	ca_send(echo, BENCH_MSG_TYPE_SYNC, 0, 0);
+	ca_msg_t* msg = ca_receive();
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	if(*(long*)msg->data != node_msgs) {
+		fprintf(stderr, "node: %ld of %ld messages got through\n", *(long*)msg->data, node_msgs);
+	}
+	ca_release_msg(msg);
+	node_secs = elapsed(&start_time, &end_time);
+	for(i = 0; i < node_msgs; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &sent);
+		ca_send(echo, BENCH_MSG_TYPE_PING, payload, node_bytes);
+		ca_release_msg(ca_receive());
+		clock_gettime(CLOCK_MONOTONIC, &received);
+		node_round_trips[i] = elapsed(&sent, &received) * 1e9;
+	}
+	ca_send(echo, BENCH_MSG_TYPE_QUIT, 0, 0);
+	free(payload);
+	return 0;
+}
+
+int read_full(int fd, char* buf, long size) {
+	while(size > 0) {
+		ssize_t done = read(fd, buf, size);
+		if(done <= 0) {
+			return -1;
+		}
+		buf += done;
+		size -= done;
+	}
+	return 0;
+}
+
+int write_full(int fd, const char* buf, long size) {
+	while(size > 0) {
+		ssize_t done = write(fd, buf, size);
+		if(done <= 0) {
+			return -1;
+		}
+		buf += done;
+		size -= done;
+	}
+	return 0;
+}
+
+// The same traffic as a socketpair's two ends: the child reads
+// 'node_msgs' records, acknowledges them, then echoes records back
+void run_node_socket() {
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		perror("socketpair");
+		return;
+	}
+	char* buf = (char*)calloc(1, node_bytes > 0 ? node_bytes : 1);
+	long record = node_bytes > 0 ? node_bytes : 1;
+	long i;
+	pid_t pid = fork();
+	if(pid == 0) {
+		close(fds[0]);
+		for(i = 0; i < node_msgs; i++) {
+			(void)read_full(fds[1], buf, record);
+		}
+		(void)write_full(fds[1], buf, 1);
+		for(i = 0; i < node_msgs; i++) {
+			if(read_full(fds[1], buf, record) != 0 || write_full(fds[1], buf, record) != 0) {
+				break;
+			}
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	struct timespec sent, received;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	for(i = 0; i < node_msgs; i++) {
+		(void)write_full(fds[0], buf, record);
+	}
+	(void)read_full(fds[0], buf, 1);
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	node_secs = elapsed(&start_time, &end_time);
+	for(i = 0; i < node_msgs; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &sent);
+		(void)write_full(fds[0], buf, record);
+		(void)read_full(fds[0], buf, record);
+		clock_gettime(CLOCK_MONOTONIC, &received);
+		node_round_trips[i] = elapsed(&sent, &received) * 1e9;
+	}
+	close(fds[0]);
+	waitpid(pid, 0, 0);
+	free(buf);
+}
+
+void print_node(const char* transport) {
+	qsort(node_round_trips, node_msgs, sizeof(double), compare_doubles);
+	printf("node transport=%s msgs=%ld bytes=%ld secs=%.3f msgs_per_sec=%.0f p50_ns=%.0f p99_ns=%.0f p999_ns=%.0f\n",
+		transport, node_msgs, node_bytes, node_secs, node_msgs / node_secs,
+		percentile(node_round_trips, node_msgs, 0.5), percentile(node_round_trips, node_msgs, 0.99),
+		percentile(node_round_trips, node_msgs, 0.999));
+}
+
+void bench_node(int argc, char **argv) {
+	if(argc > 0) {
+		node_msgs = atol(argv[0]) > 0 ? atol(argv[0]) : 1;
+	}
+	if(argc > 1) {
+		node_bytes = atol(argv[1]) < 0 ? 0 : atol(argv[1]) > CA_NODE_MSG_SIZE ? CA_NODE_MSG_SIZE : atol(argv[1]);
+	}
+	node_round_trips = (double*)malloc(node_msgs * sizeof(double));
+	node_secs = 0;
+	// Left over by a run that did not get to the end
+	shm_unlink(BENCH_NODE_SEGMENT);
+	pid_t pid = fork();
+	if(pid == 0) {
+		if(ca_node_join(BENCH_NODE_SEGMENT, 2) != 0) {
+			_exit(1);
+		}
+		(void)ca_node_publish(ACTOR_ID(ca_spawn(nodeechofn)));
+		ca_join();
+		ca_node_leave();
+		_exit(0);
+	}
+	int error = ca_node_join(BENCH_NODE_SEGMENT, 1);
+	if(error != 0) {
+		fprintf(stderr, "node: ca_node_join: %s\n", strerror(error));
+		kill(pid, SIGTERM);
+	}
+	else {
+		(void)ca_spawn(nodeclientfn);
+		ca_join();
+		ca_node_leave();
+		if(node_secs == 0) {
+			kill(pid, SIGTERM);
+		}
+	}
+	waitpid(pid, 0, 0);
+	shm_unlink(BENCH_NODE_SEGMENT);
+	if(node_secs > 0) {
+		print_node("shm");
+	}
+	run_node_socket();
+	print_node("socketpair");
+	free(node_round_trips);
+}
+
+// ---------------------------------------------------------
+// All of the above, with thread actors: ca_set_scheduler() only
+// works before the first spawn
+// ---------------------------------------------------------
+
+void bench_all() {
+	bench_fanin(0, 0);
+	bench_fanout(0, 0);
+	bench_pingpong(0, 0);
+	bench_ring(0, 0);
+	bench_handlers(0, 0);
+	bench_spawn(0, 0);
+	bench_payload(0, 0);
+	bench_pipeline(0, 0);
+	bench_broadcast(0, 0);
+	bench_batch(0, 0);
+	bench_timers(0, 0);
+	bench_prio(0, 0);
+	bench_trace(0, 0);
+	bench_pool(0, 0);
+	bench_call(0, 0);
+}
+
+int main(int argc, char **argv) {
+	if(argc > 1 && strcmp(argv[1], "all") == 0) {
+		bench_all();
+	}
+	else if(argc > 1 && strcmp(argv[1], "skewed") == 0) {
+		bench_skewed(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "fanin") == 0) {
+		bench_fanin(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "pipeline") == 0) {
+		bench_pipeline(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "broadcast") == 0) {
+		bench_broadcast(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "batch") == 0) {
+		bench_batch(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "timers") == 0) {
+		bench_timers(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "spawn") == 0) {
+		bench_spawn(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "prio") == 0) {
+		bench_prio(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "fanout") == 0) {
+		bench_fanout(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "pingpong") == 0) {
+		bench_pingpong(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "ring") == 0) {
+		bench_ring(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "handlers") == 0) {
+		bench_handlers(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "payload") == 0) {
+		bench_payload(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "trace") == 0) {
+		bench_trace(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "pool") == 0) {
+		bench_pool(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "call") == 0) {
+		bench_call(argc - 2, argv + 2);
+	}
+	else if(argc > 1 && strcmp(argv[1], "node") == 0) {
+		bench_node(argc - 2, argv + 2);
+	}
+	else {
+		fprintf(stderr, "usage: %s all|fanin|fanout|pingpong|ring|handlers|spawn|payload|skewed|pipeline|broadcast|batch|timers|prio|trace|pool|call|node [args...]\n", argv[0]);
+		return 1;
+	}
+	return 0;
+}
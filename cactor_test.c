@@ -20,12 +20,56 @@
  * limitations under that License.
  */
 
+// For CPU affinity
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "cactor.h"
 
 #define SAMPLE_MSG_TYPE_HELLO	1
 #define SAMPLE_MSG_TYPE_REPLY	2
 #define NUM_MSGS				1500
 
+#define TEST_MSG_TYPE_ADD		3
+#define TEST_MSG_TYPE_SILENT	4
+#define TEST_MSG_TYPE_QUIT		5
+#define TEST_MSG_TYPE_KEY		6	// Then one per hash pool phase
+#define TEST_MSG_TYPE_DATA		8
+#define TEST_MSG_TYPE_CONTROL	9
+#define TEST_MSG_TYPE_OTHER		10
+#define TEST_POOL_KEYS			64
+#define TEST_NODE_SEGMENT		"/cactor_test"
+
+int failures = 0;
+
+void check(const char* what, int ok) {
+	printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+	if(!ok) {
+		failures++;
+	}
+}
+
+uint64_t now_ms() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// ca_sleep() all the way through: a message coming in cuts it short
+void nap(long milliseconds) {
+	uint64_t until = now_ms() + milliseconds;
+	uint64_t now;
+	while((now = now_ms()) < until) {
+		ca_sleep((long)(until - now));
+	}
+}
+
 void* pongfn(void* args) {
 	printf("Starting pong\n");
 
@@ -96,10 +140,917 @@ void* pingfn(void* args) {
 	return 0;
 }
 
+// ---------------------------------------------------------
+// Pools: round robin shares evenly, a key always goes to the
+// same member, and resizing retires members with a stop message.
+// ---------------------------------------------------------
+
+long rr_counts[4];
+int rr_reported = 0;
+ca_actor_id_t key_owners[2][TEST_POOL_KEYS];
+int key_moves = 0;
+
+void* pool_memberfn(void* args) {
+	long count = 0;
+	for(;;) {
+		ca_msg_t* msg = ca_receive();
+		if(msg->type == CA_MSG_TYPE_STOP) {
+			ca_release_msg(msg);
+			break;
+		}
+		if(msg->type >= TEST_MSG_TYPE_KEY) {
+			int phase = (int)(msg->type - TEST_MSG_TYPE_KEY);
+			long key = *(long*)msg->data;
+			ca_actor_id_t none = 0;
+			if(!__atomic_compare_exchange_n(&key_owners[phase][key], &none, msg->dest_id, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+					&& none != msg->dest_id) {
+				__atomic_add_fetch(&key_moves, 1, __ATOMIC_SEQ_CST);
+			}
+		}
+		count++;
+		ca_release_msg(msg);
+	}
+	rr_counts[__atomic_fetch_add(&rr_reported, 1, __ATOMIC_SEQ_CST) % 4] += count;
+	return 0;
+}
+
+void test_pools() {
+	ca_actor_id_t pool = ca_spawn_pool(pool_memberfn, 4, CA_POOL_ROUND_ROBIN);
+	long i;
+	for(i = 0; i < 400; i++) {
+		ca_send(pool, SAMPLE_MSG_TYPE_HELLO, 0, 0);
+	}
+	check("pool size", ca_pool_size(pool) == 4);
+	// Stopping them all retires the pool itself
+	check("pool resize to 0", ca_pool_resize(pool, 0) == 0 && ca_pool_size(pool) == -1);
+	ca_join();
+	check("pool round robin", rr_reported == 4 && rr_counts[0] == 100 && rr_counts[1] == 100
+		&& rr_counts[2] == 100 && rr_counts[3] == 100);
+
+	pool = ca_spawn_pool(pool_memberfn, 4, CA_POOL_HASH);
+	int phase, round;
+	for(phase = 0; phase < 2; phase++) {
+		if(phase == 1) {
+			check("pool resize to 2", ca_pool_resize(pool, 2) == 0 && ca_pool_size(pool) == 2);
+		}
+		for(round = 0; round < 2; round++) {
+			for(i = 0; i < TEST_POOL_KEYS; i++) {
+				ca_send_key(pool, (uint64_t)i, TEST_MSG_TYPE_KEY + phase, &i, sizeof(i));
+			}
+		}
+	}
+	(void)ca_pool_resize(pool, 0);
+	ca_join();
+	// Once down to 2, keys only go to the 2 members left
+	ca_actor_id_t left[2] = { 0, 0 };
+	int spread = 1;
+	for(i = 0; i < TEST_POOL_KEYS; i++) {
+		ca_actor_id_t owner = key_owners[1][i];
+		if(left[0] == 0 || left[0] == owner) {
+			left[0] = owner;
+		}
+		else if(left[1] == 0 || left[1] == owner) {
+			left[1] = owner;
+		}
+		else {
+			spread = 0;
+		}
+	}
+	check("pool hash keeps keys", key_moves == 0);
+	check("pool hash after resize", spread && left[1] != 0);
+}
+
+// ---------------------------------------------------------
+// Calls: the reply comes back to ca_call(), a late one is
+// dropped once the call timed out.
+// ---------------------------------------------------------
+
+long call_sum = 0;
+int call_timed_out = 0;
+int call_late_reply = 0;
+
+void* call_serverfn(void* args) {
+	for(;;) {
+		ca_msg_t* msg = ca_receive();
+		if(msg->type == TEST_MSG_TYPE_QUIT) {
+			ca_release_msg(msg);
+			break;
+		}
+		if(msg->type == TEST_MSG_TYPE_ADD) {
+			int value = *(int*)msg->data + 1;
+			ca_reply(msg, TEST_MSG_TYPE_ADD, &value, sizeof(value));
+		}
+		else if(msg->type == TEST_MSG_TYPE_SILENT) {
+			ca_sleep(50);
+			ca_reply(msg, TEST_MSG_TYPE_SILENT, 0, 0);
+		}
+		ca_release_msg(msg);
+	}
+	return 0;
+}
+
+void* call_clientfn(void* args) {
+	ca_actor_id_t server = ACTOR_ID(ca_spawn(call_serverfn));
+	int i;
+	for(i = 0; i < 100; i++) {
+		ca_msg_t* reply = ca_call(server, TEST_MSG_TYPE_ADD, &i, sizeof(i), -1);
+		if(reply != 0) {
+			call_sum += *(int*)reply->data;
+			ca_release_msg(reply);
+		}
+	}
+	call_timed_out = ca_call(server, TEST_MSG_TYPE_SILENT, 0, 0, 10) == 0;
+	ca_sleep(100);
+	ca_msg_t* late = ca_receive_timeout(0);
+	call_late_reply = late != 0;
+	if(late != 0) {
+		ca_release_msg(late);
+	}
+	ca_send(server, TEST_MSG_TYPE_QUIT, 0, 0);
+	return 0;
+}
+
+void test_calls() {
+	ca_spawn(call_clientfn);
+	ca_join();
+	check("call replies", call_sum == 100 * 101 / 2);
+	check("call timeout", call_timed_out);
+	check("call late reply dropped", !call_late_reply);
+}
+
+// ---------------------------------------------------------
+// Selective receive: messages skipped over come back later in
+// the order they were sent, whatever queue they were set
+// aside in.
+// ---------------------------------------------------------
+
+int select_found = 0;
+int select_in_order = 0;
+
+int select_fromfn(ca_msg_t* msg, void* arg) {
+	return msg->type == TEST_MSG_TYPE_OTHER && *(int*)msg->data >= *(int*)arg;
+}
+
+void* select_receiverfn(void* args) {
+	ca_msg_t* msg = ca_receive_match(CA_TYPE_BIT(TEST_MSG_TYPE_CONTROL), -1);
+	ca_release_msg(msg);
+	int from = 5;
+	msg = ca_receive_match_fn(&select_fromfn, &from, 0);
+	select_found = msg != 0 && *(int*)msg->data == 5;
+	if(msg != 0) {
+		ca_release_msg(msg);
+	}
+	// All the others, as sent: data and other in turn, but other #5
+	int i, ok = 1;
+	for(i = 0; i < 19; i++) {
+		int index = i < 11 ? i / 2 : (i + 1) / 2;
+		unsigned long type = i < 11 ? (i % 2 ? TEST_MSG_TYPE_OTHER : TEST_MSG_TYPE_DATA)
+			: (i % 2 ? TEST_MSG_TYPE_DATA : TEST_MSG_TYPE_OTHER);
+		msg = ca_receive_timeout(0);
+		if(msg == 0) {
+			ok = 0;
+			break;
+		}
+		ok = ok && msg->type == type && *(int*)msg->data == index;
+		ca_release_msg(msg);
+	}
+	select_in_order = ok && ca_receive_timeout(0) == 0;
+	return 0;
+}
+
+void test_selective_receive() {
+	ca_actor_id_t receiver = ACTOR_ID(ca_spawn(select_receiverfn));
+	int i;
+	for(i = 0; i < 10; i++) {
+		ca_send(receiver, TEST_MSG_TYPE_DATA, &i, sizeof(i));
+		ca_send(receiver, TEST_MSG_TYPE_OTHER, &i, sizeof(i));
+	}
+	ca_send(receiver, TEST_MSG_TYPE_CONTROL, 0, 0);
+	ca_join();
+	check("selective receive match", select_found);
+	check("selective receive keeps order", select_in_order);
+}
+
+// ---------------------------------------------------------
+// Priority lanes: a high priority message and a call's reply
+// both get past a full mailbox's backlog, which stays in order.
+// ---------------------------------------------------------
+
+int prio_first = 0;
+int prio_reply = 0;
+int prio_backlog = 0;
+
+void* prio_receiverfn(void* args) {
+	// Let the backlog build up
+	nap(100);
+	ca_msg_t* msg = ca_receive();
+	prio_first = msg->type == TEST_MSG_TYPE_CONTROL;
+	ca_release_msg(msg);
+	ca_actor_id_t server = ACTOR_ID(ca_spawn(call_serverfn));
+	int value = 1;
+	msg = ca_call(server, TEST_MSG_TYPE_ADD, &value, sizeof(value), 1000);
+	prio_reply = msg != 0 && *(int*)msg->data == 2;
+	if(msg != 0) {
+		ca_release_msg(msg);
+	}
+	ca_send(server, TEST_MSG_TYPE_QUIT, 0, 0);
+	int i, ok = 1;
+	for(i = 0; i < 100 && ok; i++) {
+		msg = ca_receive_timeout(0);
+		ok = msg != 0 && msg->type == TEST_MSG_TYPE_DATA && *(int*)msg->data == i;
+		if(msg != 0) {
+			ca_release_msg(msg);
+		}
+	}
+	prio_backlog = ok;
+	return 0;
+}
+
+void test_priority_lanes() {
+	ca_actor_id_t receiver = ACTOR_ID(ca_spawn_bounded(prio_receiverfn, 100, CA_OVERFLOW_FAIL, 0));
+	int i;
+	for(i = 0; i < 100; i++) {
+		ca_send(receiver, TEST_MSG_TYPE_DATA, &i, sizeof(i));
+	}
+	ca_send_prio(receiver, CA_PRIO_HIGH, TEST_MSG_TYPE_CONTROL, 0, 0);
+	int full = ca_try_send(receiver, TEST_MSG_TYPE_DATA, &i, sizeof(i)) == EAGAIN;
+	ca_join();
+	check("priority mailbox full", full);
+	check("priority lane first", prio_first);
+	check("priority reply lane past a full mailbox", prio_reply);
+	check("priority backlog in order", prio_backlog);
+}
+
+// ---------------------------------------------------------
+// Bounded mailboxes: FAIL refuses at once, BLOCK gives up after
+// its timeout, DROP_OLDEST keeps the newest messages, priority
+// ones aside. Receivers sleep while the mailbox fills up, then
+// note what they got: how many, first index, priority ones.
+// ---------------------------------------------------------
+
+struct bounded_result {
+	int count;
+	int first;
+	int prio;
+};
+struct bounded_result bounded_results[3];
+
+void* bounded_receiverfn(void* args) {
+	nap(200);
+	ca_msg_t* msg = ca_receive();
+	struct bounded_result* result = &bounded_results[*(int*)msg->data];
+	ca_release_msg(msg);
+	result->first = -1;
+	while((msg = ca_receive_timeout(0)) != 0) {
+		if(msg->type == TEST_MSG_TYPE_CONTROL) {
+			result->prio++;
+		}
+		else {
+			if(result->first < 0) {
+				result->first = *(int*)msg->data;
+			}
+			result->count++;
+		}
+		ca_release_msg(msg);
+	}
+	return 0;
+}
+
+// Spawn a receiver, bounded as told, and tell it which result is its
+ca_actor_id_t bounded_spawn(int which, long capacity, int policy, long timeout) {
+	ca_actor_id_t id = ACTOR_ID(ca_spawn_bounded(bounded_receiverfn, capacity, policy, timeout));
+	ca_send_prio(id, CA_PRIO_HIGH, TEST_MSG_TYPE_ADD, &which, sizeof(which));
+	return id;
+}
+
+void test_bounded_mailboxes() {
+	int i, sent = 0, refused = 0;
+	ca_actor_id_t id = bounded_spawn(0, 10, CA_OVERFLOW_FAIL, 0);
+	for(i = 0; i < 20; i++) {
+		int error = ca_try_send(id, TEST_MSG_TYPE_DATA, &i, sizeof(i));
+		sent += error == 0;
+		refused += error == EAGAIN;
+	}
+	// The HIGH message telling it its result counts too
+	check("bounded fail refuses", sent == 9 && refused == 11);
+
+	id = bounded_spawn(1, 5, CA_OVERFLOW_BLOCK, 50);
+	uint64_t start = now_ms();
+	for(i = 0; i < 5; i++) {
+		ca_send(id, TEST_MSG_TYPE_DATA, &i, sizeof(i));
+	}
+	check("bounded block times out", now_ms() - start >= 45);
+
+	id = bounded_spawn(2, 5, CA_OVERFLOW_DROP_OLDEST, 0);
+	for(i = 0; i < 3; i++) {
+		ca_send_prio(id, CA_PRIO_HIGH, TEST_MSG_TYPE_CONTROL, 0, 0);
+	}
+	for(i = 0; i < 20; i++) {
+		ca_send(id, TEST_MSG_TYPE_DATA, &i, sizeof(i));
+	}
+	ca_join();
+	check("bounded fail keeps", bounded_results[0].count == 9 && bounded_results[0].first == 0);
+	check("bounded block drops", bounded_results[1].count == 4 && bounded_results[1].first == 0);
+	check("bounded drop oldest keeps the newest", bounded_results[2].count == 5
+		&& bounded_results[2].first == 15 && bounded_results[2].prio == 3);
+}
+
+// ---------------------------------------------------------
+// Timeouts and timers: an empty mailbox gives nothing back at
+// once with a 0 timeout, or after the timeout; a delayed message
+// comes once its delay is over, a cancelled one never.
+// ---------------------------------------------------------
+
+int timer_empty = 0;
+int timer_waited = 0;
+int timer_delivered = 0;
+int timer_quiet = 0;
+
+void* timer_receiverfn(void* args) {
+	uint64_t start = now_ms();
+	timer_empty = ca_receive_timeout(0) == 0 && now_ms() - start < 20;
+	timer_waited = ca_receive_timeout(20) == 0 && now_ms() - start >= 15;
+	ca_msg_t* msg = ca_receive_timeout(1000);
+	timer_delivered = msg != 0 && msg->type == TEST_MSG_TYPE_DATA && now_ms() - start >= 90;
+	if(msg != 0) {
+		ca_release_msg(msg);
+	}
+	timer_quiet = ca_receive_timeout(200) == 0;
+	return 0;
+}
+
+void test_timers() {
+	ca_actor_id_t receiver = ACTOR_ID(ca_spawn(timer_receiverfn));
+	(void)ca_send_after(receiver, 100, TEST_MSG_TYPE_DATA, 0, 0);
+	ca_timer_id_t cancelled = ca_send_after(receiver, 100, TEST_MSG_TYPE_OTHER, 0, 0);
+	int stopped = cancelled != 0 && ca_cancel_timer(cancelled) == 1;
+	ca_join();
+	check("timeout 0 on empty mailbox", timer_empty);
+	check("timeout on empty mailbox", timer_waited);
+	check("timer delivers after its delay", timer_delivered);
+	check("cancelled timer never delivers", stopped && timer_quiet);
+}
+
+// ---------------------------------------------------------
+// Exits: a monitor gets the exit notice, even of an actor that
+// is gone already, and ca_wait_actor() returns once it is gone.
+// ---------------------------------------------------------
+
+int exit_done = 0;
+int exit_notice = 0;
+int exit_late_notice = 0;
+
+void* exit_workerfn(void* args) {
+	ca_msg_t* msg = ca_receive();
+	ca_release_msg(msg);
+	ca_sleep(50);
+	__atomic_store_n(&exit_done, 1, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+void* exit_watcherfn(void* args) {
+	ca_actor_id_t worker = ACTOR_ID(ca_spawn(exit_workerfn));
+	ca_monitor(worker);
+	ca_send(worker, TEST_MSG_TYPE_QUIT, 0, 0);
+	ca_msg_t* msg = ca_receive_timeout(1000);
+	exit_notice = msg != 0 && msg->type == CA_MSG_TYPE_EXIT && msg->src_id == worker;
+	if(msg != 0) {
+		ca_release_msg(msg);
+	}
+	ca_monitor(worker);
+	msg = ca_receive_timeout(1000);
+	exit_late_notice = msg != 0 && msg->type == CA_MSG_TYPE_EXIT && msg->src_id == worker;
+	if(msg != 0) {
+		ca_release_msg(msg);
+	}
+	return 0;
+}
+
+void test_exits() {
+	ca_actor_id_t worker = ACTOR_ID(ca_spawn(exit_workerfn));
+	ca_send(worker, TEST_MSG_TYPE_QUIT, 0, 0);
+	int waited = ca_wait_actor(worker) == 0 && __atomic_load_n(&exit_done, __ATOMIC_SEQ_CST);
+	check("wait for an actor to exit", waited);
+	check("wait for an actor gone already", ca_wait_actor(worker) == 0);
+	ca_spawn(exit_watcherfn);
+	ca_join();
+	check("monitor gets the exit notice", exit_notice);
+	check("monitor of an actor gone already", exit_late_notice);
+}
+
+// ---------------------------------------------------------
+// Broadcast: every recipient sees the same payload, takes a
+// private copy of it, and the shared block is freed once, when
+// the last one releases its message. Payloads are above the
+// mmap threshold, so mallinfo2() accounts for each of them.
+// ---------------------------------------------------------
+
+#define TEST_BROADCAST_ACTORS	4
+#define TEST_BROADCAST_SIZE	(256 * 1024)
+
+char broadcast_payload[TEST_BROADCAST_SIZE];
+int broadcast_copies = 0;
+
+void* broadcast_receiverfn(void* args) {
+	ca_msg_t* msg = ca_receive();
+	// Hold on to it until told to go
+	ca_msg_t* go = ca_receive();
+	ca_release_msg(go);
+	ca_release_fn_t release;
+	char* copy = ca_take_data(msg, &release);
+	int ok = copy != 0 && copy != (char*)msg->data && release == 0 && memcmp(copy, broadcast_payload, TEST_BROADCAST_SIZE) == 0;
+	if(copy != 0) {
+		memset(copy, 'x', TEST_BROADCAST_SIZE);
+		ok = ok && memcmp(msg->data, broadcast_payload, TEST_BROADCAST_SIZE) == 0;
+		free(copy);
+	}
+	__atomic_add_fetch(&broadcast_copies, ok, __ATOMIC_SEQ_CST);
+	ca_release_msg(msg);
+	return 0;
+}
+
+void test_broadcast() {
+	ca_actor_id_t ids[TEST_BROADCAST_ACTORS];
+	int i;
+	for(i = 0; i < TEST_BROADCAST_ACTORS; i++) {
+		ids[i] = ACTOR_ID(ca_spawn(broadcast_receiverfn));
+	}
+	mallopt(M_MMAP_THRESHOLD, 64 * 1024);
+	memset(broadcast_payload, 'b', TEST_BROADCAST_SIZE);
+	size_t before = mallinfo2().hblkhd;
+	int delivered = ca_broadcast_group(ids, TEST_BROADCAST_ACTORS, TEST_MSG_TYPE_DATA, broadcast_payload, TEST_BROADCAST_SIZE);
+	size_t during = mallinfo2().hblkhd;
+	for(i = 0; i < TEST_BROADCAST_ACTORS; i++) {
+		ca_send(ids[i], TEST_MSG_TYPE_CONTROL, 0, 0);
+	}
+	ca_join();
+	size_t after = mallinfo2().hblkhd;
+	check("broadcast reaches the group", delivered == TEST_BROADCAST_ACTORS);
+	check("broadcast payload is copied once", during - before >= TEST_BROADCAST_SIZE && during - before < 2 * TEST_BROADCAST_SIZE);
+	check("ca_take_data on a broadcast is a private copy", broadcast_copies == TEST_BROADCAST_ACTORS);
+	check("broadcast payload is released", after == before);
+}
+
+// ---------------------------------------------------------
+// Batches: a batch is queued at once, and ca_receive_many()
+// takes it up to max at a time, in the order it was sent.
+// ---------------------------------------------------------
+
+#define TEST_BATCH_SIZE		10
+#define TEST_BATCH_MAX		4
+
+int batch_counts[4];
+int batch_values[TEST_BATCH_SIZE];
+
+void* batch_receiverfn(void* args) {
+	ca_msg_t* out[TEST_BATCH_MAX];
+	int received = 0;
+	int round;
+	for(round = 0; round < 4; round++) {
+		int count = ca_receive_many(out, TEST_BATCH_MAX, round < 3 ? 1000 : 0);
+		int i;
+		for(i = 0; i < count; i++) {
+			if(received < TEST_BATCH_SIZE) {
+				batch_values[received++] = *(int*)out[i]->data;
+			}
+			ca_release_msg(out[i]);
+		}
+		batch_counts[round] = count;
+	}
+	return 0;
+}
+
+void test_batches() {
+	ca_batch_msg_t msgs[TEST_BATCH_SIZE];
+	int values[TEST_BATCH_SIZE];
+	int i;
+	for(i = 0; i < TEST_BATCH_SIZE; i++) {
+		values[i] = i;
+		msgs[i].type = TEST_MSG_TYPE_DATA;
+		msgs[i].data = &values[i];
+		msgs[i].data_size = sizeof(values[i]);
+	}
+	ca_actor_id_t receiver = ACTOR_ID(ca_spawn(batch_receiverfn));
+	int sent = ca_send_batch(receiver, msgs, TEST_BATCH_SIZE);
+	ca_join();
+	check("ca_send_batch sends them all", sent == TEST_BATCH_SIZE);
+	check("ca_receive_many takes up to max", batch_counts[0] == TEST_BATCH_MAX && batch_counts[1] == TEST_BATCH_MAX && batch_counts[2] == TEST_BATCH_SIZE - 2 * TEST_BATCH_MAX);
+	check("ca_receive_many returns 0 on an empty mailbox", batch_counts[3] == 0);
+	int ordered = 1;
+	for(i = 0; i < TEST_BATCH_SIZE; i++) {
+		ordered = ordered && batch_values[i] == i;
+	}
+	check("batch arrives in order", ordered);
+	check("ca_send_batch to nobody", ca_send_batch(receiver, msgs, TEST_BATCH_SIZE) == 0);
+}
+
+// ---------------------------------------------------------
+// Stats: one actor sends a known number of messages to another;
+// their own counters and the runtime-wide totals match it.
+// ---------------------------------------------------------
+
+#define TEST_STATS_MSGS		25
+
+ca_actor_id_t stats_sink = CA_INVALID_ACTOR_ID;
+int stats_received = 0;
+
+void* stats_sinkfn(void* args) {
+	int i;
+	for(i = 0; i < TEST_STATS_MSGS; i++) {
+		ca_release_msg(ca_receive());
+	}
+	__atomic_store_n(&stats_received, 1, __ATOMIC_SEQ_CST);
+	ca_release_msg(ca_receive());
+	return 0;
+}
+
+void* stats_sourcefn(void* args) {
+	int i;
+	for(i = 0; i < TEST_STATS_MSGS; i++) {
+		ca_send(stats_sink, TEST_MSG_TYPE_DATA, &i, sizeof(i));
+	}
+	ca_release_msg(ca_receive());
+	return 0;
+}
+
+void test_stats() {
+	ca_stats_t before, during, after;
+	ca_actor_stats_t sink_stats, source_stats;
+	ca_stats_get(&before);
+	stats_sink = ACTOR_ID(ca_spawn(stats_sinkfn));
+	ca_actor_id_t source = ACTOR_ID(ca_spawn(stats_sourcefn));
+	while(!__atomic_load_n(&stats_received, __ATOMIC_SEQ_CST)) {
+		usleep(1000);
+	}
+	ca_stats_get(&during);
+	int found = ca_actor_stats_get(stats_sink, &sink_stats) == 0 && ca_actor_stats_get(source, &source_stats) == 0;
+	ca_send(stats_sink, TEST_MSG_TYPE_QUIT, 0, 0);
+	ca_send(source, TEST_MSG_TYPE_QUIT, 0, 0);
+	ca_join();
+	ca_stats_get(&after);
+	check("stats of live actors", found);
+	check("actor stats count what it sent", source_stats.sent == TEST_STATS_MSGS);
+	check("actor stats count what it received", sink_stats.received == TEST_STATS_MSGS && sink_stats.depth == 0 && sink_stats.depth_high_water <= TEST_STATS_MSGS);
+	check("stats count spawned and live actors", during.actors_spawned == before.actors_spawned + 2 && during.actors_live == before.actors_live + 2 && after.actors_live == before.actors_live);
+	check("stats count queued and taken messages", during.msgs_queued - before.msgs_queued == TEST_STATS_MSGS && during.msgs_taken - before.msgs_taken == TEST_STATS_MSGS);
+	check("stats count the last messages", after.msgs_queued - before.msgs_queued == TEST_STATS_MSGS + 2 && after.msgs_taken - before.msgs_taken == TEST_STATS_MSGS + 2);
+	check("no stats of an actor gone", ca_actor_stats_get(stats_sink, &sink_stats) == ESRCH);
+}
+
+// ---------------------------------------------------------
+// Tracing: a dump is well formed JSON, one event per line, and
+// every message sent while tracing has a flow from its send to
+// its receive, under the same id.
+// ---------------------------------------------------------
+
+#define TEST_TRACE_MSGS		50
+
+ca_actor_id_t trace_receiver = CA_INVALID_ACTOR_ID;
+
+void* trace_receiverfn(void* args) {
+	int i;
+	for(i = 0; i < TEST_TRACE_MSGS; i++) {
+		ca_release_msg(ca_receive());
+	}
+	return 0;
+}
+
+void* trace_senderfn(void* args) {
+	int i;
+	for(i = 0; i < TEST_TRACE_MSGS; i++) {
+		ca_send(trace_receiver, TEST_MSG_TYPE_DATA, &i, sizeof(i));
+	}
+	return 0;
+}
+
+/*
+ * Read a dump back: check its frame and that each line holds one
+ * event, and gather the ids of flow starts and ends.
+ * Returns 1 if well formed.
+ */
+int trace_parse(FILE* in, unsigned long long* starts, int* start_count, unsigned long long* ends, int* end_count) {
+	char line[1024];
+	int events = 0;
+	int closed = 0;
+	*start_count = *end_count = 0;
+	if(fgets(line, sizeof(line), in) == 0 || strcmp(line, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n") != 0) {
+		return 0;
+	}
+	while(fgets(line, sizeof(line), in) != 0) {
+		size_t length = strlen(line);
+		if(closed || length < 2 || line[length - 1] != '\n') {
+			return 0;
+		}
+		if(strcmp(line, "]}\n") == 0) {
+			closed = 1;
+			continue;
+		}
+		// "{...}," or, last, "{...}", braces balanced
+		int depth = 0;
+		size_t i;
+		length -= line[length - 2] == ',' ? 2 : 1;
+		for(i = 0; i < length; i++) {
+			depth += line[i] == '{';
+			depth -= line[i] == '}';
+			if(depth <= 0 && i != length - 1) {
+				return 0;
+			}
+		}
+		if(line[0] != '{' || depth != 0) {
+			return 0;
+		}
+		events++;
+		char* id = strstr(line, "\"id\":");
+		if(strstr(line, "\"cat\":\"msg\"") == 0 || id == 0) {
+			continue;
+		}
+		unsigned long long value = strtoull(id + 5, 0, 10);
+		if(strstr(line, "\"ph\":\"s\"") != 0 && *start_count < TEST_TRACE_MSGS * 2) {
+			starts[(*start_count)++] = value;
+		} else if(strstr(line, "\"ph\":\"f\"") != 0 && *end_count < TEST_TRACE_MSGS * 2) {
+			ends[(*end_count)++] = value;
+		}
+	}
+	return closed && events > 0;
+}
+
+void test_trace() {
+	unsigned long long starts[TEST_TRACE_MSGS * 2];
+	unsigned long long ends[TEST_TRACE_MSGS * 2];
+	int start_count, end_count;
+	ca_set_trace_ring_size(TEST_TRACE_MSGS * 16);
+	ca_trace_enable(1);
+	trace_receiver = ACTOR_ID(ca_spawn(trace_receiverfn));
+	ca_spawn(trace_senderfn);
+	ca_join();
+	ca_trace_enable(0);
+	FILE* dump = tmpfile();
+	int written = ca_trace_dump(dump);
+	rewind(dump);
+	int parsed = trace_parse(dump, starts, &start_count, ends, &end_count);
+	fclose(dump);
+	check("trace dump parses", written >= 0 && parsed);
+#if CA_TRACE == 1
+	int paired = start_count == TEST_TRACE_MSGS && end_count == TEST_TRACE_MSGS;
+	int i, j;
+	for(i = 0; paired && i < start_count; i++) {
+		int found = 0;
+		for(j = 0; j < end_count; j++) {
+			found += ends[j] == starts[i];
+		}
+		paired = starts[i] != 0 && found == 1;
+	}
+	check("trace has a send/receive flow per message", paired);
+#endif
+}
+
+// ---------------------------------------------------------
+// Affinity: an actor spawned with a CPU in its options runs on
+// that one alone, and none is spawned if it may run on no CPU
+// of ours. Tasks go wherever workers take them: only checked
+// with actors on their own thread.
+// ---------------------------------------------------------
+
+int affinity_pinned = 0;
+
+void* affinity_fn(void* args) {
+	cpu_set_t set;
+	affinity_pinned = sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1 && CPU_ISSET(*(int*)args, &set);
+	return 0;
+}
+
+void test_affinity() {
+	cpu_set_t allowed;
+	int cpu;
+	int pinned = -1;
+	int unavailable = -1;
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	for(cpu = 0; cpu < CA_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+		if(CPU_ISSET(cpu, &allowed)) {
+			pinned = cpu;
+		} else {
+			unavailable = cpu;
+		}
+	}
+	ca_spawn_opts_t opts = CA_SPAWN_OPTS_INIT;
+	CA_SPAWN_OPTS_CPU(&opts, pinned);
+	ca_actor_t* actor = ca_spawn_opts(affinity_fn, &pinned, &opts);
+	ca_join();
+	check("spawn with a CPU", actor != 0);
+#if CA_SCHED_DEFAULT == CA_SCHED_THREADS
+	check("spawn opts pin the actor to its CPU", affinity_pinned);
+	if(unavailable >= 0) {
+		ca_spawn_opts_t elsewhere = CA_SPAWN_OPTS_INIT;
+		CA_SPAWN_OPTS_CPU(&elsewhere, unavailable);
+		check("no spawn with no CPU of ours", ca_spawn_opts(affinity_fn, &unavailable, &elsewhere) == 0);
+	}
+#endif
+}
+
+// ---------------------------------------------------------
+// Handlers: one is called for each message in turn until it
+// returns 1, then it is gone, and whatever was left in its
+// mailbox is released, moved payloads included.
+// ---------------------------------------------------------
+
+#define TEST_HANDLER_BEFORE	3
+#define TEST_HANDLER_AFTER	5
+
+int handler_released = 0;
+
+void handler_release(void* data, size_t data_size) {
+	__atomic_add_fetch(&handler_released, 1, __ATOMIC_SEQ_CST);
+	free(data);
+}
+
+int counting_handler(void* state, ca_msg_t* msg) {
+	int* handled = (int*)state;
+	if(msg->type == TEST_MSG_TYPE_SILENT) {
+		// Holds its worker up while the rest gets queued
+		usleep(50000);
+	}
+	(*handled)++;
+	return msg->type == TEST_MSG_TYPE_QUIT;
+}
+
+void handler_send(ca_actor_id_t id, unsigned long type) {
+	ca_send_move(id, type, malloc(sizeof(int)), sizeof(int), handler_release);
+}
+
+void test_handlers() {
+	int handled = 0;
+	int i;
+	ca_actor_id_t handler = ACTOR_ID(ca_spawn_handler(counting_handler, &handled));
+	handler_send(handler, TEST_MSG_TYPE_SILENT);
+	for(i = 0; i < TEST_HANDLER_BEFORE; i++) {
+		handler_send(handler, TEST_MSG_TYPE_DATA);
+	}
+	handler_send(handler, TEST_MSG_TYPE_QUIT);
+	for(i = 0; i < TEST_HANDLER_AFTER; i++) {
+		handler_send(handler, TEST_MSG_TYPE_DATA);
+	}
+	int waited = ca_wait_actor(handler) == 0;
+	check("handler returning 1 exits", waited && handled == TEST_HANDLER_BEFORE + 2);
+	check("handler leftovers are released", __atomic_load_n(&handler_released, __ATOMIC_SEQ_CST) == TEST_HANDLER_BEFORE + TEST_HANDLER_AFTER + 2);
+}
+
+// ---------------------------------------------------------
+// Receive spin: messages sent while the receiver spins, as its
+// spin times out, or once it has gone to sleep all get through,
+// none of them left waiting for the next one.
+// ---------------------------------------------------------
+
+#define TEST_SPIN_MSGS		40
+#define TEST_SPIN_NS		500000
+
+int spin_received = 0;
+
+void* spin_receiverfn(void* args) {
+	int i;
+	for(i = 0; i < TEST_SPIN_MSGS; i++) {
+		ca_msg_t* msg = ca_receive_timeout(1000);
+		if(msg == 0) {
+			break;
+		}
+		spin_received += *(int*)msg->data == i;
+		ca_release_msg(msg);
+	}
+	return 0;
+}
+
+void test_receive_spin() {
+	int i;
+	ca_set_receive_spin(TEST_SPIN_NS);
+	uint64_t start = now_ms();
+	ca_actor_id_t receiver = ACTOR_ID(ca_spawn(spin_receiverfn));
+	for(i = 0; i < TEST_SPIN_MSGS; i++) {
+		// Within the spin, around its end, and well after it
+		usleep(i % 4 == 3 ? 5000 : (i % 4) * TEST_SPIN_NS / 2000);
+		ca_send(receiver, TEST_MSG_TYPE_DATA, &i, sizeof(i));
+	}
+	ca_join();
+	ca_set_receive_spin(-1);
+	// A lost wakeup would only see its message once the receive timed out
+	check("messages get through after a spin timeout", spin_received == TEST_SPIN_MSGS && now_ms() - start < 1000);
+}
+
+// ---------------------------------------------------------
+// Nodes: a message goes to another process and back; once
+// that process is gone and another one joins as the same
+// node, ids of the old one are refused and the new one gets
+// messages. Both are forked before any thread exists.
+// ---------------------------------------------------------
+
+int node_gone[2];		// Pipe: first node 2 may exit
+int node_back[2];		// Pipe: second node 2 may join
+pid_t node_pids[2];
+int node_round_trip = 0;
+
+void* node_echofn(void* args) {
+	for(;;) {
+		ca_msg_t* msg = ca_receive();
+		if(msg->type == TEST_MSG_TYPE_QUIT) {
+			ca_release_msg(msg);
+			break;
+		}
+		int value = *(int*)msg->data + 1;
+		ca_reply(msg, TEST_MSG_TYPE_ADD, &value, sizeof(value));
+		ca_release_msg(msg);
+	}
+	return 0;
+}
+
+void* node_clientfn(void* args) {
+	ca_actor_id_t peer = ca_node_lookup(2, 5000);
+	int value = 41;
+	ca_send(peer, TEST_MSG_TYPE_ADD, &value, sizeof(value));
+	ca_msg_t* reply = ca_receive_timeout(5000);
+	node_round_trip = reply != 0 && CA_ACTOR_ID_NODE(reply->src_id) == 2 && *(int*)reply->data == 42;
+	if(reply != 0) {
+		ca_release_msg(reply);
+	}
+	return 0;
+}
+
+// The second node 2 runs until told to quit; the first one
+// exits as if it crashed, without leaving
+void node_fork() {
+	char go;
+	shm_unlink(TEST_NODE_SEGMENT);
+	if(pipe(node_gone) != 0 || pipe(node_back) != 0) {
+		node_pids[0] = node_pids[1] = -1;
+		return;
+	}
+	int incarnation;
+	for(incarnation = 0; incarnation < 2; incarnation++) {
+		node_pids[incarnation] = fork();
+		if(node_pids[incarnation] != 0) {
+			continue;
+		}
+		if(incarnation == 1 && read(node_back[0], &go, 1) != 1) {
+			_exit(1);
+		}
+		if(ca_node_join(TEST_NODE_SEGMENT, 2) != 0) {
+			_exit(1);
+		}
+		ca_node_publish(ACTOR_ID(ca_spawn(node_echofn)));
+		if(incarnation == 0) {
+			(void)read(node_gone[0], &go, 1);
+			_exit(0);
+		}
+		ca_join();
+		ca_node_leave();
+		_exit(0);
+	}
+}
+
+void test_nodes() {
+	int status;
+	if(node_pids[0] < 0 || node_pids[1] < 0 || ca_node_join(TEST_NODE_SEGMENT, 1) != 0) {
+		check("node join", 0);
+		return;
+	}
+	ca_spawn(node_clientfn);
+	ca_join();
+	check("node delivery", node_round_trip);
+	ca_actor_id_t old = ca_node_lookup(2, 5000);
+	(void)write(node_gone[1], "x", 1);
+	waitpid(node_pids[0], &status, 0);
+	(void)write(node_back[1], "x", 1);
+	// Waits for the next process to publish, the old one being gone
+	ca_actor_id_t fresh = ca_node_lookup(2, 5000);
+	check("node lookup after reset", fresh != CA_INVALID_ACTOR_ID && fresh != old);
+	check("node stale id refused", ca_try_send(old, TEST_MSG_TYPE_ADD, 0, 0) == ESRCH);
+	node_round_trip = 0;
+	ca_spawn(node_clientfn);
+	ca_join();
+	check("node delivery after reset", node_round_trip);
+	ca_send(fresh, TEST_MSG_TYPE_QUIT, 0, 0);
+	waitpid(node_pids[1], &status, 0);
+	check("node exit", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	ca_node_leave();
+	shm_unlink(TEST_NODE_SEGMENT);
+}
 int main(int argc, char **argv) {
+	node_fork();
 	ca_actor_t* pingactor = ca_spawn(pingfn);
 	printf("Spawned ping actor id#%lu\n", (unsigned long)ACTOR_ID(pingactor));
 	ca_join();
+	test_pools();
+	test_calls();
+	test_selective_receive();
+	test_priority_lanes();
+	test_bounded_mailboxes();
+	test_timers();
+	test_exits();
+	test_broadcast();
+	test_batches();
+	test_stats();
+	test_trace();
+	test_affinity();
+	test_handlers();
+	test_receive_spin();
+	test_nodes();
 	printf("All actors are down. I'm done.\n");
-	return 0;
+	return failures == 0 ? 0 : 1;
 }
@@ -0,0 +1,97 @@
+/* 
+ * This file is part of the CActor library.
+ *  
+ * Copyright (c) 2012 Chris Ravenscroft
+ *  
+ * This code is dual-licensed under the terms of the Apache License Version 2.0 and
+ * the terms of the General Public License (GPL) Version 2.
+ * You may use this code according to either of these licenses as is most appropriate
+ * for your project on a case-by-case basis.
+ * 
+ * The terms of each license can be found in the root directory of this project's repository as well as at:
+ * 
+ * * http://www.apache.org/licenses/LICENSE-2.0
+ * * http://www.gnu.org/licenses/gpl-2.0.txt
+ *  
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under these Licenses is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See each License for the specific language governing permissions and
+ * limitations under that License.
+ */
+
+/*
+ * ca::send() builds each object inside its message, and the message's
+ * release destroys it: every object must be destroyed exactly once,
+ * receivers done or not.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "cactor.hpp"
+
+#define NUM_MSGS	2001
+
+std::atomic<long> alive(0);
+
+// Holds memory of its own, which a missed destructor would leak and
+// a second one free twice
+struct payload {
+	std::vector<int> values;
+	std::string text;
+	payload(int n) : values(n % 8, n), text(n % 40, 'x') { alive++; }
+	payload(const payload& other) : values(other.values), text(other.text) { alive++; }
+	payload(payload&& other) : values(std::move(other.values)), text(std::move(other.text)) { alive++; }
+	~payload() { alive--; }
+};
+
+struct quit {};
+
+long total = 0;
+
+struct summer : ca::actor<payload, quit> {
+	long sum = 0;
+	void on(payload& msg) override {
+		for(int value : msg.values) {
+			sum += value;
+		}
+		sum += msg.text.size();
+	}
+	void on(quit&) override {
+		total = sum;
+		stop();
+	}
+};
+
+// Leaves its messages behind: they go when its mailbox is pruned
+struct quitter : ca::actor<payload, quit> {
+	void on(payload&) override {}
+	void on(quit&) override { stop(); }
+};
+
+int main(int argc, char **argv) {
+	ca::actor_id id = ca::spawn<summer>();
+	ca::actor_id early = ca::spawn<quitter>();
+	ca::send(early, quit());
+	long expected = 0;
+	int i;
+	for(i = 0; i < NUM_MSGS; i++) {
+		payload value(i);
+		expected += (long)value.values.size() * i + (long)value.text.size();
+		if(i % 2 == 0) {
+			ca::send(id, std::move(value));
+		}
+		else {
+			ca::send(id, value);
+		}
+		ca::send(early, payload(i));
+	}
+	ca::send(id, quit());
+	ca_join();
+	printf("sum: %s\n", total == expected ? "ok" : "FAILED");
+	printf("objects destroyed once: %s\n", alive == 0 ? "ok" : "FAILED");
+	printf("All actors are down. I'm done.\n");
+	return total == expected && alive == 0 ? 0 : 1;
+}
@@ -1,2 +1,4 @@
 gcc -lpthread -g cactor_test.c cactor.c -o cactor_test
 gcc -lpthread -g cactor_test_short.c cactor.c -o cactor_test_short
+gcc -lpthread -O2 cactor_bench.c cactor.c -o cactor_bench
+gcc -g -c cactor.c -o cactor.o && g++ -lpthread -std=c++17 -g cactor_test_cpp.cpp cactor.o -o cactor_test_cpp; rm -f cactor.o